@@ -30,14 +30,78 @@
 
 #define BSLUG_SECTION(x) __attribute__((__section__ (".bslug." x)))
 
+/* Puts a variable in MEM2 rather than taking memory from the game's MEM1.
+ * Suits large data which is rarely used, such as tables and fonts. Don't mix
+ * const and non-const variables in one file; use BSLUG_SECTION("mem2.x")
+ * with different names for them instead. Functions stay in MEM1
+ * regardless, as does anything when the window is full or the IOS's heap
+ * overlaps it. */
+#define BSLUG_MEM2 BSLUG_SECTION("mem2")
+
+/* Declares one of the game's small data variables, which code built with
+ * -msdata=eabi then reaches from r13 or r2 in one instruction. Only for
+ * extern declarations; a module has no small data of its own. */
+#define BSLUG_SDATA __attribute__((__section__ (".sdata")))
+
+/* A hash of a symbol name, worked out by the compiler for a string literal.
+ * The loader looks names up by it, comparing the names themselves only when
+ * hashes match. It is the top 24 bits of FNV-1a over the length and the first
+ * BSLUG_NAME_HASH_LENGTH characters padded with zeros; Symbol_NameHash in the
+ * loader does the same at run time. */
+#define BSLUG_NAME_HASH_LENGTH 32
+#define BSLUG_NAME_HASH_CHAR(s, i) \
+    ((i) < sizeof(s) - 1 ? (uint8_t)(s)[(i) < sizeof(s) ? (i) : 0] : 0)
+#define BSLUG_NAME_HASH_STEP(h, c) ((uint32_t)(((h) ^ (c)) * 16777619u))
+#define BSLUG_NAME_HASH_4(h, s, i) \
+    BSLUG_NAME_HASH_STEP(BSLUG_NAME_HASH_STEP(BSLUG_NAME_HASH_STEP( \
+        BSLUG_NAME_HASH_STEP(h, BSLUG_NAME_HASH_CHAR(s, i)), \
+        BSLUG_NAME_HASH_CHAR(s, (i) + 1)), \
+        BSLUG_NAME_HASH_CHAR(s, (i) + 2)), \
+        BSLUG_NAME_HASH_CHAR(s, (i) + 3))
+#define BSLUG_NAME_HASH_16(h, s, i) \
+    BSLUG_NAME_HASH_4(BSLUG_NAME_HASH_4(BSLUG_NAME_HASH_4(BSLUG_NAME_HASH_4( \
+        h, s, i), s, (i) + 4), s, (i) + 8), s, (i) + 12)
+#define BSLUG_NAME_HASH(s) \
+    (BSLUG_NAME_HASH_16(BSLUG_NAME_HASH_16( \
+        BSLUG_NAME_HASH_STEP(2166136261u, (sizeof(s) - 1) & 0xff), \
+        s, 0), s, 16) >> 8)
+
 typedef enum bslug_loader_entry_type_t {
     BSLUG_LOADER_ENTRY_FUNCTION,
     BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY,
-    BSLUG_LOADER_ENTRY_EXPORT
+    BSLUG_LOADER_ENTRY_EXPORT,
+    BSLUG_LOADER_ENTRY_HOOK_AT
 } bslug_loader_entry_type_t;
 
+/* The game's registers when a BSLUG_HOOK_AT callback is called. gpr[1] is
+ * the game's stack pointer. Changes to anything else are seen by the game
+ * once the callback returns. Only the volatile floating point registers are
+ * here; the callback keeps the others as any function does. fpr holds the
+ * first (ps0) half of each and ps1 the second paired single half, as
+ * OSSaveFPUContext keeps them, so paired singles must be enabled (HID2[PSE]),
+ * which the game does at start up. fpscr is the low word of the doubleword
+ * mffs writes; fpscr_pad is its unused high word.
+ * Added in BSLUG_LIB_VERSION 0.1.4 */
+typedef struct bslug_context_t {
+    uint32_t gpr[32];
+    uint32_t cr;
+    uint32_t lr;
+    uint32_t ctr;
+    uint32_t xer;
+    double fpr[14];
+    uint32_t fpscr_pad;
+    uint32_t fpscr;
+    float ps1[14];
+} bslug_context_t;
+
+typedef struct bslug_hook_t {
+    size_t offset;
+    void (*callback)(bslug_context_t *context);
+} bslug_hook_t;
+
 typedef struct bslug_loader_entry_t {
-    bslug_loader_entry_type_t type;
+    /* a bslug_loader_entry_type_t and a name hash; see below. */
+    uint32_t type;
     union {
         struct {
             const char *name;
@@ -47,14 +111,30 @@ typedef struct bslug_loader_entry_t {
             const char *name;
             const void *target;
         } export;
+        struct {
+            const char *name;
+            const bslug_hook_t *hook;
+        } hook;
     } data;
 } bslug_loader_entry_t;
 
+/* The low 8 bits of an entry's type field are its type, and the rest are the
+ * BSLUG_NAME_HASH of its name. Modules from before BSLUG_LIB_VERSION 0.1.3
+ * have 0 there instead. Loaders which don't know this would fail on the
+ * whole list, so modules which hash their names declare BSLUG version 0.2 in
+ * their meta, which those loaders skip with a warning. */
+#define BSLUG_LOADER_ENTRY_TYPE(entry) \
+    ((bslug_loader_entry_type_t)((entry)->type & 0xff))
+#define BSLUG_LOADER_ENTRY_HASH(entry) ((entry)->type >> 8)
+#define BSLUG_LOADER_ENTRY_TYPE_HASH(type, name) \
+    ((uint32_t)(type) | (uint32_t)BSLUG_NAME_HASH(name) << 8)
+
 #define BSLUG_REPLACE(original_func, replace_func) \
     extern const bslug_loader_entry_t bslug_load_ ## original_func \
         BSLUG_SECTION("load"); \
     const bslug_loader_entry_t bslug_load_ ## original_func = { \
-        .type = BSLUG_LOADER_ENTRY_FUNCTION, \
+        .type = BSLUG_LOADER_ENTRY_TYPE_HASH( \
+            BSLUG_LOADER_ENTRY_FUNCTION, #original_func), \
         .data = { \
             .function = { \
                 .name = #original_func, \
@@ -66,7 +146,8 @@ typedef struct bslug_loader_entry_t {
     extern const bslug_loader_entry_t bslug_load_ ## original_func \
         BSLUG_SECTION("load"); \
     const bslug_loader_entry_t bslug_load_ ## original_func = { \
-        .type = BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY, \
+        .type = BSLUG_LOADER_ENTRY_TYPE_HASH( \
+            BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY, #original_func), \
         .data = { \
             .function = { \
                 .name = #original_func, \
@@ -78,7 +159,8 @@ typedef struct bslug_loader_entry_t {
     extern const bslug_loader_entry_t bslug_export_ ## symbol \
         BSLUG_SECTION("load"); \
     const bslug_loader_entry_t bslug_export_ ## symbol = { \
-        .type = BSLUG_LOADER_ENTRY_EXPORT, \
+        .type = BSLUG_LOADER_ENTRY_TYPE_HASH( \
+            BSLUG_LOADER_ENTRY_EXPORT, #symbol), \
         .data = { \
             .export = { \
                 .name = #symbol, \
@@ -87,12 +169,39 @@ typedef struct bslug_loader_entry_t {
         } \
     }
 
+/* Calls hook_func with the game's registers each time the game reaches the
+ * instruction symbol_offset bytes into symbol, before that instruction runs.
+ * symbol_offset must be a literal number which is a multiple of 4. Unlike
+ * BSLUG_REPLACE, the function needn't be called through its start, and
+ * several modules may hook the same instruction.
+ * Added in BSLUG_LIB_VERSION 0.1.4 */
+#define BSLUG_HOOK_AT(symbol, symbol_offset, hook_func) \
+    static const bslug_hook_t \
+        bslug_hook_ ## symbol ## _ ## symbol_offset = { \
+        .offset = (symbol_offset), \
+        .callback = &(hook_func) \
+    }; \
+    extern const bslug_loader_entry_t \
+        bslug_load_hook_ ## symbol ## _ ## symbol_offset \
+        BSLUG_SECTION("load"); \
+    const bslug_loader_entry_t \
+        bslug_load_hook_ ## symbol ## _ ## symbol_offset = { \
+        .type = BSLUG_LOADER_ENTRY_TYPE_HASH( \
+            BSLUG_LOADER_ENTRY_HOOK_AT, #symbol), \
+        .data = { \
+            .hook = { \
+                .name = #symbol, \
+                .hook = &bslug_hook_ ## symbol ## _ ## symbol_offset \
+            } \
+        } \
+    }
+
 #define BSLUG_META(id, value) \
     extern const char bslug_meta_ ## id [] BSLUG_SECTION("meta"); \
     const char bslug_meta_ ## id [] = #id "=" value
 
 #define BSLUG_MODULE_GAME(x)    BSLUG_META(game, x)
-#define BSLUG_MODULE_NAME(x)    BSLUG_META(name, x); BSLUG_META(bslug, "0.1")
+#define BSLUG_MODULE_NAME(x)    BSLUG_META(name, x); BSLUG_META(bslug, "0.2")
 #define BSLUG_MODULE_AUTHOR(x)  BSLUG_META(author, x)
 #define BSLUG_MODULE_VERSION(x) BSLUG_META(version, x)
 #define BSLUG_MODULE_LICENSE(x) BSLUG_META(license, x)
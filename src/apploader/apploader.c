@@ -320,6 +320,9 @@ static void *Aploader_Main(void *arg) {
     os0->info.arena_high = os0->info.arena_high - module_list_size;
     os0->info.fst = (char *)os0->info.fst - module_list_size;
     os0->info.fst_size += module_list_size;
+    if (module_mem2_size > 0 &&
+        os1->mem2_arena_high > (uint32_t)(MODULE_MEM2_END - module_mem2_size))
+        os1->mem2_arena_high = (uint32_t)(MODULE_MEM2_END - module_mem2_size);
 
     os0->threads.debug_monitor_location = (void *)0x81800000;
     os0->threads.simulated_memory_size = 0x01800000;
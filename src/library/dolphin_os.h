@@ -112,7 +112,10 @@ typedef struct {
     uint8_t padding114[0x118 - 0x114]; /* 0x114 */
     uint32_t mem2_size; /* 0x118 */
     uint32_t mem2_simulated_size; /* 0x11c */
-    uint8_t padding120[0x130 - 0x120]; /* 0x120 */
+    void *mem2_end; /* 0x120 */
+    uint32_t mem2_arena_low; /* 0x124 */
+    uint32_t mem2_arena_high; /* 0x128 */
+    uint8_t padding12c[0x130 - 0x12c]; /* 0x12c */
     uint32_t ios_heap_start; /* 0x130 */
     uint32_t ios_heap_end; /* 0x134 */
     uint32_t hollywood_version; /* 0x138 */
@@ -44,6 +44,7 @@ typedef struct {
 static bool Event_Init(event_t *event);
 static bool Event_Destroy(event_t *event);
 static bool Event_Wait(event_t *event);
+static bool Event_Triggered(const event_t *event);
 static bool Event_Trigger(event_t *event);
 static bool Event_Reset(event_t *event);
 
@@ -80,6 +81,12 @@ static inline bool Event_Wait(event_t *event) {
     }
 }
 
+/* Whether the event has been triggered yet, without waiting for it. */
+static inline bool Event_Triggered(const event_t *event) {
+    assert(event);
+    return event->triggered;
+}
+
 static inline bool Event_Trigger(event_t *event) {
     assert(event);
     assert(event->sem != LWP_SEM_NULL);
@@ -56,6 +56,8 @@ int main(void) {
     /* The game's boot loader is statically loaded at 0x81200000, so we'd better
      * not start mallocing there! */
     SYS_SetArena1Hi((void *)0x81200000);
+    /* Nor in the MEM2 window for modules. */
+    SYS_SetArena2Hi(MODULE_MEM2_START);
 
     /* initialise all subsystems */
     if (!Event_Init(&main_event_fat_loaded))
@@ -187,6 +189,9 @@ int main(void) {
     
     Event_Wait(&apploader_event_complete);
     Event_Wait(&module_event_complete);
+#ifndef NDEBUG
+    printf("%u cache operations.\n", module_cache_op_count);
+#endif
     fatUnmount("sd");
     __io_wiisd.shutdown();
     
@@ -0,0 +1,288 @@
+/* hook.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "hook.h"
+
+#include <assert.h>
+#include <bslug_include/bslug.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const hook_chain_t *hook_chain_sort;
+
+/* the stack frame of a thunk: the back chain and LR save word, then the
+ * context. Doubleword aligned, as the ABI needs. */
+#define HOOK_THUNK_CONTEXT 8
+#define HOOK_THUNK_FRAME \
+    ((HOOK_THUNK_CONTEXT + sizeof(bslug_context_t) + 7) & ~7)
+#define HOOK_THUNK_OFFSET(field) \
+    (HOOK_THUNK_CONTEXT + offsetof(bslug_context_t, field))
+
+/* D-form instructions on r1. */
+#define HOOK_STW(rs, d) (0x90010000 | (rs) << 21 | ((d) & 0xffff))
+#define HOOK_LWZ(rd, d) (0x80010000 | (rd) << 21 | ((d) & 0xffff))
+#define HOOK_STFD(frs, d) (0xd8010000 | (frs) << 21 | ((d) & 0xffff))
+#define HOOK_LFD(frd, d) (0xc8010000 | (frd) << 21 | ((d) & 0xffff))
+#define HOOK_ADDI(rd, d) (0x38010000 | (rd) << 21 | ((d) & 0xffff))
+#define HOOK_STFS(frs, d) (0xd0010000 | (frs) << 21 | ((d) & 0xffff))
+#define HOOK_LFS(frd, d) (0xc0010000 | (frd) << 21 | ((d) & 0xffff))
+/* ps_merge11 fr, fr, fr: the paired single half ps1 into ps0 as well. */
+#define HOOK_PS_MERGE11(fr) \
+    (0x100004e0 | (fr) << 21 | (fr) << 16 | (fr) << 11)
+
+static int Hook_ChainCompare(const void *left, const void *right);
+static bool Hook_ChainSame(
+    const hook_chain_t *left, const hook_chain_t *right);
+
+bool Hook_ChainBuild(hook_chain_t *hooks, size_t count) {
+    size_t *order, i, used;
+    
+    assert(hooks != NULL || count == 0);
+    
+    order = malloc(count * sizeof(size_t));
+    if (order == NULL && count > 0)
+        return false;
+    
+    used = 0;
+    for (i = 0; i < count; i++) {
+        hooks[i].first = false;
+        hooks[i].next = HOOK_CHAIN_END;
+        hooks[i].trampoline = 0;
+        if (hooks[i].name != NULL)
+            order[used++] = i;
+    }
+    
+    /* by function, and within that in the order the modules are linked. */
+    hook_chain_sort = hooks;
+    qsort(order, used, sizeof(size_t), &Hook_ChainCompare);
+    hook_chain_sort = NULL;
+    
+    for (i = 0; i < used; i++) {
+        if (i == 0 || !Hook_ChainSame(hooks + order[i - 1], hooks + order[i]))
+            hooks[order[i]].first = true;
+        if (i + 1 < used &&
+            Hook_ChainSame(hooks + order[i], hooks + order[i + 1]))
+            hooks[order[i]].next = order[i + 1];
+    }
+    
+    free(order);
+    return true;
+}
+
+/* Orders indices into hook_chain_sort by hash, name and then index. Indices of
+ * the same function only compare equal to themselves. */
+static int Hook_ChainCompare(const void *left, const void *right) {
+    const hook_chain_t *hook_left, *hook_right;
+    size_t index_left, index_right;
+    int result;
+    
+    index_left = *(const size_t *)left;
+    index_right = *(const size_t *)right;
+    hook_left = hook_chain_sort + index_left;
+    hook_right = hook_chain_sort + index_right;
+    
+    if (hook_left->hash != hook_right->hash)
+        return hook_left->hash < hook_right->hash ? -1 : 1;
+    result = strcmp(hook_left->name, hook_right->name);
+    if (result != 0)
+        return result;
+    return (index_left > index_right) - (index_left < index_right);
+}
+
+/* Whether left and right replace the same function. */
+static bool Hook_ChainSame(
+        const hook_chain_t *left, const hook_chain_t *right) {
+    return left->hash == right->hash && strcmp(left->name, right->name) == 0;
+}
+
+bool Hook_ChainLink(
+        hook_chain_t *hooks, size_t hook, uint32_t *trampoline,
+        uint32_t trampoline_address, uint32_t instruction, uint32_t address,
+        uint32_t *branch) {
+    assert(hooks != NULL);
+    assert(hooks[hook].name != NULL);
+    assert(branch != NULL);
+    
+    *branch = 0;
+    if (hooks[hook].first) {
+        if (trampoline != NULL) {
+            /* b replacement, which must be within 32MiB. */
+            if (hooks[hook].target - address + 0x2000000 >= 0x4000000)
+                return false;
+            Hook_Trampoline(
+                trampoline, trampoline_address, instruction, address);
+            *branch =
+                0x48000000 + ((hooks[hook].target - address) & 0x3fffffc);
+        }
+        hooks[hook].trampoline = trampoline_address;
+    }
+    
+    assert(hooks[hook].trampoline != 0);
+    if (hooks[hook].next != HOOK_CHAIN_END)
+        hooks[hooks[hook].next].trampoline = hooks[hook].trampoline;
+    return true;
+}
+
+uint32_t Hook_ChainCallThrough(const hook_chain_t *hooks, size_t hook) {
+    assert(hooks != NULL);
+    assert(hooks[hook].name != NULL);
+    
+    if (hooks[hook].next != HOOK_CHAIN_END)
+        return hooks[hooks[hook].next].target;
+    return hooks[hook].trampoline;
+}
+
+size_t Hook_TrampolineSize(uint32_t instruction) {
+    /* a bc needs a b to reach its target. */
+    if ((instruction & 0xfc000002) == 0x40000000)
+        return 12;
+    return 8;
+}
+
+size_t Hook_Trampoline(
+        uint32_t *trampoline, uint32_t trampoline_address,
+        uint32_t instruction, uint32_t address) {
+    assert(trampoline != NULL);
+    
+    switch (instruction & 0xfc000002) {
+        case 0x40000000: { /* bc */
+            uint32_t target;
+            int32_t offset;
+            
+            offset = instruction & 0x0000fffc;
+            if (offset & 0x00008000)
+                offset -= 0x00010000;
+            target = address + offset;
+            
+            /* Conditional branch to either target or next instruction.
+             * We can't just conditional branch to original target as
+             * it is probably too far for a single branch. */
+            trampoline[0] = (instruction & 0xffff0003) | 8;
+            /* branch to second instruction of function. */
+            trampoline[1] =
+                0x48000000 +
+                ((address + 4 - (trampoline_address + 4)) & 0x3fffffc);
+            /* branch to the target of the original branch. */
+            trampoline[2] =
+                0x48000000 +
+                ((target - (trampoline_address + 8)) & 0x3fffffc);
+            return 3;
+        } case 0x48000000: { /* b */
+            uint32_t target;
+            int32_t offset;
+            
+            offset = instruction & 0x03fffffc;
+            if (offset & 0x02000000)
+                offset -= 0x04000000;
+            target = address + offset;
+            
+            /* branch to the target of the original branch. */
+            trampoline[0] =
+                (instruction & 0xfc000003) +
+                ((target - trampoline_address) & 0x3fffffc);
+            /* branch to second instruction of function. */
+            trampoline[1] =
+                0x48000000 +
+                ((address + 4 - (trampoline_address + 4)) & 0x3fffffc);
+            return 2;
+        } default: { /* other (inc ba, and bca) */
+            /* copy the original instruction. */
+            trampoline[0] = instruction;
+            /* branch to second instruction of function. */
+            trampoline[1] =
+                0x48000000 +
+                ((address + 4 - (trampoline_address + 4)) & 0x3fffffc);
+            return 2;
+        }
+    }
+}
+
+size_t Hook_Thunk(
+        uint32_t *thunk, uint32_t thunk_address, uint32_t callback,
+        uint32_t instruction, uint32_t address) {
+    size_t n, i;
+    
+    assert(thunk != NULL);
+    
+    n = 0;
+    /* stwu r1, -frame(r1) */
+    thunk[n++] = 0x94210000 | (-HOOK_THUNK_FRAME & 0xffff);
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(gpr[0]));
+    /* stmw r2, gpr[2](r1) */
+    thunk[n++] = 0xbc410000 | HOOK_THUNK_OFFSET(gpr[2]);
+    /* the game's r1, before the frame. */
+    thunk[n++] = HOOK_ADDI(0, HOOK_THUNK_FRAME);
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(gpr[1]));
+    thunk[n++] = 0x7c000026; /* mfcr r0 */
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(cr));
+    thunk[n++] = 0x7c0802a6; /* mflr r0 */
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(lr));
+    thunk[n++] = 0x7c0902a6; /* mfctr r0 */
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(ctr));
+    thunk[n++] = 0x7c0102a6; /* mfxer r0 */
+    thunk[n++] = HOOK_STW(0, HOOK_THUNK_OFFSET(xer));
+    for (i = 0; i < 14; i++)
+        thunk[n++] = HOOK_STFD(i, HOOK_THUNK_OFFSET(fpr[i]));
+    /* then ps1 of each, as OSSaveFPUContext does. */
+    for (i = 0; i < 14; i++) {
+        thunk[n++] = HOOK_PS_MERGE11(i);
+        thunk[n++] = HOOK_STFS(i, HOOK_THUNK_OFFSET(ps1[i]));
+    }
+    thunk[n++] = 0xfc00048e; /* mffs f0 */
+    thunk[n++] = HOOK_STFD(0, HOOK_THUNK_OFFSET(fpscr_pad));
+    thunk[n++] = HOOK_ADDI(3, HOOK_THUNK_CONTEXT);
+    
+    assert(n == HOOK_THUNK_CALL);
+    /* bl callback */
+    thunk[n] =
+        0x48000001 + ((callback - (thunk_address + n * 4)) & 0x3fffffc);
+    n++;
+    
+    thunk[n++] = HOOK_LFD(0, HOOK_THUNK_OFFSET(fpscr_pad));
+    thunk[n++] = 0xfdfe058e; /* mtfsf 0xff, f0 */
+    /* lfs sets both halves, then lfd only ps0. */
+    for (i = 0; i < 14; i++) {
+        thunk[n++] = HOOK_LFS(i, HOOK_THUNK_OFFSET(ps1[i]));
+        thunk[n++] = HOOK_LFD(i, HOOK_THUNK_OFFSET(fpr[i]));
+    }
+    thunk[n++] = HOOK_LWZ(0, HOOK_THUNK_OFFSET(xer));
+    thunk[n++] = 0x7c0103a6; /* mtxer r0 */
+    thunk[n++] = HOOK_LWZ(0, HOOK_THUNK_OFFSET(ctr));
+    thunk[n++] = 0x7c0903a6; /* mtctr r0 */
+    thunk[n++] = HOOK_LWZ(0, HOOK_THUNK_OFFSET(lr));
+    thunk[n++] = 0x7c0803a6; /* mtlr r0 */
+    thunk[n++] = HOOK_LWZ(0, HOOK_THUNK_OFFSET(cr));
+    thunk[n++] = 0x7c0ff120; /* mtcrf 0xff, r0 */
+    thunk[n++] = HOOK_LWZ(0, HOOK_THUNK_OFFSET(gpr[0]));
+    /* lmw r2, gpr[2](r1) */
+    thunk[n++] = 0xb8410000 | HOOK_THUNK_OFFSET(gpr[2]);
+    thunk[n++] = HOOK_ADDI(1, HOOK_THUNK_FRAME);
+    
+    assert(n == HOOK_THUNK_BODY);
+    return n + Hook_Trampoline(
+        thunk + n, thunk_address + n * 4, instruction, address);
+}
@@ -0,0 +1,98 @@
+/* hook.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HOOK_H_
+#define HOOK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hooks put in the game: a branch over the first instruction of a function,
+ * and a trampoline which does that instruction and goes back. Addresses are
+ * those the game sees, so the instructions can be worked out anywhere. */
+
+/* the most words Hook_Trampoline writes. */
+#define HOOK_TRAMPOLINE_MAX 3
+/* the words of a thunk before its trampoline, the word which calls the
+ * callback, and the most bytes Hook_Thunk writes. */
+#define HOOK_THUNK_BODY 100
+#define HOOK_THUNK_CALL 58
+#define HOOK_THUNK_SIZE ((HOOK_THUNK_BODY + HOOK_TRAMPOLINE_MAX) * 4)
+
+#define HOOK_CHAIN_END ((size_t)-1)
+
+/* One replacement of a function. When several modules replace the same
+ * function, the game branches to the first, each calls straight through to
+ * the next, and the last calls the one trampoline. */
+typedef struct {
+    /* NULL for an entry which isn't a replacement. */
+    const char *name;
+    uint32_t hash;
+    /* the replacement function. */
+    uint32_t target;
+    /* set by Hook_ChainBuild: whether this is the replacement the game calls,
+     * and the next replacement of the same function, or HOOK_CHAIN_END. */
+    bool first;
+    size_t next;
+    /* the trampoline to the original, once it has been made. */
+    uint32_t trampoline;
+} hook_chain_t;
+
+/* Links the replacements of each function together in order. Returns false if
+ * out of memory. */
+bool Hook_ChainBuild(hook_chain_t *hooks, size_t count);
+/* Puts hooks[hook] in its chain; done for each in order once Hook_ChainBuild
+ * has run. The first replacement of a function has its trampoline at
+ * trampoline_address. If trampoline is not NULL, that is where it is written,
+ * for the function's first instruction at address, and *branch is set to the
+ * branch to put there instead; otherwise *branch is 0, as it is for the
+ * others, which ignore those arguments. Returns false if the replacement is
+ * out of range of address. */
+bool Hook_ChainLink(
+    hook_chain_t *hooks, size_t hook, uint32_t *trampoline,
+    uint32_t trampoline_address, uint32_t instruction, uint32_t address,
+    uint32_t *branch);
+/* Where calls from the module of hook to its function should go. */
+uint32_t Hook_ChainCallThrough(const hook_chain_t *hooks, size_t hook);
+
+/* The size in bytes of the trampoline for a function starting instruction. */
+size_t Hook_TrampolineSize(uint32_t instruction);
+/* Writes to trampoline, which will be at trampoline_address, the instructions
+ * to do instruction as if at address, then go on to address + 4. Returns the
+ * number of words written. */
+size_t Hook_Trampoline(
+    uint32_t *trampoline, uint32_t trampoline_address,
+    uint32_t instruction, uint32_t address);
+
+/* Writes to thunk, which will be at thunk_address, the instructions for a
+ * BSLUG_HOOK_AT at address: save the registers as a bslug_context_t on the
+ * stack, branch and link to callback with r3 pointing at it, restore them,
+ * then do instruction and go on to address + 4. callback must be in range of
+ * word HOOK_THUNK_CALL. Returns the number of words written. */
+size_t Hook_Thunk(
+    uint32_t *thunk, uint32_t thunk_address, uint32_t callback,
+    uint32_t instruction, uint32_t address);
+
+#endif /* HOOK_H_ */
@@ -0,0 +1,292 @@
+/* link.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "link.h"
+
+#include <assert.h>
+#include <elfdefinitions.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static bool Link_SmallDataOffset(
+    const link_target_t *target, uint32_t address, bool allow_sda2,
+    unsigned int *reg, int32_t *offset);
+
+size_t Link_Width(unsigned int type) {
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_ADDR24:
+        case R_PPC_ADDR14:
+        case R_PPC_ADDR14_BRTAKEN:
+        case R_PPC_ADDR14_BRNTAKEN:
+        case R_PPC_UADDR32:
+        case R_PPC_REL24:
+        case R_PPC_REL14:
+        case R_PPC_REL14_BRTAKEN:
+        case R_PPC_REL14_BRNTAKEN:
+        case R_PPC_REL32:
+        case R_PPC_ADDR30:
+        case R_PPC_SECTOFF:
+        case R_PPC_EMB_NADDR32:
+            return 4;
+        case R_PPC_ADDR16:
+        case R_PPC_ADDR16_HI:
+        case R_PPC_ADDR16_HA:
+        case R_PPC_ADDR16_LO:
+        case R_PPC_UADDR16:
+        case R_PPC_SECTOFF_LO:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_SECTOFF_HA:
+        case R_PPC_EMB_NADDR16:
+        case R_PPC_EMB_NADDR16_LO:
+        case R_PPC_EMB_NADDR16_HI:
+        case R_PPC_EMB_NADDR16_HA:
+        case R_PPC_EMB_SDA21:
+        case R_PPC_SDAREL16:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+link_result_t Link_Apply(
+        const link_target_t *target, const link_image_t *image,
+        uint32_t offset, unsigned int type, int32_t addend, uint32_t symbol) {
+    uint8_t *data;
+    uint32_t position;
+    int32_t value;
+    size_t width;
+    
+    assert(target != NULL);
+    assert(image != NULL);
+    
+    width = Link_Width(type);
+    if (width == 0)
+        return LINK_UNSUPPORTED;
+    
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_ADDR24:
+        case R_PPC_ADDR14:
+        case R_PPC_ADDR14_BRTAKEN:
+        case R_PPC_ADDR14_BRNTAKEN:
+        case R_PPC_UADDR32: {
+            value = (int32_t)symbol + addend;
+            break;
+        } case R_PPC_ADDR16:
+        case R_PPC_ADDR16_HI:
+        case R_PPC_ADDR16_HA:
+        case R_PPC_ADDR16_LO:
+        case R_PPC_UADDR16: {
+            value = (int32_t)symbol + addend;
+            break;
+        } case R_PPC_REL24:
+        case R_PPC_REL14:
+        case R_PPC_REL14_BRTAKEN:
+        case R_PPC_REL14_BRNTAKEN:
+        case R_PPC_REL32:
+        case R_PPC_ADDR30: {
+            value = (int32_t)symbol + addend -
+                (int32_t)(image->address + offset);
+            break;
+        } case R_PPC_SECTOFF: {
+            value = offset + addend;
+            break;
+        } case R_PPC_SECTOFF_LO:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_SECTOFF_HA: {
+            value = offset + addend;
+            break;
+        } case R_PPC_EMB_NADDR32: {
+            value = addend - (int32_t)symbol;
+            break;
+        } case R_PPC_EMB_NADDR16:
+        case R_PPC_EMB_NADDR16_LO:
+        case R_PPC_EMB_NADDR16_HI:
+        case R_PPC_EMB_NADDR16_HA: {
+            value = addend - (int32_t)symbol;
+            break;
+        } case R_PPC_EMB_SDA21:
+        case R_PPC_SDAREL16: {
+            value = (int32_t)symbol + addend;
+            break;
+        } default:
+            return LINK_UNSUPPORTED;
+    }
+    
+    if (offset > image->size || image->size - offset < width)
+        return LINK_OUTSIDE;
+    data = image->data + offset;
+    position = image->address + offset;
+    
+    /* too far for a conditional branch; the compiler must avoid these. */
+    if ((type == R_PPC_REL14 || type == R_PPC_REL14_BRTAKEN ||
+         type == R_PPC_REL14_BRNTAKEN) &&
+        (value < -0x8000 || value >= 0x8000))
+        return LINK_BRANCH_RANGE;
+    
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_UADDR32:
+        case R_PPC_REL32:
+        case R_PPC_SECTOFF:
+        case R_PPC_EMB_NADDR32: {
+            Link_Put32(data, value);
+            break;
+        } case R_PPC_REL24: {
+            if (!Link_BranchInRange(position, position + value))
+                return LINK_BRANCH_RANGE;
+        } /* fallthrough */
+        case R_PPC_ADDR24: {
+            Link_Put32(
+                data, (Link_Get32(data) & 0xfc000003) | (value & 0x03fffffc));
+            break;
+        } case R_PPC_ADDR16:
+        case R_PPC_UADDR16:
+        case R_PPC_EMB_NADDR16: {
+            Link_Put16(data, value);
+            break;
+        } case R_PPC_ADDR16_HI:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_EMB_NADDR16_HI: {
+            Link_Put16(data, value >> 16);
+            break;
+        } case R_PPC_ADDR16_HA:
+        case R_PPC_SECTOFF_HA:
+        case R_PPC_EMB_NADDR16_HA: {
+            Link_Put16(data, (value >> 16) + ((value >> 15) & 1));
+            break;
+        } case R_PPC_ADDR16_LO:
+        case R_PPC_SECTOFF_LO:
+        case R_PPC_EMB_NADDR16_LO: {
+            Link_Put16(data, value & 0xffff);
+            break;
+        } case R_PPC_ADDR14:
+        case R_PPC_REL14: {
+            Link_Put32(
+                data, (Link_Get32(data) & 0xffff0003) | (value & 0x0000fffc));
+            break;
+        } case R_PPC_ADDR14_BRTAKEN:
+        case R_PPC_REL14_BRTAKEN: {
+            Link_Put32(
+                data,
+                (Link_Get32(data) & 0xffdf0003) | (value & 0x0000fffc) |
+                0x00200000);
+            break;
+        } case R_PPC_ADDR14_BRNTAKEN:
+        case R_PPC_REL14_BRNTAKEN: {
+            Link_Put32(
+                data, (Link_Get32(data) & 0xffdf0003) | (value & 0x0000fffc));
+            break;
+        } case R_PPC_ADDR30: {
+            Link_Put32(
+                data, (Link_Get32(data) & 0x00000003) | (value & 0xfffffffc));
+            break;
+        } case R_PPC_EMB_SDA21:
+        case R_PPC_SDAREL16: {
+            unsigned int reg;
+            int32_t small;
+            
+            if (!Link_SmallDataOffset(
+                    target, value, type == R_PPC_EMB_SDA21, &reg, &small))
+                return LINK_SMALL_DATA_RANGE;
+            
+            /* the relocation is on the low half of a D-form instruction;
+             * SDA21 chooses its base register too. */
+            if (type == R_PPC_EMB_SDA21) {
+                uint8_t *instruction;
+                
+                if (offset < (position & 3))
+                    return LINK_OUTSIDE;
+                instruction = data - (position & 3);
+                Link_Put32(
+                    instruction,
+                    (Link_Get32(instruction) & 0xffe0ffff) | (reg << 16));
+            }
+            Link_Put16(data, small);
+            break;
+        }
+    }
+    
+    return LINK_OK;
+}
+
+/* Finds a register and offset which reach address: r13 for the game's
+ * .sdata/.sbss, r2 for its .sdata2/.sbss2 or r0 for the first and last 32KiB
+ * of the address space. A module's own data is never in reach; modules use
+ * the small data relocations only to address the game's variables. */
+static bool Link_SmallDataOffset(
+        const link_target_t *target, uint32_t address, bool allow_sda2,
+        unsigned int *reg, int32_t *offset) {
+    assert(reg != NULL);
+    assert(offset != NULL);
+    
+    if (target->sda_base != 0 &&
+        address - target->sda_base + 0x8000 < 0x10000) {
+        *reg = 13;
+        *offset = address - target->sda_base;
+        return true;
+    }
+    if (!allow_sda2)
+        return false;
+    if (target->sda2_base != 0 &&
+        address - target->sda2_base + 0x8000 < 0x10000) {
+        *reg = 2;
+        *offset = address - target->sda2_base;
+        return true;
+    }
+    if (address + 0x8000 < 0x10000) {
+        *reg = 0;
+        *offset = address;
+        return true;
+    }
+    return false;
+}
+
+bool Link_BranchInRange(uint32_t from, uint32_t to) {
+    int32_t offset;
+    
+    offset = (int32_t)(to - from);
+    return offset >= -0x2000000 && offset < 0x2000000;
+}
+
+uint32_t Link_Get32(const uint8_t *data) {
+    return
+        (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+        (uint32_t)data[2] << 8 | data[3];
+}
+
+void Link_Put32(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+void Link_Put16(uint8_t *data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value;
+}
@@ -0,0 +1,79 @@
+/* link.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The relocations of a module, done on memory which needn't be where the
+ * module will run. The loader links modules in place, but the prelinker and
+ * the tests link them into buffers on the computer. Instructions and data
+ * are read and written big endian, whatever the host. */
+
+/* Memory to link into: size bytes at data, which the Wii sees at address. */
+typedef struct {
+    uint8_t *data;
+    uint32_t address;
+    size_t size;
+} link_image_t;
+
+/* What a module is linked against, besides the symbols. */
+typedef struct {
+    /* the game's small data bases, kept in r13 and r2, or 0 if unknown. */
+    uint32_t sda_base;
+    uint32_t sda2_base;
+} link_target_t;
+
+typedef enum {
+    LINK_OK,
+    LINK_UNSUPPORTED,
+    LINK_OUTSIDE,
+    LINK_BRANCH_RANGE,
+    LINK_SMALL_DATA_RANGE
+} link_result_t;
+
+/* Does the relocation of type at offset in image, against symbol, an
+ * address. For the section relative relocations, offset is also taken as the
+ * offset in the section, so image must start at the section. */
+link_result_t Link_Apply(
+    const link_target_t *target, const link_image_t *image, uint32_t offset,
+    unsigned int type, int32_t addend, uint32_t symbol);
+
+/* The number of bytes a relocation of type changes, or 0 if Link_Apply
+ * doesn't support it. */
+size_t Link_Width(unsigned int type);
+
+/* Whether a branch at from reaches to directly. */
+bool Link_BranchInRange(uint32_t from, uint32_t to);
+
+/* Reads and writes big endian words and halfwords. */
+uint32_t Link_Get32(const uint8_t *data);
+void Link_Put32(uint8_t *data, uint32_t value);
+void Link_Put16(uint8_t *data, uint16_t value);
+
+#endif /* LINK_H_ */
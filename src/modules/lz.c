@@ -0,0 +1,187 @@
+/* lz.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "lz.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MATCH_MIN 4
+#define LZ_OFFSET_MAX 65535
+/* the format needs the last 5 bytes to be literals, and the last match to
+ * start 12 bytes from the end. */
+#define LZ_END_LITERALS 5
+#define LZ_END_MATCH 12
+
+static uint8_t *LZ_WriteLength(uint8_t *out, size_t length);
+static uint8_t *LZ_WriteSequence(
+    uint8_t *out, const uint8_t *literals, size_t literal_length,
+    size_t offset, size_t match_length);
+static bool LZ_ReadLength(
+    const uint8_t **in, const uint8_t *in_end, size_t *length);
+
+size_t LZ_Compress(const uint8_t *in, size_t in_size, uint8_t *out) {
+    /* each entry is a position after the last one with the hash, or 0. */
+    size_t table[1 << LZ_HASH_BITS];
+    size_t position, anchor;
+    uint8_t *out_start = out;
+    
+    memset(table, 0, sizeof(table));
+    
+    position = 0;
+    anchor = 0;
+    while (in_size > LZ_END_MATCH && position < in_size - LZ_END_MATCH) {
+        uint32_t sequence;
+        size_t hash, candidate, length;
+        
+        memcpy(&sequence, in + position, sizeof(sequence));
+        hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        candidate = table[hash];
+        table[hash] = position + 1;
+        
+        if (candidate == 0 || position + 1 - candidate > LZ_OFFSET_MAX ||
+            memcmp(in + candidate - 1, in + position, LZ_MATCH_MIN) != 0) {
+            position++;
+            continue;
+        }
+        candidate--;
+        
+        length = LZ_MATCH_MIN;
+        while (position + length < in_size - LZ_END_LITERALS &&
+               in[candidate + length] == in[position + length])
+            length++;
+        
+        out = LZ_WriteSequence(
+            out, in + anchor, position - anchor, position - candidate,
+            length);
+        position += length;
+        anchor = position;
+    }
+    
+    out = LZ_WriteSequence(out, in + anchor, in_size - anchor, 0, 0);
+    
+    assert((size_t)(out - out_start) <= LZ_BOUND(in_size));
+    return out - out_start;
+}
+
+static uint8_t *LZ_WriteLength(uint8_t *out, size_t length) {
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = length;
+    return out;
+}
+
+/* Writes a sequence; a match_length of 0 means there is no match, as for the
+ * last sequence. */
+static uint8_t *LZ_WriteSequence(
+        uint8_t *out, const uint8_t *literals, size_t literal_length,
+        size_t offset, size_t match_length) {
+    uint8_t *token;
+    
+    token = out++;
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15)
+        out = LZ_WriteLength(out, literal_length - 15);
+    
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    
+    if (match_length == 0)
+        return out;
+    
+    *out++ = offset;
+    *out++ = offset >> 8;
+    
+    match_length -= LZ_MATCH_MIN;
+    *token |= match_length < 15 ? match_length : 15;
+    if (match_length >= 15)
+        out = LZ_WriteLength(out, match_length - 15);
+    
+    return out;
+}
+
+bool LZ_Decompress(
+        const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    const uint8_t *in_end = in + in_size;
+    uint8_t *out_start = out, *out_end = out + out_size;
+    
+    while (in < in_end) {
+        size_t length, offset;
+        uint8_t token;
+        
+        token = *in++;
+        
+        length = token >> 4;
+        if (length == 15 && !LZ_ReadLength(&in, in_end, &length))
+            return false;
+        if (length > (size_t)(in_end - in) ||
+            length > (size_t)(out_end - out))
+            return false;
+        memcpy(out, in, length);
+        in += length;
+        out += length;
+        
+        /* the last sequence has no match. */
+        if (in == in_end)
+            break;
+        
+        if (in_end - in < 2)
+            return false;
+        offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - out_start))
+            return false;
+        
+        length = token & 15;
+        if (length == 15 && !LZ_ReadLength(&in, in_end, &length))
+            return false;
+        length += LZ_MATCH_MIN;
+        if (length > (size_t)(out_end - out))
+            return false;
+        
+        /* the match can overlap what it makes, so copy a byte at a time. */
+        for (; length > 0; length--, out++)
+            *out = out[-offset];
+    }
+    
+    return out == out_end;
+}
+
+static bool LZ_ReadLength(
+        const uint8_t **in, const uint8_t *in_end, size_t *length) {
+    uint8_t byte;
+    
+    do {
+        if (*in == in_end)
+            return false;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    
+    return true;
+}
@@ -0,0 +1,49 @@
+/* lz.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LZ_H_
+#define LZ_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compression in the LZ4 block format: a series of sequences, each a token
+ * byte with the literal length in the high nibble and the match length less 4
+ * in the low nibble, the literals, and a 2 byte little endian match offset.
+ * A nibble of 15 is continued by bytes which are added to it until one isn't
+ * 255. The last sequence only has literals. */
+
+/* the most LZ_Compress can make from size bytes. */
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+/* Compresses in_size bytes of in to out, which must have LZ_BOUND(in_size)
+ * bytes. Returns the size of the compressed data. */
+size_t LZ_Compress(const uint8_t *in, size_t in_size, uint8_t *out);
+/* Decompresses in_size bytes of in to out. Returns true only if the data was
+ * valid and was exactly out_size bytes. */
+bool LZ_Decompress(
+    const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size);
+
+#endif /* LZ_H_ */
@@ -1,4 +1,8 @@
 WD        := $(dir $(lastword $(MAKEFILE_LIST)))
 WD_MODULE := $(WD)
 
+SRC += $(WD)hook.c
+SRC += $(WD)link.c
+SRC += $(WD)lz.c
 SRC += $(WD)module.c
+SRC += $(WD)prelink.c
@@ -37,43 +37,234 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "apploader/apploader.h"
 #include "library/dolphin_os.h"
 #include "library/event.h"
 #include "main.h"
+#include "modules/hook.h"
+#include "modules/link.h"
+#include "modules/lz.h"
+#include "modules/prelink.h"
 #include "search/search.h"
+#include "search/symbol.h"
 #include "threads.h"
 
+/* A name needed by the relocations of one or more modules. Each name is kept
+ * once, and is looked up once per module no matter how many relocations
+ * refer to it. */
+typedef struct module_symbol_t {
+    struct module_symbol_t *hash_next;
+    /* Symbol_NameHash(name). */
+    uint32_t hash;
+    /* the relocations against this symbol not yet applied, in module order,
+     * or MODULE_RELOCATION_NONE. */
+    size_t relocation_first;
+    size_t relocation_last;
+    /* the result of the last lookup, valid if resolved is true. */
+    void *address;
+    bool resolved;
+    char name[];
+} module_symbol_t;
+
+#define MODULE_RELOCATION_NONE ((size_t)-1)
+
 typedef struct {
     size_t module;
-    const char *name;
+    module_symbol_t *symbol;
+    /* the next relocation against symbol, or MODULE_RELOCATION_NONE. */
+    size_t symbol_next;
     void *address;
+    /* the size of the section or region at address. */
+    size_t size;
     size_t offset;
     char type;
     int addend;
 } module_unresolved_relocation_t;
 
+typedef struct {
+    Elf_Scn *scn;
+    Elf32_Shdr *shdr;
+    const char *name;
+    /* the first SHT_REL or SHT_RELA section that applies to this one, or 0. */
+    size_t relocation;
+    /* for SHT_REL and SHT_RELA, the next one for the same section, or 0. */
+    size_t relocation_next;
+    /* for SHT_REL and SHT_RELA, the relocations. */
+    Elf_Data *data;
+    /* for allocated SHT_PROGBITS, where the contents are in the file. */
+    off_t offset;
+    /* true if the section is reachable from .bslug.load and is loaded. */
+    bool live;
+    /* for live sections, where Module_ListLayout put it in the module
+     * space, as an offset from module_list_base, or from module_mem2_base if
+     * mem2 is set. */
+    size_t layout;
+    bool mem2;
+} module_elf_section_t;
+
+/* What Module_LoadPrelinked learns about a prelinked module. */
+typedef struct {
+    prelink_header_t header;
+    /* where the image and .bslug.load are in the file. */
+    off_t image_offset;
+    off_t load_offset;
+    prelink_fixup_t *fixups;
+    char *names;
+    /* the start of each name in names. */
+    const char **name_list;
+    size_t name_count;
+    /* the image and .bslug.load, as sections 1 and 2 for Module_ListLayout. */
+    Elf32_Shdr shdrs[3];
+} module_prelink_t;
+
+/* What Module_Load learns about a module, kept so that Module_ListLink can
+ * link it without parsing the file a second time. The Elf only has the
+ * headers, symbols and relocations; see Module_ElfOpen. For a prelinked
+ * module, elf is NULL and prelink is set instead. */
+typedef struct {
+    Elf *elf;
+    module_prelink_t *prelink;
+    /* the memory elf was made from. */
+    char *image;
+    /* the module's file, while it is open, and where in it the ELF starts. */
+    int fd;
+    off_t offset;
+    /* true for an archive member, which has no .bslug.meta or .bslug.load. */
+    bool member;
+    /* indexed by section number; section 0 has a NULL scn. */
+    module_elf_section_t *sections;
+    size_t section_count;
+    Elf32_Sym *symtab;
+    size_t symtab_count;
+    size_t symtab_strndx;
+    /* section numbers of the SHT_REL and SHT_RELA sections. */
+    size_t *relocations;
+    size_t relocations_count;
+    /* the BSLUG_HOOK_AT entries in .bslug.load, which need a thunk rather
+     * than a stub; see Module_StubsSize. */
+    size_t hooks_count;
+} module_elf_t;
+
+/* A member header in an ar archive. */
+typedef struct {
+    char name[16];
+    char date[12];
+    char uid[6];
+    char gid[6];
+    char mode[8];
+    char size[10];
+    char magic[2];
+} module_archive_header_t;
+
+typedef struct {
+    const char *name;
+    /* offset of the member's header. */
+    uint32_t member;
+    /* true once the member has been loaded, or tried. */
+    bool loaded;
+} module_archive_symbol_t;
+
+/* An archive's symbol index, kept until Module_ListLoadArchives has decided
+ * which members are needed. */
+typedef struct {
+    char *path;
+    /* sorted by name. */
+    module_archive_symbol_t *symbols;
+    size_t symbol_count;
+    char *symbol_names;
+    /* the "//" member, or NULL. */
+    char *long_names;
+    size_t long_names_size;
+} module_archive_t;
+
+/* A global symbol of an archive member, made visible to other modules by
+ * Module_ListLoadSymbols like a BSLUG_EXPORT. */
+typedef struct {
+    char *name;
+    void *address;
+} module_export_t;
+
 event_t module_event_list_loaded;
 event_t module_event_complete;
+event_t module_event_cache_checked;
+event_t module_event_linked;
 
 bool module_has_error;
 bool module_has_info;
+bool module_cache_hit;
 
 #define MODULE_LIST_CAPACITY_DEFAULT 16
 
 size_t module_list_size = 0;
+/* the start of the module space, which ends at MODULE_LIST_END. */
+static uint8_t *module_list_base = NULL;
+/* the size of the sections at module_list_base; the rest of the space is for
+ * the stubs made by Module_ListLinkFinalReplaceFunction. */
+static size_t module_list_sections_size = 0;
+
+size_t module_mem2_size = 0;
+/* the start of the MEM2 sections, which end at MODULE_MEM2_END. */
+static uint8_t *module_mem2_base = NULL;
+
+/* read only data sections at least this big go in MEM2 even if they don't ask
+ * to; see Module_LayoutMem2. */
+#define MODULE_MEM2_THRESHOLD (16 * 1024)
+
+/* What the modules are linked against. The game's small data bases, which it
+ * keeps in r13 and r2 throughout, are zero until Module_ListLinkFinal, once
+ * the game is loaded. Code built with -msdata=eabi reaches data near them in
+ * one instruction. Code is only ever in MEM1, so branches between it and
+ * the game always reach; one which doesn't is an error. */
+static link_target_t module_link_target;
+
+#define MODULE_LIST_END ((uint8_t *)0x81800000)
+/* the game's boot loader is at 0x81200000, and the apploader takes anything
+ * it loads above 0x81400000 as the game's; the module space must stay clear of
+ * both. */
+#define MODULE_LIST_SIZE_MAX ((size_t)(MODULE_LIST_END - (uint8_t *)0x81400000))
+/* the biggest stub made by Module_ListLinkFinalReplaceFunction. */
+#define MODULE_REPLACE_STUB_SIZE 12
+/* the biggest made by Module_ListLinkFinalHookAt. */
+#define MODULE_HOOK_STUB_SIZE HOOK_THUNK_SIZE
 module_metadata_t **module_list = NULL;
 size_t module_list_count = 0;
 static size_t module_list_capacity = 0;
 
+/* module_elf_list[i] describes module_list[i] until it is linked. */
+static module_elf_t **module_elf_list = NULL;
+static size_t module_elf_list_count = 0;
+static size_t module_elf_list_capacity = 0;
+
 #define MODULE_RELOCATIONS_CAPCITY_DEFAULT 128
 
 static module_unresolved_relocation_t *module_relocations = NULL;
 static size_t module_relocations_count = 0;
 static size_t module_relocations_capacity = 0;
 
+#define MODULE_SYMBOLS_CAPACITY_DEFAULT 64
+#define MODULE_SYMBOLS_HASH_SIZE 256
+
+/* every symbol, in the order they were first needed. */
+static module_symbol_t **module_symbols = NULL;
+static size_t module_symbols_count = 0;
+static size_t module_symbols_capacity = 0;
+static module_symbol_t *module_symbols_hash[MODULE_SYMBOLS_HASH_SIZE];
+
+#define MODULE_ARCHIVES_CAPACITY_DEFAULT 4
+
+static module_archive_t **module_archives = NULL;
+static size_t module_archives_count = 0;
+static size_t module_archives_capacity = 0;
+
+#define MODULE_EXPORTS_CAPACITY_DEFAULT 64
+
+static module_export_t *module_exports = NULL;
+static size_t module_exports_count = 0;
+static size_t module_exports_capacity = 0;
+
 #define MODULE_ENTRIES_CAPACITY_DEFAULT 128
 
 static bslug_loader_entry_t *module_entries = NULL;
@@ -81,6 +272,77 @@ static size_t module_entries_count = 0;
 static size_t module_entries_capacity = 0;
 
 static const char module_path[] = "sd:/bslug/modules";
+/* where src/search finds the symbols, which the cache depends on. */
+static const char module_symbols_path[] = "sd:/bslug/symbols";
+
+/* A game code instruction changed by Module_ListLinkFinalReplaceFunction. */
+typedef struct {
+    uint32_t address;
+    uint32_t instruction;
+} module_patch_t;
+
+#define MODULE_PATCHES_CAPACITY_DEFAULT 16
+
+static module_patch_t *module_patches = NULL;
+static size_t module_patches_count = 0;
+static size_t module_patches_capacity = 0;
+
+size_t module_cache_op_count = 0;
+
+/* The linked module space for one game and set of files is the same every
+ * time, so it is saved in the cache directory, as a file named after the
+ * game. The file has a module_cache_header_t, a module_cache_module_t for
+ * each module, strings_size bytes of the modules' strings, patch_count
+ * module_patch_t, image_size bytes of the space and then mem2_size bytes of
+ * the MEM2 sections. */
+static const char module_cache_path[] = "sd:/bslug/cache";
+
+#define MODULE_CACHE_MAGIC "BSLC"
+#define MODULE_CACHE_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    /* see Module_CacheKey. */
+    uint64_t key;
+    uint32_t module_count;
+    uint32_t strings_size;
+    uint32_t patch_count;
+    uint32_t image_size;
+    uint32_t mem2_size;
+} module_cache_header_t;
+
+/* the strings are path, game, name, author, version and license, each ended
+ * by a NUL. */
+typedef struct {
+    uint32_t size;
+    uint32_t entries_count;
+} module_cache_module_t;
+
+/* FNV-1a. */
+#define MODULE_CACHE_HASH_INIT 0xcbf29ce484222325ull
+#define MODULE_CACHE_HASH_PRIME 0x100000001b3ull
+
+static uint64_t module_cache_key;
+/* set if the cache couldn't record everything done to the game. */
+static bool module_cache_incomplete = false;
+
+#define MODULE_ARCHIVE_MAGIC "!<arch>\n"
+
+/* A name exported by a module, for Module_ListOrder. */
+typedef struct {
+    const char *name;
+    size_t module;
+} module_order_export_t;
+
+/* an edge from the module exporting a name to one importing it. */
+typedef struct {
+    size_t exporter;
+    size_t importer;
+} module_order_edge_t;
+
+/* the prefix of the symbol BSLUG_EXPORT makes for each export. */
+#define MODULE_EXPORT_PREFIX "bslug_export_"
 
 static void *Module_Main(void *arg);
 static void *Module_ListAllocate(
@@ -88,42 +350,129 @@ static void *Module_ListAllocate(
     size_t *capacity, size_t *count, size_t default_capacity);
     
 static void Module_ListLoad(void);
-static void Module_CheckDirectory(char *path);
+static void Module_CheckDirectory(char *path, void (*check)(const char *path));
+static const char *Module_FileExtension(const char *path);
+static bool Module_IsModule(const char *path);
 static void Module_CheckFile(const char *path);
 static void Module_Load(const char *path);
-static void Module_LoadElf(const char *path, Elf *elf);
-static bool Module_LoadElfSymtab(
-    Elf *elf, Elf32_Sym **symtab, size_t *symtab_count, size_t *symtab_strndx);
+static bool Module_LoadElf(
+    const char *path, int fd, const unsigned char *ident, off_t offset,
+    const char *member);
+static bool Module_ListAdd(
+    const char *path, module_metadata_t *metadata, module_elf_t *module);
+static bool Module_LoadPrelinked(const char *path, int fd);
+static void Module_LoadArchive(const char *path, int fd);
+static bool Module_ArchiveHeader(
+    int fd, off_t offset, module_archive_header_t *header, size_t *size);
+static int Module_ArchiveSymbolCompare(const void *left, const void *right);
+static void Module_ArchiveFree(module_archive_t *archive);
+static void Module_ListLoadArchives(void);
+static void Module_ListOrder(void);
+static bool Module_OrderExports(
+    module_order_export_t **exports, size_t *count, size_t *capacity);
+static bool Module_OrderImport(
+    const char *name, size_t importer, const module_order_export_t *exports,
+    size_t exports_count, module_order_edge_t **edges, size_t *count,
+    size_t *capacity);
+static int Module_OrderExportCompare(const void *left, const void *right);
+static bool Module_OrderBefore(size_t left, size_t right);
+static void Module_OrderReportCycles(
+    const bool *done, const module_order_edge_t *edges, size_t edges_count,
+    size_t count);
+static bool Module_ListDefines(const char *name);
+static void Module_LoadArchiveMember(
+    module_archive_t *archive, uint32_t member);
+static bool Module_ElfRead(int fd, off_t offset, void *destination, size_t size);
+static bool Module_LoadHooksCount(
+    int fd, off_t offset, size_t size, size_t *hooks_count);
+static size_t Module_StubsSize(
+    const module_elf_t *module, size_t entries_count);
+static module_elf_t *Module_ElfOpen(int fd, off_t offset);
+static bool Module_ElfKeepSection(
+    const Elf32_Shdr *shdrs, size_t count, size_t index);
+static void Module_ElfClose(module_elf_t *module);
+static bool Module_LoadElfSymtab(module_elf_t *module);
+static bool Module_ElfMarkLive(module_elf_t *module);
+static bool Module_ElfSectionLoaded(const module_elf_section_t *section);
 static module_metadata_t *Module_MetadataRead(
-    const char *path, size_t index, Elf *elf, 
-    Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx);
+    const char *path, size_t index, module_elf_t *module);
+static module_metadata_t *Module_MetadataParse(
+    const char *path, char *metadata, char *metadata_end,
+    size_t entries_count);
+static bool Module_MetadataForGame(const module_metadata_t *metadata);
+static module_metadata_t *Module_MetadataCreate(
+    const char *path, const char *game, const char *name, const char *author,
+    const char *version, const char *license, size_t entries_count);
 static bool Module_ElfLoadSection(
-    const Elf *elf, Elf_Scn *scn, const Elf32_Shdr *shdr, void *destination);
+    const module_elf_t *module, size_t shndx, void *destination);
 static void Module_ElfLoadSymbols(
     size_t shndx, const void *destination, 
     Elf32_Sym *symtab, size_t symtab_count);
+static void Module_ElfUnloadSymbols(
+    size_t shndx, const void *destination, 
+    Elf32_Sym *symtab, size_t symtab_count);
 static bool Module_ElfLink(
-    size_t index, Elf *elf, size_t shndx, void *destination,
-    Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx,
+    size_t index, const module_elf_t *module, size_t shndx, void *destination,
     bool allow_globals);
+static bool Module_ElfLinkRelocations(
+    size_t index, const module_elf_t *module, size_t relocation,
+    void *destination, bool allow_globals);
 static bool Module_ElfLinkOne(
-    char type, size_t offset, int addend, void *destination,
+    char type, size_t offset, int addend, void *destination, size_t size,
     uint32_t symbol_addr);
-    
-static bool Module_ListLink(uint8_t **space);
-static bool Module_LinkModule(size_t index, const char *path, uint8_t **space);
-static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space);
+static bool Module_RelocationAdd(
+    size_t index, const char *name, void *destination, size_t size,
+    size_t offset, char type, int addend);
+static module_symbol_t *Module_SymbolFind(
+    const char *name, uint32_t hash, bool add);
+static void Module_SymbolInvalidate(const char *name, uint32_t hash);
+static void Module_SymbolFreeAll(void);
+    
+static void Module_ListLayout(void);
+static int Module_LayoutCompare(const void *left, const void *right);
+static size_t Module_LayoutAlign(const module_elf_section_t *section);
+static bool Module_LayoutMem2(const module_elf_section_t *section);
+static bool Module_Mem2Usable(void);
+static void Module_LayoutPlace(
+    module_elf_section_t *section, size_t *size, size_t *mem2_size);
+static uint8_t *Module_SectionAddress(const module_elf_section_t *section);
+static bool Module_ListLink(void);
+static bool Module_ListNeeded(void);
+static bool Module_LinkModuleElf(size_t index, module_elf_t *module);
+static bool Module_ElfExport(const module_elf_t *module);
+static bool Module_LinkModulePrelinked(size_t index, module_elf_t *module);
 
 static bool Module_ListLoadSymbols(uint8_t **space);
 
 static bool Module_ListLinkFinal(uint8_t **space);
 static bool Module_ListLinkFinalReplaceFunction(
-        uint8_t **space, bslug_loader_entry_t *entry);
+    uint8_t **space, bslug_loader_entry_t *entry,
+    hook_chain_t *hooks, size_t hook);
+static bool Module_ListLinkFinalHookAt(
+    uint8_t **space, bslug_loader_entry_t *entry);
+static void Module_ListLinkFinalPatch(uint32_t *address, uint32_t instruction);
+static void Module_Flush(void);
+static void Module_FlushRange(const void *start, size_t size);
+static int Module_FlushLineCompare(const void *left, const void *right);
+
+static void Module_CacheCheck(void);
+static void Module_CacheKey(void);
+static uint64_t Module_CacheHash(uint64_t hash, const void *data, size_t size);
+static void Module_CacheHashFile(const char *path);
+static void Module_CacheHashModule(const char *path);
+static void Module_CacheHashSymbols(const char *path);
+static void Module_CacheFileName(char *path);
+static bool Module_CacheLoad(void);
+static void Module_CachePatch(void);
+static void Module_CacheSave(void);
+static bool Module_CacheWrite(FILE *file);
         
 bool Module_Init(void) {
     return
         Event_Init(&module_event_list_loaded) &&
-        Event_Init(&module_event_complete);
+        Event_Init(&module_event_complete) &&
+        Event_Init(&module_event_cache_checked) &&
+        Event_Init(&module_event_linked);
 }
 
 bool Module_RunBackground(void) {
@@ -144,16 +493,41 @@ bool Module_RunBackground(void) {
 
 static void *Module_Main(void *arg) {
     uint8_t *space;
+    bool linked;
     
-    Module_ListLoad();
+    Module_CacheCheck();
+    
+    if (module_cache_hit) {
+        Event_Trigger(&module_event_list_loaded);
+        
+        /* the space was read by Module_CacheLoad; only the game is left. */
+        Event_Wait(&apploader_event_complete);
+        Module_CachePatch();
+        Module_Flush();
+        free(module_patches);
+        module_patches = NULL;
+        module_patches_count = 0;
+        module_patches_capacity = 0;
+        
+        Event_Trigger(&module_event_complete);
+        return NULL;
+    }
     
-    module_list_size += ((-module_list_size) & 0x1f);
+    Module_ListLoad();
+    Module_ListOrder();
+    Module_ListLayout();
     
     Event_Trigger(&module_event_list_loaded);
     
-    space = (uint8_t *)0x81800000;
+    /* the stubs are made downwards from the end of the space. */
+    space = MODULE_LIST_END;
     
-    if (!Module_ListLink(&space))
+    /* the search waits for this, to look only for the symbols used. */
+    linked = Module_ListLink() && Module_ListNeeded();
+    if (!linked)
+        module_has_error = true;
+    Event_Trigger(&module_event_linked);
+    if (!linked)
         goto exit_error;
     
     Event_Wait(&apploader_event_complete);
@@ -167,9 +541,9 @@ static void *Module_Main(void *arg) {
     if (!Module_ListLinkFinal(&space))
         goto exit_error;
     
-    assert(space > (uint8_t *)0x81800000 - module_list_size);
+    assert(space >= module_list_base + module_list_sections_size);
     
-    DCFlushRange(space, 0x81800000 - (uint32_t)space);
+    Module_CacheSave();
 
     Event_Trigger(&module_event_complete);
     
@@ -221,10 +595,12 @@ static void Module_ListLoad(void) {
     
     strcpy(path, module_path);
     
-    Module_CheckDirectory(path);
+    Module_CheckDirectory(path, &Module_CheckFile);
+    Module_ListLoadArchives();
 }
 
-static void Module_CheckDirectory(char *path) {
+/* Calls check for each file in path, and in the directories for this game. */
+static void Module_CheckDirectory(char *path, void (*check)(const char *path)) {
     DIR *dir;
     
     dir = opendir(path);
@@ -249,7 +625,7 @@ static void Module_CheckDirectory(char *path) {
                         old_path_end, entry->d_name,
                         FILENAME_MAX - (old_path_end - path));
                     
-                    Module_CheckFile(path);
+                    check(path);
                     
                     /* reset back to the original path for next file */
                     *old_path_end = '\0';
@@ -281,7 +657,7 @@ static void Module_CheckDirectory(char *path) {
                             old_path_end, entry->d_name,
                             FILENAME_MAX - (old_path_end - path));
                         
-                        Module_CheckDirectory(path);
+                        Module_CheckDirectory(path, check);
                         
                         /* reset back to the original path for next file */
                         *old_path_end = '\0';
@@ -295,7 +671,7 @@ static void Module_CheckDirectory(char *path) {
     }
 }
 
-static void Module_CheckFile(const char *path) {
+static const char *Module_FileExtension(const char *path) {
     const char *extension;
     
     /* find the file extension */
@@ -307,18 +683,29 @@ static void Module_CheckFile(const char *path) {
         
     assert(extension != NULL);
     
-    if (strcmp(extension, "mod") == 0 ||
+    return extension;
+}
+
+static bool Module_IsModule(const char *path) {
+    const char *extension;
+    
+    extension = Module_FileExtension(path);
+    
+    return
+        strcmp(extension, "mod") == 0 ||
         strcmp(extension, "o") == 0 ||
         strcmp(extension, "a") == 0 ||
-        strcmp(extension, "elf") == 0) {
-        
+        strcmp(extension, "elf") == 0;
+}
+
+static void Module_CheckFile(const char *path) {
+    if (Module_IsModule(path))
         Module_Load(path);
-    }
 }
 
 static void Module_Load(const char *path) {
     int fd = -1;
-    Elf *elf = NULL;
+    unsigned char ident[EI_NIDENT];
     
     /* check for compile errors */
     if (elf_version(EV_CURRENT) == EV_NONE)
@@ -328,59 +715,45 @@ static void Module_Load(const char *path) {
     
     if (fd == -1)
         goto exit_error;
-        
-    elf = elf_begin(fd, ELF_C_READ, NULL);
     
-    if (elf == NULL)
+    if (!Module_ElfRead(fd, 0, ident, sizeof(ident))) {
+        printf(
+            "Warning: Ignoring '%s' - Invalid ELF file.\n", path);
         goto exit_error;
+    }
         
-    switch (elf_kind(elf)) {
-        case ELF_K_AR:
-            /* TODO */
-            printf(
-                "Warning: Ignoring '%s' - Archives not yet supported.\n", path);
-            module_has_info = true;
-            goto exit_error;
-        case ELF_K_ELF:
-            Module_LoadElf(path, elf);
-            break;
-        default:
-            printf(
-                "Warning: Ignoring '%s' - Invalid ELF file.\n", path);
-            goto exit_error;
+    if (memcmp(
+            ident, MODULE_ARCHIVE_MAGIC, strlen(MODULE_ARCHIVE_MAGIC)) == 0) {
+        Module_LoadArchive(path, fd);
+    } else if (ident[0] == ELFMAG0 && ident[1] == ELFMAG1 &&
+               ident[2] == ELFMAG2 && ident[3] == ELFMAG3) {
+        Module_LoadElf(path, fd, ident, 0, NULL);
+    } else if (memcmp(ident, PRELINK_MAGIC, strlen(PRELINK_MAGIC)) == 0) {
+        Module_LoadPrelinked(path, fd);
+    } else {
+        printf(
+            "Warning: Ignoring '%s' - Invalid ELF file.\n", path);
+        goto exit_error;
     }
 
 exit_error:
-    if (elf != NULL)
-        elf_end(elf);
     if (fd != -1)
         close(fd);
 }
 
-static void Module_LoadElf(const char *path, Elf *elf) {
-    Elf_Scn *scn;
+/* Loads the ELF at offset in fd. For an archive member, member is its name,
+ * and path the archive's. */
+static bool Module_LoadElf(
+        const char *path, int fd, const unsigned char *ident, off_t offset,
+        const char *member) {
     Elf32_Ehdr *ehdr;
-    char *ident;
-    size_t shstrndx, sz, symtab_count, i, symtab_strndx;
-    Elf32_Sym *symtab = NULL;
+    size_t i;
+    module_elf_t *module = NULL;
     module_metadata_t *metadata = NULL;
-    module_metadata_t **list_ptr;
     
-    assert(elf != NULL);
-    assert(elf_kind(elf) == ELF_K_ELF);
+    assert(fd != -1);
+    assert(ident != NULL);
     
-    ident = elf_getident(elf, &sz);
-    
-    if (ident == NULL) {
-        printf("Warning: Ignoring '%s' - Invalid ELF header.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (sz < 7) {
-        printf("Warning: Ignoring '%s' - Invalid ELF header.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
     if (ident[4] != ELFCLASS32) {
         printf("Warning: Ignoring '%s' - Not 32 bit ELF.\n", path);
         module_has_info = true;
@@ -396,8 +769,16 @@ static void Module_LoadElf(const char *path, Elf *elf) {
         module_has_info = true;
         goto exit_error;
     }
+    
+    module = Module_ElfOpen(fd, offset);
+    
+    if (module == NULL) {
+        printf("Warning: Ignoring '%s' - Couldn't parse sections.\n", path);
+        module_has_info = true;
+        goto exit_error;
+    }
         
-    ehdr = elf32_getehdr(elf);
+    ehdr = elf32_getehdr(module->elf);
     
     if (ehdr == NULL) {
         printf("Warning: Ignoring '%s' - Invalid ELF header\n", path);
@@ -419,217 +800,1363 @@ static void Module_LoadElf(const char *path, Elf *elf) {
         module_has_info = true;
         goto exit_error;
     }
-        
-    if (!Module_LoadElfSymtab(elf, &symtab, &symtab_count, &symtab_strndx)) {
+    if (module->symtab == NULL) {
         printf("Warning: Ignoring '%s' - Couldn't parse symtab.\n", path);
         module_has_info = true;
         goto exit_error;
     }
         
-    assert(symtab != NULL);
-        
-    metadata = Module_MetadataRead(
-        path, module_list_count, elf, symtab, symtab_count, symtab_strndx);
+    if (member != NULL) {
+        /* members are only loaded if needed, so they suit any game. */
+        module->member = true;
+        metadata = Module_MetadataCreate(path, "", member, path, "", "", 0);
+        if (metadata == NULL) {
+            printf("Warning: Ignoring '%s(%s)' - ENOMEM.\n", path, member);
+            module_has_info = true;
+            goto exit_error;
+        }
+    } else {
+        metadata = Module_MetadataRead(path, module_list_count, module);
     
-    if (metadata == NULL) /* error reporting done inside method */
+        if (metadata == NULL) /* error reporting done inside method */
+            goto exit_error;
+    }
+    
+    if (!Module_MetadataForGame(metadata))
         goto exit_error;
     
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
-        printf("Warning: Ignoring '%s' - Couldn't find shdrstndx.\n", path);
+    if (!Module_ElfMarkLive(module)) {
+        printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
         module_has_info = true;
         goto exit_error;
     }
     
-    for (i = 0; metadata->game[i] != '\0'; i++) {
-        if (metadata->game[i] != '?') {
-            Event_Wait(&apploader_event_disk_id);
-            if ((i < 4 && metadata->game[i] != os0->disc.gamename[i]) ||
-                (i >= 4 && i < 6 &&
-                 metadata->game[i] != os0->disc.company[i - 4]) ||
-                i >= 6)
-                goto exit_error;
-        }
-    }
-    
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-        
+    for (i = 1; i < module->section_count; i++) {
         Elf32_Shdr *shdr;
         
-        shdr = elf32_getshdr(scn);
+        shdr = module->sections[i].shdr;
         if (shdr == NULL)
             continue;
             
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC)) {
-            
+        if (module->sections[i].live) {
             const char *name;
                 
-            name = elf_strptr(elf, shstrndx, shdr->sh_name);
-            if (name == NULL)
-                continue;
+            name = module->sections[i].name;
             
-            if (strcmp(name, ".bslug.meta") == 0) {
-                continue;
-            } else if (strcmp(name, ".bslug.load") == 0) {
-                metadata->size +=
-                    shdr->sh_size / sizeof(bslug_loader_entry_t) * 12;
+            if (strcmp(name, ".bslug.load") == 0) {
+                if (!Module_LoadHooksCount(
+                        module->fd, module->offset + module->sections[i].offset,
+                        shdr->sh_size, &module->hooks_count)) {
+                    printf(
+                        "Warning: Ignoring '%s' - Couldn't load .bslug.load.\n",
+                        path);
+                    module_has_info = true;
+                    goto exit_error;
+                }
+                metadata->size += Module_StubsSize(
+                    module, shdr->sh_size / sizeof(bslug_loader_entry_t));
             } else {
+                /* the padding depends on the other modules; see
+                 * Module_ListLayout. */
                 metadata->size += shdr->sh_size;
-                /* add alignment padding to size */
-                if (shdr->sh_addralign > 3)
-                    /* roundup to multiple of sh_addralign  */
-                    metadata->size +=
-                        (-metadata->size & (shdr->sh_addralign - 1));
-                else
-                    /* roundup to multiple of 4 */
-                    metadata->size += (-metadata->size & 3);
             }
         }
     }
     
-    /* roundup to multiple of 4 */
-    metadata->size += (-metadata->size & 3);
+    /* the file is opened again to link it. */
+    module->fd = -1;
+    
+    if (!Module_ListAdd(path, metadata, module))
+        goto exit_error;
+    
+    return true;
+exit_error:
+    if (metadata != NULL)
+        free(metadata);
+    if (module != NULL) {
+        /* the caller still owns fd. */
+        module->fd = -1;
+        Module_ElfClose(module);
+    }
+    return false;
+}
+
+/* Adds a loaded module to module_list and module_elf_list, which then own
+ * metadata and module. */
+static bool Module_ListAdd(
+        const char *path, module_metadata_t *metadata, module_elf_t *module) {
+    module_metadata_t **list_ptr;
+    module_elf_t **elf_list_ptr;
     
+    elf_list_ptr = Module_ListAllocate(
+        &module_elf_list, sizeof(module_elf_t *), 1,
+        &module_elf_list_capacity, &module_elf_list_count,
+        MODULE_LIST_CAPACITY_DEFAULT);
+    if (elf_list_ptr == NULL) {
+        printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
+        module_has_info = true;
+        return false;
+    }
     list_ptr = Module_ListAllocate(
         &module_list, sizeof(module_metadata_t *), 1, &module_list_capacity,
         &module_list_count, MODULE_LIST_CAPACITY_DEFAULT);
     if (list_ptr == NULL) {
+        module_elf_list_count--;
         printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
         module_has_info = true;
-        goto exit_error;
+        return false;
     }
     
     assert(module_list != NULL);
     assert(module_list_count <= module_list_capacity);
+    assert(module_list_count == module_elf_list_count);
     
     *list_ptr = metadata;
-    module_list_size += metadata->size;
-    /* prevent the data being freed */
-    metadata = NULL;
+    *elf_list_ptr = module;
+    
+    return true;
+}
+
+/* Loads a module made by tools/prelink; see prelink.h. */
+static bool Module_LoadPrelinked(const char *path, int fd) {
+    module_prelink_t *prelink;
+    module_elf_t *module = NULL;
+    module_metadata_t *metadata = NULL;
+    char *meta = NULL;
+    off_t offset;
+    size_t i;
+    
+    module = calloc(1, sizeof(module_elf_t));
+    if (module == NULL)
+        goto exit_enomem;
+    module->fd = -1;
     
+    module->prelink = prelink = calloc(1, sizeof(module_prelink_t));
+    if (prelink == NULL)
+        goto exit_enomem;
+    
+    if (!Module_ElfRead(fd, 0, &prelink->header, sizeof(prelink->header)))
+        goto exit_invalid;
+    if (prelink->header.version != PRELINK_VERSION) {
+        printf("Warning: Ignoring '%s' - Unknown prelink version.\n", path);
+        module_has_info = true;
+        goto exit_error;
+    }
+    if (prelink->header.meta_size == 0 ||
+        prelink->header.image_align == 0 ||
+        (prelink->header.image_align & (prelink->header.image_align - 1)) ||
+        (prelink->header.flags & ~PRELINK_FLAG_COMPRESSED) ||
+        prelink->header.load_size % sizeof(bslug_loader_entry_t) != 0 ||
+        prelink->header.fixup_count > SIZE_MAX / sizeof(prelink_fixup_t))
+        goto exit_invalid;
+    if (!(prelink->header.flags & PRELINK_FLAG_COMPRESSED) &&
+        prelink->header.image_stored_size != prelink->header.image_size)
+        goto exit_invalid;
+    
+    offset = sizeof(prelink->header);
+    
+    meta = malloc(prelink->header.meta_size);
+    if (meta == NULL)
+        goto exit_enomem;
+    if (!Module_ElfRead(fd, offset, meta, prelink->header.meta_size))
+        goto exit_invalid;
+    meta[prelink->header.meta_size - 1] = '\0';
+    offset += prelink->header.meta_size + (-prelink->header.meta_size & 3);
+    
+    metadata = Module_MetadataParse(
+        path, meta, meta + prelink->header.meta_size,
+        prelink->header.load_size / sizeof(bslug_loader_entry_t));
+    if (metadata == NULL) /* error reporting done inside method */
+        goto exit_error;
+    
+    if (!Module_MetadataForGame(metadata))
+        goto exit_error;
+    
+    prelink->image_offset = offset;
+    offset +=
+        prelink->header.image_stored_size +
+        (-prelink->header.image_stored_size & 3);
+    prelink->load_offset = offset;
+    offset += prelink->header.load_size + (-prelink->header.load_size & 3);
+    
+    prelink->fixups = malloc(
+        prelink->header.fixup_count * sizeof(prelink_fixup_t));
+    prelink->names = malloc(prelink->header.names_size + 1);
+    if ((prelink->fixups == NULL && prelink->header.fixup_count > 0) ||
+        prelink->names == NULL)
+        goto exit_enomem;
+    if (!Module_ElfRead(
+            fd, offset, prelink->fixups,
+            prelink->header.fixup_count * sizeof(prelink_fixup_t)))
+        goto exit_invalid;
+    offset += prelink->header.fixup_count * sizeof(prelink_fixup_t);
+    if (!Module_ElfRead(
+            fd, offset, prelink->names, prelink->header.names_size))
+        goto exit_invalid;
+    prelink->names[prelink->header.names_size] = '\0';
+    
+    for (i = 0; i < prelink->header.names_size; i++) {
+        if (prelink->names[i] == '\0')
+            prelink->name_count++;
+    }
+    prelink->name_list = malloc(prelink->name_count * sizeof(const char *));
+    if (prelink->name_list == NULL && prelink->name_count > 0)
+        goto exit_enomem;
+    prelink->name_count = 0;
+    for (i = 0; i < prelink->header.names_size;
+         i += strlen(prelink->names + i) + 1)
+        prelink->name_list[prelink->name_count++] = prelink->names + i;
+    
+    for (i = 0; i < prelink->header.fixup_count; i++) {
+        const prelink_fixup_t *fixup;
+        
+        fixup = &prelink->fixups[i];
+        if (!Prelink_FixupValid(
+                &prelink->header, fixup, prelink->name_count))
+            goto exit_invalid;
+    }
+    
+    /* sections for Module_ListLayout; neither can be collected. */
+    module->section_count = 3;
+    module->sections = calloc(
+        module->section_count, sizeof(module_elf_section_t));
+    if (module->sections == NULL)
+        goto exit_enomem;
+    
+    prelink->shdrs[1].sh_type = SHT_PROGBITS;
+    prelink->shdrs[1].sh_flags = SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR;
+    prelink->shdrs[1].sh_size =
+        prelink->header.image_size + prelink->header.image_bss_size;
+    prelink->shdrs[1].sh_addralign = prelink->header.image_align;
+    module->sections[1].shdr = &prelink->shdrs[1];
+    module->sections[1].name = "";
+    module->sections[1].live = prelink->shdrs[1].sh_size > 0;
+    
+    prelink->shdrs[2].sh_type = SHT_PROGBITS;
+    prelink->shdrs[2].sh_flags = SHF_ALLOC;
+    prelink->shdrs[2].sh_size = prelink->header.load_size;
+    module->sections[2].shdr = &prelink->shdrs[2];
+    module->sections[2].name = ".bslug.load";
+    module->sections[2].live = true;
+    
+    if (!Module_LoadHooksCount(
+            fd, prelink->load_offset, prelink->header.load_size,
+            &module->hooks_count))
+        goto exit_invalid;
+    metadata->size =
+        prelink->shdrs[1].sh_size +
+        Module_StubsSize(module, metadata->entries_count);
+    
+    if (!Module_ListAdd(path, metadata, module))
+        goto exit_error;
+    
+    free(meta);
+    return true;
+exit_enomem:
+    printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
+    module_has_info = true;
+    goto exit_error;
+exit_invalid:
+    printf("Warning: Ignoring '%s' - Invalid prelinked module.\n", path);
+    module_has_info = true;
 exit_error:
+    if (meta != NULL)
+        free(meta);
     if (metadata != NULL)
         free(metadata);
-    if (symtab != NULL)
-        free(symtab);
+    if (module != NULL)
+        Module_ElfClose(module);
+    return false;
 }
 
-static bool Module_LoadElfSymtab(
-        Elf *elf, Elf32_Sym **symtab, size_t *symtab_count,
-        size_t *symtab_strndx) {
-    Elf_Scn *scn;
-    bool result = false;
-
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
+/* Reads an archive's symbol index, so that Module_ListLoadArchives can load
+ * just the members which are needed. */
+static void Module_LoadArchive(const char *path, int fd) {
+    module_archive_t *archive = NULL;
+    module_archive_t **list_ptr;
+    module_archive_header_t header;
+    off_t offset;
+    size_t size, i;
+    
+    archive = calloc(1, sizeof(module_archive_t));
+    if (archive == NULL)
+        goto exit_enomem;
+    
+    archive->path = strdup(path);
+    if (archive->path == NULL)
+        goto exit_enomem;
+    
+    /* the special members come first. */
+    for (offset = strlen(MODULE_ARCHIVE_MAGIC);
+         Module_ArchiveHeader(fd, offset, &header, &size) &&
+            header.name[0] == '/';
+         offset += sizeof(header) + size + (size & 1)) {
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
-            
-        if (shdr->sh_type == SHT_SYMTAB) {
-            size_t sym;
+        if (header.name[1] == ' ' && archive->symbol_names == NULL) {
+            const uint8_t *index;
+            size_t names_size;
+            char *name;
             
-            assert (*symtab == NULL);
-            *symtab = malloc(shdr->sh_size);
-            if (*symtab == NULL)
-                continue;
+            if (size < 4)
+                goto exit_invalid;
             
-            *symtab_count = shdr->sh_size / sizeof(Elf32_Sym);
-            *symtab_strndx = shdr->sh_link;
-
-            if (!Module_ElfLoadSection(elf, scn, shdr, *symtab))
-                goto exit_error;
+            archive->symbol_names = malloc(size + 1);
+            if (archive->symbol_names == NULL)
+                goto exit_enomem;
+            if (!Module_ElfRead(
+                    fd, offset + sizeof(header), archive->symbol_names, size))
+                goto exit_invalid;
+            archive->symbol_names[size] = '\0';
             
-            for (sym = 0; sym < *symtab_count; sym++)
-                (*symtab)[sym].st_other = 0;
+            /* a big endian count, the offsets of each symbol's member, and
+             * then the names. */
+            index = (const uint8_t *)archive->symbol_names;
+            archive->symbol_count =
+                (index[0] << 24) | (index[1] << 16) | (index[2] << 8) |
+                index[3];
+            if (archive->symbol_count > (size - 4) / 4)
+                goto exit_invalid;
             
+            archive->symbols = malloc(
+                archive->symbol_count * sizeof(module_archive_symbol_t));
+            if (archive->symbols == NULL && archive->symbol_count > 0)
+                goto exit_enomem;
             
+            name = archive->symbol_names + 4 + archive->symbol_count * 4;
+            names_size = size - 4 - archive->symbol_count * 4;
+            for (i = 0; i < archive->symbol_count; i++) {
+                const uint8_t *member;
+                size_t length;
+                
+                if (names_size == 0)
+                    goto exit_invalid;
+                
+                member = index + 4 + i * 4;
+                archive->symbols[i].name = name;
+                archive->symbols[i].member =
+                    (member[0] << 24) | (member[1] << 16) |
+                    (member[2] << 8) | member[3];
+                archive->symbols[i].loaded = false;
+                
+                length = strnlen(name, names_size);
+                if (length == names_size)
+                    goto exit_invalid;
+                name += length + 1;
+                names_size -= length + 1;
+            }
             
-            break;
+            qsort(
+                archive->symbols, archive->symbol_count,
+                sizeof(module_archive_symbol_t), &Module_ArchiveSymbolCompare);
+        } else if (header.name[1] == '/' && archive->long_names == NULL) {
+            archive->long_names = malloc(size + 1);
+            if (archive->long_names == NULL)
+                goto exit_enomem;
+            if (!Module_ElfRead(
+                    fd, offset + sizeof(header), archive->long_names, size))
+                goto exit_invalid;
+            archive->long_names[size] = '\0';
+            archive->long_names_size = size;
         }
     }
     
-    if (*symtab == NULL)
+    if (archive->symbols == NULL) {
+        printf(
+            "Warning: Ignoring '%s' - Archive has no symbol index.\n", path);
+        module_has_info = true;
         goto exit_error;
+    }
     
-    result = true;
+    list_ptr = Module_ListAllocate(
+        &module_archives, sizeof(module_archive_t *), 1,
+        &module_archives_capacity, &module_archives_count,
+        MODULE_ARCHIVES_CAPACITY_DEFAULT);
+    if (list_ptr == NULL)
+        goto exit_enomem;
+    
+    *list_ptr = archive;
+    return;
+exit_enomem:
+    printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
+    module_has_info = true;
+    goto exit_error;
+exit_invalid:
+    printf("Warning: Ignoring '%s' - Invalid archive.\n", path);
+    module_has_info = true;
 exit_error:
-    return result;
+    if (archive != NULL)
+        Module_ArchiveFree(archive);
 }
 
-static module_metadata_t *Module_MetadataRead(
-        const char *path, size_t index, Elf *elf,
-        Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx) {
-    char *metadata = NULL, *metadata_cur, *metadata_end, *tmp;
-    const char *game, *name, *author, *version, *license, *bslug;
-    module_metadata_t *ret = NULL;
-    Elf_Scn *scn;
-    size_t shstrndx, entries_count;
+/* Reads the member header at offset, and the size of the member after it. */
+static bool Module_ArchiveHeader(
+        int fd, off_t offset, module_archive_header_t *header, size_t *size) {
+    char size_string[sizeof(header->size) + 1];
+    char *end;
     
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
-        printf("Warning: Ignoring '%s' - Couldn't find shstrndx\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
+    if (!Module_ElfRead(fd, offset, header, sizeof(*header)))
+        return false;
+    if (header->magic[0] != '`' || header->magic[1] != '\n')
+        return false;
     
-    entries_count = 0;
+    memcpy(size_string, header->size, sizeof(header->size));
+    size_string[sizeof(header->size)] = '\0';
+    *size = strtoul(size_string, &end, 10);
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
-        const char *name;
+    return end != size_string;
+}
+
+static int Module_ArchiveSymbolCompare(const void *left, const void *right) {
+    return strcmp(
+        ((const module_archive_symbol_t *)left)->name,
+        ((const module_archive_symbol_t *)right)->name);
+}
+
+static void Module_ArchiveFree(module_archive_t *archive) {
+    free(archive->path);
+    free(archive->symbols);
+    free(archive->symbol_names);
+    free(archive->long_names);
+    free(archive);
+}
+
+/* Loads the archive members which define symbols the modules need, the way a
+ * linker does: each member loaded may need more, so this continues until
+ * every module, including the members, has been checked. A symbol is needed
+ * if a loaded section refers to it and no module defines it. */
+static void Module_ListLoadArchives(void) {
+    size_t index, i, j;
+    
+    for (index = 0;
+         module_archives_count > 0 && index < module_elf_list_count;
+         index++) {
+        module_elf_t *module;
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
-            
-        name = elf_strptr(elf, shstrndx, shdr->sh_name);
-        if (name == NULL)
-            continue;
+        module = module_elf_list[index];
         
-        if (strcmp(name, ".bslug.meta") == 0) {
-            if (shdr->sh_size == 0)
-                continue;
+        for (i = 0; i < module->relocations_count; i++) {
+            const module_elf_section_t *section;
+            size_t entry_size, count;
             
-            if (metadata != NULL)
-                continue;
-            metadata = malloc(shdr->sh_size);
-            if (metadata == NULL)
+            section = &module->sections[module->relocations[i]];
+            if (section->data == NULL ||
+                section->shdr->sh_info >= module->section_count ||
+                !module->sections[section->shdr->sh_info].live)
                 continue;
-                
-            if (!Module_ElfLoadSection(elf, scn, shdr, metadata)) {
-                printf(
-                    "Warning: Ignoring '%s' - Couldn't load .bslug.meta.\n",
-                    path);
-                module_has_info = true;
-                goto exit_error;
-            }
             
-            Module_ElfLoadSymbols(
-                elf_ndxscn(scn), metadata, symtab, symtab_count);
-            
-            if (!Module_ElfLink(
-                    index, elf, elf_ndxscn(scn), metadata,
-                    symtab, symtab_count, symtab_strndx, false)) {
-                printf(
-                    "Warning: Ignoring '%s' - .bslug.meta contains invalid "
-                    "relocations.\n", path);
-                module_has_info = true;
-                goto exit_error;
-            }
+            entry_size =
+                section->shdr->sh_type == SHT_REL ?
+                sizeof(Elf32_Rel) : sizeof(Elf32_Rela);
+            count = section->shdr->sh_size / entry_size;
             
-            metadata_end = metadata + shdr->sh_size;
-            metadata_end[-1] = '\0';
-        } else if (strcmp(name, ".bslug.load") == 0) {
-            entries_count = shdr->sh_size / sizeof(bslug_loader_entry_t);
+            for (j = 0; j < count; j++) {
+                const Elf32_Rel *rel;
+                const Elf32_Sym *symbol;
+                module_archive_symbol_t key, *found;
+                size_t archive;
+                
+                /* an Elf32_Rela starts with the same fields. */
+                rel = (const Elf32_Rel *)
+                    ((const char *)section->data->d_buf + j * entry_size);
+                
+                if (ELF32_R_SYM(rel->r_info) >= module->symtab_count)
+                    continue;
+                
+                symbol = &module->symtab[ELF32_R_SYM(rel->r_info)];
+                
+                /* weak references don't cause members to be loaded. */
+                if (symbol->st_shndx != SHN_UNDEF ||
+                    ELF32_ST_BIND(symbol->st_info) != STB_GLOBAL)
+                    continue;
+                
+                key.name = elf_strptr(
+                    module->elf, module->symtab_strndx, symbol->st_name);
+                if (key.name == NULL)
+                    continue;
+                
+                for (archive = 0; archive < module_archives_count; archive++) {
+                    found = bsearch(
+                        &key, module_archives[archive]->symbols,
+                        module_archives[archive]->symbol_count,
+                        sizeof(module_archive_symbol_t),
+                        &Module_ArchiveSymbolCompare);
+                    
+                    if (found == NULL)
+                        continue;
+                    
+                    if (!found->loaded && !Module_ListDefines(key.name))
+                        Module_LoadArchiveMember(
+                            module_archives[archive], found->member);
+                    break;
+                }
+            }
+        }
+    }
+    
+    for (i = 0; i < module_archives_count; i++)
+        Module_ArchiveFree(module_archives[i]);
+    free(module_archives);
+    module_archives = NULL;
+    module_archives_count = 0;
+    module_archives_capacity = 0;
+}
+
+/* Sorts module_list so that modules which export a name come before the ones
+ * which import it, so the result of linking doesn't depend on where they are
+ * on the SD card. Modules which don't depend on each other are sorted by path.
+ * Modules in a cycle are reported, and linked in path order. */
+static void Module_ListOrder(void) {
+    module_order_export_t *exports = NULL;
+    module_order_edge_t *edges = NULL;
+    size_t exports_count = 0, exports_capacity = 0;
+    size_t edges_count = 0, edges_capacity = 0;
+    size_t *indegree = NULL, *order = NULL;
+    module_metadata_t **list = NULL;
+    module_elf_t **elf_list = NULL;
+    size_t index, i, count;
+    bool *done = NULL, cycle = false;
+    
+    count = module_elf_list_count;
+    assert(count == module_list_count);
+    if (count < 2)
+        return;
+    
+    if (!Module_OrderExports(&exports, &exports_count, &exports_capacity))
+        goto exit_error;
+    
+    for (index = 0; index < count; index++) {
+        const module_elf_t *module;
+        
+        module = module_elf_list[index];
+        
+        if (module->prelink != NULL) {
+            for (i = 0; i < module->prelink->name_count; i++) {
+                if (!Module_OrderImport(
+                        module->prelink->name_list[i], index, exports,
+                        exports_count, &edges, &edges_count, &edges_capacity))
+                    goto exit_error;
+            }
+            continue;
+        }
+        
+        for (i = 1; i < module->symtab_count; i++) {
+            const char *name;
+            
+            if (module->symtab[i].st_shndx != SHN_UNDEF ||
+                ELF32_ST_BIND(module->symtab[i].st_info) == STB_LOCAL)
+                continue;
+            
+            name = elf_strptr(
+                module->elf, module->symtab_strndx, module->symtab[i].st_name);
+            if (name != NULL &&
+                !Module_OrderImport(
+                    name, index, exports, exports_count, &edges,
+                    &edges_count, &edges_capacity))
+                goto exit_error;
+        }
+    }
+    
+    indegree = calloc(count, sizeof(size_t));
+    order = malloc(count * sizeof(size_t));
+    done = calloc(count, sizeof(bool));
+    list = malloc(count * sizeof(module_metadata_t *));
+    elf_list = malloc(count * sizeof(module_elf_t *));
+    if (indegree == NULL || order == NULL || done == NULL || list == NULL ||
+        elf_list == NULL)
+        goto exit_error;
+    
+    for (i = 0; i < edges_count; i++)
+        indegree[edges[i].importer]++;
+    
+    for (index = 0; index < count; index++) {
+        size_t next = count;
+        
+        for (i = 0; i < count; i++) {
+            if (!done[i] && indegree[i] == 0 &&
+                (next == count || Module_OrderBefore(i, next)))
+                next = i;
+        }
+        
+        if (next == count) {
+            /* everything left is in or after a cycle. */
+            if (!cycle) {
+                Module_OrderReportCycles(done, edges, edges_count, count);
+                module_has_info = true;
+                cycle = true;
+            }
+            
+            for (i = 0; i < count; i++) {
+                if (!done[i] && (next == count || Module_OrderBefore(i, next)))
+                    next = i;
+            }
+        }
+        
+        assert(next < count);
+        done[next] = true;
+        order[index] = next;
+        for (i = 0; i < edges_count; i++) {
+            if (edges[i].exporter == next && indegree[edges[i].importer] > 0)
+                indegree[edges[i].importer]--;
+        }
+    }
+    
+    for (index = 0; index < count; index++) {
+        list[index] = module_list[order[index]];
+        elf_list[index] = module_elf_list[order[index]];
+    }
+    memcpy(module_list, list, count * sizeof(module_metadata_t *));
+    memcpy(module_elf_list, elf_list, count * sizeof(module_elf_t *));
+    
+exit_error:
+    /* without memory, the modules are linked in the order they were found. */
+    free(exports);
+    free(edges);
+    free(indegree);
+    free(order);
+    free(done);
+    free(list);
+    free(elf_list);
+}
+
+/* Lists the names each module exports, sorted by name. These are the names
+ * given to BSLUG_EXPORT, and every global an archive member defines. */
+static bool Module_OrderExports(
+        module_order_export_t **exports, size_t *count, size_t *capacity) {
+    size_t index, i;
+    
+    for (index = 0; index < module_elf_list_count; index++) {
+        const module_elf_t *module;
+        
+        module = module_elf_list[index];
+        
+        for (i = 1; i < module->symtab_count; i++) {
+            const Elf32_Sym *symbol;
+            module_order_export_t *export;
+            const char *name;
+            
+            symbol = &module->symtab[i];
+            if (ELF32_ST_BIND(symbol->st_info) == STB_LOCAL ||
+                symbol->st_shndx == SHN_UNDEF ||
+                symbol->st_shndx >= module->section_count ||
+                !module->sections[symbol->st_shndx].live)
+                continue;
+            
+            name = elf_strptr(
+                module->elf, module->symtab_strndx, symbol->st_name);
+            if (name == NULL)
+                continue;
+            if (!module->member) {
+                if (strncmp(
+                        name, MODULE_EXPORT_PREFIX,
+                        strlen(MODULE_EXPORT_PREFIX)) != 0)
+                    continue;
+                name += strlen(MODULE_EXPORT_PREFIX);
+            }
+            
+            export = Module_ListAllocate(
+                exports, sizeof(module_order_export_t), 1, capacity, count,
+                MODULE_EXPORTS_CAPACITY_DEFAULT);
+            if (export == NULL)
+                return false;
+            export->name = name;
+            export->module = index;
+        }
+    }
+    
+    if (*count > 0)
+        qsort(
+            *exports, *count, sizeof(module_order_export_t),
+            &Module_OrderExportCompare);
+    
+    return true;
+}
+
+/* Adds an edge to importer from each other module which exports name. */
+static bool Module_OrderImport(
+        const char *name, size_t importer, const module_order_export_t *exports,
+        size_t exports_count, module_order_edge_t **edges, size_t *count,
+        size_t *capacity) {
+    module_order_export_t key;
+    const module_order_export_t *found, *end;
+    
+    if (exports_count == 0)
+        return true;
+    
+    key.name = name;
+    found = bsearch(
+        &key, exports, exports_count, sizeof(module_order_export_t),
+        &Module_OrderExportCompare);
+    if (found == NULL)
+        return true;
+    
+    /* there may be several with the name. */
+    while (found > exports && strcmp(found[-1].name, name) == 0)
+        found--;
+    for (end = exports + exports_count;
+         found < end && strcmp(found->name, name) == 0;
+         found++) {
+        module_order_edge_t *edge;
+        
+        if (found->module == importer)
+            continue;
+        
+        edge = Module_ListAllocate(
+            edges, sizeof(module_order_edge_t), 1, capacity, count,
+            MODULE_EXPORTS_CAPACITY_DEFAULT);
+        if (edge == NULL)
+            return false;
+        edge->exporter = found->module;
+        edge->importer = importer;
+    }
+    
+    return true;
+}
+
+static int Module_OrderExportCompare(const void *left, const void *right) {
+    return strcmp(
+        ((const module_order_export_t *)left)->name,
+        ((const module_order_export_t *)right)->name);
+}
+
+/* Whether module left goes before module right when neither depends on the
+ * other. Archive members share their archive's path, so are kept in order. */
+static bool Module_OrderBefore(size_t left, size_t right) {
+    int compare;
+    
+    compare = strcmp(module_list[left]->path, module_list[right]->path);
+    if (compare != 0)
+        return compare < 0;
+    return left < right;
+}
+
+/* Reports each cycle among the modules not yet done: the sets of modules which
+ * each depend on all the others, found from which modules each can reach.
+ * Modules which only depend on a cycle aren't part of it, so aren't listed. */
+static void Module_OrderReportCycles(
+        const bool *done, const module_order_edge_t *edges, size_t edges_count,
+        size_t count) {
+    bool *reach, *reported;
+    size_t i, j, k;
+    
+    reach = calloc(count * count, sizeof(bool));
+    reported = calloc(count, sizeof(bool));
+    if (reach == NULL || reported == NULL) {
+        /* without memory, list everything which is left. */
+        printf("Warning: Modules depend on each other:\n");
+        for (i = 0; i < count; i++) {
+            if (!done[i])
+                printf("\t%s\n", module_list[i]->path);
+        }
+        goto exit_error;
+    }
+    
+    /* reach[i * count + j] is whether module j depends on module i. */
+    for (i = 0; i < edges_count; i++) {
+        if (!done[edges[i].exporter] && !done[edges[i].importer])
+            reach[edges[i].exporter * count + edges[i].importer] = true;
+    }
+    for (k = 0; k < count; k++) {
+        if (done[k])
+            continue;
+        for (i = 0; i < count; i++) {
+            if (done[i] || !reach[i * count + k])
+                continue;
+            for (j = 0; j < count; j++) {
+                if (reach[k * count + j])
+                    reach[i * count + j] = true;
+            }
+        }
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (done[i] || reported[i] || !reach[i * count + i])
+            continue;
+        
+        printf("Warning: Modules depend on each other:\n");
+        for (j = i; j < count; j++) {
+            if (reach[i * count + j] && reach[j * count + i]) {
+                printf("\t%s\n", module_list[j]->path);
+                reported[j] = true;
+            }
+        }
+    }
+    
+exit_error:
+    free(reach);
+    free(reported);
+}
+
+/* Returns true if a loaded section of a module defines the global name. */
+static bool Module_ListDefines(const char *name) {
+    size_t index, i;
+    
+    for (index = 0; index < module_elf_list_count; index++) {
+        const module_elf_t *module;
+        
+        module = module_elf_list[index];
+        
+        for (i = 1; i < module->symtab_count; i++) {
+            const Elf32_Sym *symbol;
+            const char *symbol_name;
+            
+            symbol = &module->symtab[i];
+            if (ELF32_ST_BIND(symbol->st_info) == STB_LOCAL ||
+                symbol->st_shndx == SHN_UNDEF ||
+                symbol->st_shndx >= module->section_count ||
+                !module->sections[symbol->st_shndx].live)
+                continue;
+            
+            symbol_name = elf_strptr(
+                module->elf, module->symtab_strndx, symbol->st_name);
+            if (symbol_name != NULL && strcmp(symbol_name, name) == 0)
+                return true;
+        }
+    }
+    
+    return false;
+}
+
+static void Module_LoadArchiveMember(
+        module_archive_t *archive, uint32_t member) {
+    module_archive_header_t header;
+    unsigned char ident[EI_NIDENT];
+    char name[sizeof(header.name) + 1];
+    const char *member_name;
+    size_t size, i;
+    int fd;
+    
+    /* every symbol of the member is now defined, or it won't load. */
+    for (i = 0; i < archive->symbol_count; i++) {
+        if (archive->symbols[i].member == member)
+            archive->symbols[i].loaded = true;
+    }
+    
+    fd = open(archive->path, O_RDONLY, 0);
+    if (fd == -1)
+        return;
+    
+    if (!Module_ArchiveHeader(fd, member, &header, &size) ||
+        !Module_ElfRead(fd, member + sizeof(header), ident, sizeof(ident))) {
+        printf("Warning: Ignoring '%s' - Invalid archive.\n", archive->path);
+        module_has_info = true;
+        goto exit_error;
+    }
+    
+    /* names are "name/", or "/offset" into the long names. */
+    memcpy(name, header.name, sizeof(header.name));
+    name[sizeof(header.name)] = '\0';
+    member_name = name;
+    if (name[0] == '/' && archive->long_names != NULL) {
+        size_t long_name;
+        
+        long_name = strtoul(name + 1, NULL, 10);
+        if (long_name < archive->long_names_size)
+            member_name = archive->long_names + long_name;
+    }
+    for (i = 0; member_name[i] != '/' && member_name[i] != '\n' &&
+                member_name[i] != '\0'; i++);
+    
+    {
+        char member_copy[i + 1];
+        
+        memcpy(member_copy, member_name, i);
+        member_copy[i] = '\0';
+        
+        if (ident[0] == ELFMAG0 && ident[1] == ELFMAG1 &&
+            ident[2] == ELFMAG2 && ident[3] == ELFMAG3) {
+            Module_LoadElf(
+                archive->path, fd, ident, member + sizeof(header),
+                member_copy);
+        } else {
+            printf(
+                "Warning: Ignoring '%s(%s)' - Invalid ELF file.\n",
+                archive->path, member_copy);
+            module_has_info = true;
+        }
+    }
+    
+exit_error:
+    close(fd);
+}
+
+static bool Module_ElfRead(int fd, off_t offset, void *destination, size_t size) {
+    if (lseek(fd, offset, SEEK_SET) != offset)
+        return false;
+    
+    while (size > 0) {
+        ssize_t count;
+        
+        count = read(fd, destination, size);
+        if (count <= 0)
+            return false;
+        
+        destination = (char *)destination + count;
+        size -= count;
+    }
+    
+    return true;
+}
+
+/* Counts the BSLUG_HOOK_AT entries in the size bytes of .bslug.load at offset
+ * in fd. The type fields are constants, so they needn't be linked first. */
+static bool Module_LoadHooksCount(
+        int fd, off_t offset, size_t size, size_t *hooks_count) {
+    bslug_loader_entry_t *entries;
+    size_t i;
+    
+    assert(hooks_count != NULL);
+    
+    *hooks_count = 0;
+    if (size < sizeof(bslug_loader_entry_t))
+        return true;
+    
+    entries = malloc(size);
+    if (entries == NULL)
+        return false;
+    if (!Module_ElfRead(fd, offset, entries, size)) {
+        free(entries);
+        return false;
+    }
+    
+    for (i = 0; i < size / sizeof(bslug_loader_entry_t); i++) {
+        if (BSLUG_LOADER_ENTRY_TYPE(entries + i) == BSLUG_LOADER_ENTRY_HOOK_AT)
+            (*hooks_count)++;
+    }
+    
+    free(entries);
+    return true;
+}
+
+/* The space at the end of the module space for the stubs of a module with
+ * entries_count entries. */
+static size_t Module_StubsSize(
+        const module_elf_t *module, size_t entries_count) {
+    assert(module->hooks_count <= entries_count);
+    
+    return
+        (entries_count - module->hooks_count) * MODULE_REPLACE_STUB_SIZE +
+        module->hooks_count * MODULE_HOOK_STUB_SIZE;
+}
+
+static module_elf_t *Module_ElfOpen(int fd, off_t offset) {
+    Elf *elf;
+    Elf_Scn *scn;
+    Elf_Data file, memory;
+    Elf32_Ehdr ehdr;
+    Elf32_Shdr *shdrs = NULL;
+    unsigned char ehdr_file[sizeof(Elf32_Ehdr)];
+    unsigned char *shdrs_file = NULL;
+    size_t ehdr_size, shdr_size, image_size, shstrndx, i;
+    module_elf_t *module = NULL;
+    
+    /* The sections which are loaded are read straight from the file into
+     * place by Module_ElfLoadSection, so rather than have libelf read the
+     * whole file, it gets an image with just the headers and the sections the
+     * loader itself reads: the symbols, strings and relocations. */
+    
+    module = calloc(1, sizeof(module_elf_t));
+    if (module == NULL)
+        goto exit_error;
+    
+    module->fd = fd;
+    module->offset = offset;
+    
+    ehdr_size = elf32_fsize(ELF_T_EHDR, 1, EV_CURRENT);
+    shdr_size = elf32_fsize(ELF_T_SHDR, 1, EV_CURRENT);
+    assert(ehdr_size <= sizeof(ehdr_file));
+    
+    if (!Module_ElfRead(fd, offset, ehdr_file, ehdr_size))
+        goto exit_error;
+    if (ehdr_file[EI_CLASS] != ELFCLASS32)
+        goto exit_error;
+    
+    file.d_buf = ehdr_file;
+    file.d_size = ehdr_size;
+    file.d_type = ELF_T_EHDR;
+    file.d_version = EV_CURRENT;
+    memory.d_buf = &ehdr;
+    memory.d_size = sizeof(ehdr);
+    memory.d_version = EV_CURRENT;
+    if (elf32_xlatetom(&memory, &file, ehdr_file[EI_DATA]) == NULL)
+        goto exit_error;
+    
+    if (ehdr.e_shnum == 0 || ehdr.e_shentsize != shdr_size)
+        goto exit_error;
+    
+    module->section_count = ehdr.e_shnum;
+    module->sections = calloc(
+        module->section_count, sizeof(module_elf_section_t));
+    module->relocations = malloc(module->section_count * sizeof(size_t));
+    shdrs = malloc(module->section_count * sizeof(Elf32_Shdr));
+    shdrs_file = malloc(module->section_count * shdr_size);
+    if (module->sections == NULL || module->relocations == NULL ||
+        shdrs == NULL || shdrs_file == NULL)
+        goto exit_error;
+    
+    if (!Module_ElfRead(
+            fd, offset + ehdr.e_shoff, shdrs_file,
+            module->section_count * shdr_size))
+        goto exit_error;
+    
+    file.d_buf = shdrs_file;
+    file.d_size = module->section_count * shdr_size;
+    file.d_type = ELF_T_SHDR;
+    memory.d_buf = shdrs;
+    memory.d_size = module->section_count * sizeof(Elf32_Shdr);
+    if (elf32_xlatetom(&memory, &file, ehdr_file[EI_DATA]) == NULL)
+        goto exit_error;
+    
+    /* the image is the header, then the section headers, then the sections
+     * libelf needs. */
+    image_size = ehdr_size + module->section_count * shdr_size;
+    for (i = 1; i < module->section_count; i++) {
+        if (Module_ElfKeepSection(shdrs, module->section_count, i))
+            image_size += shdrs[i].sh_size;
+    }
+    
+    module->image = malloc(image_size);
+    if (module->image == NULL)
+        goto exit_error;
+    
+    image_size = ehdr_size + module->section_count * shdr_size;
+    for (i = 1; i < module->section_count; i++) {
+        module->sections[i].offset = shdrs[i].sh_offset;
+        
+        if (Module_ElfKeepSection(shdrs, module->section_count, i)) {
+            if (!Module_ElfRead(
+                    fd, offset + shdrs[i].sh_offset,
+                    module->image + image_size, shdrs[i].sh_size))
+                goto exit_error;
+            
+            shdrs[i].sh_offset = image_size;
+            image_size += shdrs[i].sh_size;
+        } else
+            shdrs[i].sh_offset = 0;
+    }
+    
+    ehdr.e_shoff = ehdr_size;
+    
+    file.d_buf = module->image;
+    file.d_size = ehdr_size;
+    file.d_type = ELF_T_EHDR;
+    memory.d_buf = &ehdr;
+    memory.d_size = sizeof(ehdr);
+    if (elf32_xlatetof(&file, &memory, ehdr_file[EI_DATA]) == NULL)
+        goto exit_error;
+    
+    file.d_buf = module->image + ehdr_size;
+    file.d_size = module->section_count * shdr_size;
+    file.d_type = ELF_T_SHDR;
+    memory.d_buf = shdrs;
+    memory.d_size = module->section_count * sizeof(Elf32_Shdr);
+    if (elf32_xlatetof(&file, &memory, ehdr_file[EI_DATA]) == NULL)
+        goto exit_error;
+    
+    free(shdrs);
+    shdrs = NULL;
+    free(shdrs_file);
+    shdrs_file = NULL;
+    
+    elf = elf_memory(module->image, image_size);
+    if (elf == NULL)
+        goto exit_error;
+    
+    module->elf = elf;
+    
+    if (elf_getshdrstrndx(elf, &shstrndx) != 0)
+        goto exit_error;
+    
+    for (scn = elf_nextscn(elf, NULL);
+         scn != NULL;
+         scn = elf_nextscn(elf, scn)) {
+        
+        module_elf_section_t *section;
+        size_t index;
+        
+        index = elf_ndxscn(scn);
+        if (index >= module->section_count)
+            goto exit_error;
+        
+        section = &module->sections[index];
+        section->scn = scn;
+        section->shdr = elf32_getshdr(scn);
+        if (section->shdr == NULL)
+            continue;
+        
+        section->name = elf_strptr(elf, shstrndx, section->shdr->sh_name);
+        
+        if ((section->shdr->sh_type == SHT_REL ||
+             section->shdr->sh_type == SHT_RELA) &&
+            section->shdr->sh_offset != 0) {
+            
+            section->data = elf_getdata(scn, NULL);
+            module->relocations[module->relocations_count++] = index;
+        }
+    }
+    
+    /* index the relocations by the section they apply to. The sections were
+     * all found above, so later entries exist even if they come after. */
+    for (i = module->relocations_count; i > 0; i--) {
+        module_elf_section_t *section, *target;
+        
+        section = &module->sections[module->relocations[i - 1]];
+        if (section->shdr->sh_info >= module->section_count)
+            continue;
+        
+        target = &module->sections[section->shdr->sh_info];
+        section->relocation_next = target->relocation;
+        target->relocation = module->relocations[i - 1];
+    }
+    
+    /* a missing symtab is reported by the caller. */
+    if (!Module_LoadElfSymtab(module)) {
+        free(module->symtab);
+        module->symtab = NULL;
+    }
+    
+    return module;
+exit_error:
+    if (shdrs != NULL)
+        free(shdrs);
+    if (shdrs_file != NULL)
+        free(shdrs_file);
+    if (module != NULL) {
+        /* the caller still owns fd. */
+        module->fd = -1;
+        Module_ElfClose(module);
+    }
+    return NULL;
+}
+
+/* Returns true if libelf needs section index's contents. */
+static bool Module_ElfKeepSection(
+        const Elf32_Shdr *shdrs, size_t count, size_t index) {
+    switch (shdrs[index].sh_type) {
+        case SHT_SYMTAB:
+        case SHT_STRTAB:
+            return true;
+        case SHT_REL:
+        case SHT_RELA:
+            /* relocations of debugging information aren't used. */
+            return
+                shdrs[index].sh_info < count &&
+                (shdrs[shdrs[index].sh_info].sh_flags & SHF_ALLOC);
+        default:
+            return false;
+    }
+}
+
+static void Module_ElfClose(module_elf_t *module) {
+    assert(module != NULL);
+    
+    if (module->elf != NULL)
+        elf_end(module->elf);
+    if (module->prelink != NULL) {
+        free(module->prelink->fixups);
+        free(module->prelink->names);
+        free(module->prelink->name_list);
+        free(module->prelink);
+    }
+    if (module->fd != -1)
+        close(module->fd);
+    free(module->image);
+    free(module->sections);
+    free(module->symtab);
+    free(module->relocations);
+    free(module);
+}
+
+static bool Module_LoadElfSymtab(module_elf_t *module) {
+    size_t i;
+
+    for (i = 1; i < module->section_count; i++) {
+        Elf32_Shdr *shdr;
+        
+        shdr = module->sections[i].shdr;
+        if (shdr == NULL)
+            continue;
+            
+        if (shdr->sh_type == SHT_SYMTAB) {
+            size_t sym;
+            
+            assert (module->symtab == NULL);
+            module->symtab = malloc(shdr->sh_size);
+            if (module->symtab == NULL)
+                continue;
+            
+            module->symtab_count = shdr->sh_size / sizeof(Elf32_Sym);
+            module->symtab_strndx = shdr->sh_link;
+
+            if (!Module_ElfLoadSection(module, i, module->symtab))
+                return false;
+            
+            for (sym = 0; sym < module->symtab_count; sym++)
+                module->symtab[sym].st_other = 0;
+            
+            break;
+        }
+    }
+    
+    return module->symtab != NULL;
+}
+
+/* Returns true if section is one that would be copied into memory. */
+static bool Module_ElfSectionLoaded(const module_elf_section_t *section) {
+    if (section->shdr == NULL || section->name == NULL)
+        return false;
+    if (section->shdr->sh_type != SHT_PROGBITS &&
+        section->shdr->sh_type != SHT_NOBITS)
+        return false;
+    if (!(section->shdr->sh_flags & SHF_ALLOC))
+        return false;
+    return strcmp(section->name, ".bslug.meta") != 0;
+}
+
+/* Marks the sections which are reachable, so that the others needn't be
+ * loaded. The .bslug.load entries are what the loader uses, so they are the
+ * roots, and a section is reachable if a reachable section has a relocation
+ * against a symbol in it. Other modules can only refer to this one through
+ * its exports, which are entries, so each module can be done on its own.
+ * Archive members have no entries; their global symbols are the roots. */
+static bool Module_ElfMarkLive(module_elf_t *module) {
+    size_t *stack, stack_count, i;
+    
+    stack = malloc(module->section_count * sizeof(size_t));
+    if (stack == NULL)
+        return false;
+    
+    stack_count = 0;
+    for (i = 1; i < module->section_count; i++) {
+        module->sections[i].live = false;
+        
+        if (Module_ElfSectionLoaded(&module->sections[i]) &&
+            strcmp(module->sections[i].name, ".bslug.load") == 0) {
+            module->sections[i].live = true;
+            stack[stack_count++] = i;
+        }
+    }
+    
+    for (i = 1; module->member && i < module->symtab_count; i++) {
+        size_t shndx;
+        
+        shndx = module->symtab[i].st_shndx;
+        if (ELF32_ST_BIND(module->symtab[i].st_info) == STB_LOCAL ||
+            shndx == SHN_UNDEF || shndx >= module->section_count)
+            continue;
+        
+        if (!module->sections[shndx].live &&
+            Module_ElfSectionLoaded(&module->sections[shndx])) {
+            module->sections[shndx].live = true;
+            stack[stack_count++] = shndx;
+        }
+    }
+    
+    while (stack_count > 0) {
+        size_t relocation;
+        
+        i = stack[--stack_count];
+        
+        for (relocation = module->sections[i].relocation;
+             relocation != 0;
+             relocation = module->sections[relocation].relocation_next) {
+            
+            const module_elf_section_t *section;
+            size_t entry_size, count, j;
+            
+            section = &module->sections[relocation];
+            if (section->data == NULL)
+                continue;
+            
+            entry_size =
+                section->shdr->sh_type == SHT_REL ?
+                sizeof(Elf32_Rel) : sizeof(Elf32_Rela);
+            count = section->shdr->sh_size / entry_size;
+            
+            for (j = 0; j < count; j++) {
+                const Elf32_Rel *rel;
+                size_t symbol, shndx;
+                
+                /* an Elf32_Rela starts with the same fields. */
+                rel = (const Elf32_Rel *)
+                    ((const char *)section->data->d_buf + j * entry_size);
+                
+                symbol = ELF32_R_SYM(rel->r_info);
+                if (symbol >= module->symtab_count)
+                    continue;
+                
+                shndx = module->symtab[symbol].st_shndx;
+                if (shndx == SHN_UNDEF || shndx >= SHN_LORESERVE ||
+                    shndx >= module->section_count)
+                    continue;
+                
+                if (!module->sections[shndx].live &&
+                    Module_ElfSectionLoaded(&module->sections[shndx])) {
+                    module->sections[shndx].live = true;
+                    stack[stack_count++] = shndx;
+                }
+            }
+        }
+    }
+    
+    free(stack);
+    return true;
+}
+
+static module_metadata_t *Module_MetadataRead(
+        const char *path, size_t index, module_elf_t *module) {
+    char *metadata = NULL, *metadata_end;
+    module_metadata_t *ret = NULL;
+    size_t i, metadata_shndx, entries_count;
+    
+    entries_count = 0;
+    metadata_shndx = 0;
+    
+    for (i = 1; i < module->section_count; i++) {
+        Elf32_Shdr *shdr;
+        const char *name;
+        
+        shdr = module->sections[i].shdr;
+        if (shdr == NULL)
+            continue;
+            
+        name = module->sections[i].name;
+        if (name == NULL)
+            continue;
+        
+        if (strcmp(name, ".bslug.meta") == 0) {
+            if (shdr->sh_size == 0)
+                continue;
+            
+            if (metadata != NULL)
+                continue;
+            metadata = malloc(shdr->sh_size);
+            if (metadata == NULL)
+                continue;
+                
+            if (!Module_ElfLoadSection(module, i, metadata)) {
+                printf(
+                    "Warning: Ignoring '%s' - Couldn't load .bslug.meta.\n",
+                    path);
+                module_has_info = true;
+                goto exit_error;
+            }
+            
+            metadata_shndx = i;
+            Module_ElfLoadSymbols(
+                i, metadata, module->symtab, module->symtab_count);
+            
+            if (!Module_ElfLink(index, module, i, metadata, false)) {
+                printf(
+                    "Warning: Ignoring '%s' - .bslug.meta contains invalid "
+                    "relocations.\n", path);
+                module_has_info = true;
+                goto exit_error;
+            }
+            
+            metadata_end = metadata + shdr->sh_size;
+            metadata_end[-1] = '\0';
+        } else if (strcmp(name, ".bslug.load") == 0) {
+            entries_count = shdr->sh_size / sizeof(bslug_loader_entry_t);
         }
     }
 
@@ -639,6 +2166,28 @@ static module_metadata_t *Module_MetadataRead(
         goto exit_error;
     }
     
+    ret = Module_MetadataParse(path, metadata, metadata_end, entries_count);
+    
+exit_error:
+    if (metadata != NULL) {
+        /* the symtab is kept for linking, which doesn't load .bslug.meta. */
+        Module_ElfUnloadSymbols(
+            metadata_shndx, metadata, module->symtab, module->symtab_count);
+        free(metadata);
+    }
+        
+    return ret;
+}
+
+/* Reads the "key=value" strings of .bslug.meta, from metadata up to
+ * metadata_end, which must be a NUL. */
+static module_metadata_t *Module_MetadataParse(
+        const char *path, char *metadata, char *metadata_end,
+        size_t entries_count) {
+    char *metadata_cur;
+    const char *game, *name, *author, *version, *license, *bslug;
+    module_metadata_t *ret = NULL;
+    
     game = NULL;
     name = NULL;
     author = NULL;
@@ -720,7 +2269,9 @@ static module_metadata_t *Module_MetadataRead(
     
     if (game == NULL)
         game = "";
-    if (bslug == NULL || strcmp(bslug, "0.1") != 0) {
+    /* 0.2 modules hash their .bslug.load names; 0.1 ones don't. */
+    if (bslug == NULL ||
+        (strcmp(bslug, "0.1") != 0 && strcmp(bslug, "0.2") != 0)) {
         printf("Warning: Ignoring '%s' - Unrecognised BSlug version.\n", path);
         module_has_info = true;
         goto exit_error;
@@ -754,16 +2305,50 @@ static module_metadata_t *Module_MetadataRead(
         goto exit_error;
     }
     
-    ret = malloc(
-        sizeof(module_metadata_t) + strlen(path) +
-        strlen(game) + strlen(name) + strlen(author) +
-        strlen(version) + strlen(license) + 6);
+    ret = Module_MetadataCreate(
+        path, game, name, author, version, license, entries_count);
     if (ret == NULL) {
         printf("Warning: Ignoring '%s' - Couldn't parse BSlug metadata.\n", path);
         module_has_info = true;
         goto exit_error;
     }
     
+exit_error:
+    return ret;
+}
+
+/* Returns true if the module suits the game in the drive. */
+static bool Module_MetadataForGame(const module_metadata_t *metadata) {
+    size_t i;
+    
+    for (i = 0; metadata->game[i] != '\0'; i++) {
+        if (metadata->game[i] != '?') {
+            Event_Wait(&apploader_event_disk_id);
+            if ((i < 4 && metadata->game[i] != os0->disc.gamename[i]) ||
+                (i >= 4 && i < 6 &&
+                 metadata->game[i] != os0->disc.company[i - 4]) ||
+                i >= 6)
+                return false;
+        }
+    }
+    
+    return true;
+}
+
+static module_metadata_t *Module_MetadataCreate(
+        const char *path, const char *game, const char *name,
+        const char *author, const char *version, const char *license,
+        size_t entries_count) {
+    module_metadata_t *ret;
+    char *tmp;
+    
+    ret = malloc(
+        sizeof(module_metadata_t) + strlen(path) +
+        strlen(game) + strlen(name) + strlen(author) +
+        strlen(version) + strlen(license) + 6);
+    if (ret == NULL)
+        return NULL;
+    
     tmp = (char *)(ret + 1);
     strcpy(tmp, path);
     ret->path = tmp;
@@ -785,35 +2370,43 @@ static module_metadata_t *Module_MetadataRead(
     ret->size = 0;
     ret->entries_count = entries_count;
     
-exit_error:
-    if (metadata != NULL)
-        free(metadata);
-        
     return ret;
 }
 
 static bool Module_ElfLoadSection(
-        const Elf *elf, Elf_Scn *scn, const Elf32_Shdr *shdr,
-        void *destination) {
+        const module_elf_t *module, size_t shndx, void *destination) {
+    const module_elf_section_t *section;
         
     assert(destination != NULL);
+    assert(shndx < module->section_count);
     
-    switch (shdr->sh_type) {
-        case SHT_SYMTAB:
-        case SHT_PROGBITS: {
+    section = &module->sections[shndx];
+    assert(section->shdr != NULL);
+    
+    switch (section->shdr->sh_type) {
+        case SHT_SYMTAB: {
             Elf_Data *data;
             size_t n;
         
             n = 0;
-            for (data = elf_getdata(scn, NULL);
+            for (data = elf_getdata(section->scn, NULL);
                  data != NULL;
-                 data = elf_getdata(scn, data)) {
+                 data = elf_getdata(section->scn, data)) {
                 memcpy((char *)destination + n, data->d_buf, data->d_size);
                 n += data->d_size;
             }
             return true;
+        } case SHT_PROGBITS: {
+            /* only allocated sections can be read; see Module_ElfOpen. */
+            if (!(section->shdr->sh_flags & SHF_ALLOC))
+                return false;
+            
+            assert(module->fd != -1);
+            return Module_ElfRead(
+                module->fd, module->offset + section->offset, destination,
+                section->shdr->sh_size);
         } case SHT_NOBITS: {
-            memset(destination, 0, shdr->sh_size);
+            memset(destination, 0, section->shdr->sh_size);
             return true;
         } default:
             return false;
@@ -838,189 +2431,173 @@ static void Module_ElfLoadSymbols(
     }
 }
 
+static void Module_ElfUnloadSymbols(
+        size_t shndx, const void *destination,
+        Elf32_Sym *symtab, size_t symtab_count) {
+    
+    size_t i;
+    
+    /* undoes Module_ElfLoadSymbols. */
+    for (i = 0; i < symtab_count; i++) {
+        if (symtab[i].st_shndx == shndx &&
+            symtab[i].st_other == 1) {
+            
+            symtab[i].st_value -= (Elf32_Addr)destination;
+            symtab[i].st_other = 0;
+        }
+    }
+}
+
 static bool Module_ElfLink(
-        size_t index, Elf *elf, size_t shndx, void *destination,
-        Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx,
-        bool allow_globals) {
-    Elf_Scn *scn;
+        size_t index, const module_elf_t *module, size_t shndx,
+        void *destination, bool allow_globals) {
+    size_t relocation;
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
-        
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
+    for (relocation = module->sections[shndx].relocation;
+         relocation != 0;
+         relocation = module->sections[relocation].relocation_next) {
         
-        switch (shdr->sh_type) {
-            case SHT_REL: {
-                const Elf32_Rel *rel;
-                Elf_Data *data;
-                size_t i;
+        if (!Module_ElfLinkRelocations(
+                index, module, relocation, destination, allow_globals))
+            return false;
+    }
+    
+    return true;
+}
+
+static bool Module_ElfLinkRelocations(
+        size_t index, const module_elf_t *module, size_t relocation,
+        void *destination, bool allow_globals) {
+    Elf *elf = module->elf;
+    Elf32_Sym *symtab = module->symtab;
+    size_t symtab_count = module->symtab_count;
+    size_t symtab_strndx = module->symtab_strndx;
+    Elf32_Shdr *shdr;
+    size_t size;
+    
+    shdr = module->sections[relocation].shdr;
+    if (shdr->sh_info >= module->section_count)
+        return false;
+    size = module->sections[shdr->sh_info].shdr->sh_size;
+    
+    switch (shdr->sh_type) {
+        case SHT_REL: {
+            const Elf32_Rel *rel;
+            Elf_Data *data;
+            size_t i;
+            
+            data = module->sections[relocation].data;
+            if (data == NULL)
+                break;
                 
-                if (shdr->sh_info != shndx)
-                    continue;
+            rel = data->d_buf;
+            
+            for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rel); i++) {
+                uint32_t symbol_addr;
+                size_t symbol;
                 
-                data = elf_getdata(scn, NULL);
-                if (data == NULL)
-                    continue;
-                    
-                rel = data->d_buf;
+                symbol = ELF32_R_SYM(rel[i].r_info);
                 
-                for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rel); i++) {
-                    uint32_t symbol_addr;
-                    size_t symbol;
-                    
-                    symbol = ELF32_R_SYM(rel[i].r_info);
-                    
-                    if (symbol > symtab_count)
+                if (symbol > symtab_count)
+                    return false;
+                /* the addend is read from the section itself. */
+                if (size < 4 || rel[i].r_offset > size - 4)
+                    return false;
+                
+                switch (symtab[symbol].st_shndx) {
+                    case SHN_ABS: {
+                        symbol_addr = symtab[symbol].st_value;
+                        break;
+                    } case SHN_COMMON: {
                         return false;
-                    
-                    switch (symtab[symbol].st_shndx) {
-                        case SHN_ABS: {
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        } case SHN_COMMON: {
-                            return false;
-                        } case SHN_UNDEF: {
-                            if (allow_globals) {
-                                module_unresolved_relocation_t *reloc;
-                                char *name;
-                                
-                                reloc = Module_ListAllocate(
-                                    &module_relocations,
-                                    sizeof(module_unresolved_relocation_t), 1,
-                                    &module_relocations_capacity,
-                                    &module_relocations_count,
-                                    MODULE_RELOCATIONS_CAPCITY_DEFAULT);
-                                if (reloc == NULL)
-                                    return false;
-                                
-                                name = elf_strptr(
-                                    elf, symtab_strndx, symtab[symbol].st_name);
-                                
-                                if (name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->name = strdup(name);
-                                if (reloc->name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->module = index;
-                                reloc->address = destination;
-                                reloc->offset = rel[i].r_offset;
-                                reloc->type = ELF32_R_TYPE(rel[i].r_info);
-                                reloc->addend = 
+                    } case SHN_UNDEF: {
+                        if (allow_globals) {
+                            if (!Module_RelocationAdd(
+                                    index,
+                                    elf_strptr(
+                                        elf, symtab_strndx,
+                                        symtab[symbol].st_name),
+                                    destination, size, rel[i].r_offset,
+                                    ELF32_R_TYPE(rel[i].r_info),
                                     *(int *)((char *)destination +
-                                        rel[i].r_offset);
-                                
-                                continue;
-                            } else
-                                return false;
-                        } default: {
-                            if (symtab[symbol].st_other != 1)
+                                        rel[i].r_offset)))
                                 return false;
                             
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        }
+                            continue;
+                        } else
+                            return false;
+                    } default: {
+                        if (symtab[symbol].st_other != 1)
+                            return false;
+                        
+                        symbol_addr = symtab[symbol].st_value;
+                        break;
                     }
-                    
-                    if (!Module_ElfLinkOne(
-                            ELF32_R_TYPE(rel[i].r_info), rel[i].r_offset,
-                            *(int *)((char *)destination + rel[i].r_offset),
-                            destination, symbol_addr))
-                        return false;
                 }
+                
+                if (!Module_ElfLinkOne(
+                        ELF32_R_TYPE(rel[i].r_info), rel[i].r_offset,
+                        *(int *)((char *)destination + rel[i].r_offset),
+                        destination, size, symbol_addr))
+                    return false;
+            }
+            break;
+        } case SHT_RELA: {
+            const Elf32_Rela *rela;
+            Elf_Data *data;
+            size_t i;
+            
+            data = module->sections[relocation].data;
+            if (data == NULL)
                 break;
-            } case SHT_RELA: {
-                const Elf32_Rela *rela;
-                Elf_Data *data;
-                size_t i;
                 
-                if (shdr->sh_info != shndx)
-                    continue;
+            rela = data->d_buf;
+            
+            for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rela); i++) {
+                uint32_t symbol_addr;
+                size_t symbol;
                 
-                data = elf_getdata(scn, NULL);
-                if (data == NULL)
-                    continue;
-                    
-                rela = data->d_buf;
+                symbol = ELF32_R_SYM(rela[i].r_info);
                 
-                for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rela); i++) {
-                    uint32_t symbol_addr;
-                    size_t symbol;
-                    
-                    symbol = ELF32_R_SYM(rela[i].r_info);
-                    
-                    if (symbol > symtab_count)
+                if (symbol > symtab_count)
+                    return false;
+                
+                switch (symtab[symbol].st_shndx) {
+                    case SHN_ABS: {
+                        symbol_addr = symtab[symbol].st_value;
+                        break;
+                    } case SHN_COMMON: {
                         return false;
-                    
-                    switch (symtab[symbol].st_shndx) {
-                        case SHN_ABS: {
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        } case SHN_COMMON: {
-                            return false;
-                        } case SHN_UNDEF: {
-                            if (allow_globals) {
-                                module_unresolved_relocation_t *reloc;
-                                char *name;
-                                
-                                reloc = Module_ListAllocate(
-                                    &module_relocations,
-                                    sizeof(module_unresolved_relocation_t), 1,
-                                    &module_relocations_capacity,
-                                    &module_relocations_count,
-                                    MODULE_RELOCATIONS_CAPCITY_DEFAULT);
-                                if (reloc == NULL)
-                                    return false;
-                                
-                                name = elf_strptr(
-                                    elf, symtab_strndx, symtab[symbol].st_name);
-                                
-                                if (name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->name = strdup(name);
-                                if (reloc->name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->module = index;
-                                reloc->address = destination;
-                                reloc->offset = rela[i].r_offset;
-                                reloc->type = ELF32_R_TYPE(rela[i].r_info);
-                                reloc->addend = rela[i].r_addend;
-                                
-                                continue;
-                            } else
-                                return false;
-                        } default: {
-                            if (symtab[symbol].st_other != 1)
+                    } case SHN_UNDEF: {
+                        if (allow_globals) {
+                            if (!Module_RelocationAdd(
+                                    index,
+                                    elf_strptr(
+                                        elf, symtab_strndx,
+                                        symtab[symbol].st_name),
+                                    destination, size, rela[i].r_offset,
+                                    ELF32_R_TYPE(rela[i].r_info),
+                                    rela[i].r_addend))
                                 return false;
                             
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        }
+                            continue;
+                        } else
+                            return false;
+                    } default: {
+                        if (symtab[symbol].st_other != 1)
+                            return false;
+                        
+                        symbol_addr = symtab[symbol].st_value;
+                        break;
                     }
-                                
-                    if (!Module_ElfLinkOne(
-                            ELF32_R_TYPE(rela[i].r_info), rela[i].r_offset,
-                            rela[i].r_addend, destination, symbol_addr))
-                        return false;
                 }
-                break;
+                            
+                if (!Module_ElfLinkOne(
+                        ELF32_R_TYPE(rela[i].r_info), rela[i].r_offset,
+                        rela[i].r_addend, destination, size, symbol_addr))
+                    return false;
             }
+            break;
         }
     }
     
@@ -1029,104 +2606,27 @@ static bool Module_ElfLink(
 
 static bool Module_ElfLinkOne(
         char type, size_t offset, int addend,
-        void *destination, uint32_t symbol_addr) {
-    int value;
+        void *destination, size_t size, uint32_t symbol_addr) {
+    link_image_t image;
     char *target = (char *)destination + offset;
     bool result = false;
-
-    switch (type) {
-        case R_PPC_ADDR32:
-        case R_PPC_ADDR24:
-        case R_PPC_ADDR16:
-        case R_PPC_ADDR16_HI:
-        case R_PPC_ADDR16_HA:
-        case R_PPC_ADDR16_LO:
-        case R_PPC_ADDR14:
-        case R_PPC_ADDR14_BRTAKEN:
-        case R_PPC_ADDR14_BRNTAKEN:
-        case R_PPC_UADDR32:
-        case R_PPC_UADDR16: {
-            value = (int)symbol_addr + addend;
-            break;
-        } case R_PPC_REL24:
-        case R_PPC_REL14:
-        case R_PPC_REL14_BRTAKEN:
-        case R_PPC_REL14_BRNTAKEN:
-        case R_PPC_REL32:
-        case R_PPC_ADDR30: {
-            value = (int)symbol_addr + addend - (int)target;
-            break;
-        } case R_PPC_SECTOFF:
-        case R_PPC_SECTOFF_LO:
-        case R_PPC_SECTOFF_HI:
-        case R_PPC_SECTOFF_HA: {
-            value = offset + addend;
-            break;
-        } case R_PPC_EMB_NADDR32:
-        case R_PPC_EMB_NADDR16:
-        case R_PPC_EMB_NADDR16_LO:
-        case R_PPC_EMB_NADDR16_HI:
-        case R_PPC_EMB_NADDR16_HA: {
-            value = addend - (int)symbol_addr;
-            break;
-        } default:
-            goto exit_error;
-    }
     
+    /* the loader links in place, so the image is the memory itself. */
+    image.data = destination;
+    image.address = (uint32_t)destination;
+    image.size = size;
     
-    switch (type) {
-        case R_PPC_ADDR32:
-        case R_PPC_UADDR32:
-        case R_PPC_REL32:
-        case R_PPC_SECTOFF:
-        case R_PPC_EMB_NADDR32: {
-            *(int *)target = value;
-            break;
-        } case R_PPC_ADDR24:
-        case R_PPC_REL24: {
-            *(int *)target =
-                (*(int *)target & 0xfc000003) | (value & 0x03fffffc);
-            break;
-        } case R_PPC_ADDR16:
-        case R_PPC_UADDR16:
-        case R_PPC_EMB_NADDR16: {
-            *(short *)target = value;
-            break;
-        } case R_PPC_ADDR16_HI:
-        case R_PPC_SECTOFF_HI:
-        case R_PPC_EMB_NADDR16_HI: {
-            *(short *)target = value >> 16;
-            break;
-        } case R_PPC_ADDR16_HA:
-        case R_PPC_SECTOFF_HA:
-        case R_PPC_EMB_NADDR16_HA: {
-            *(short *)target = (value >> 16) + ((value >> 15) & 1);
-            break;
-        } case R_PPC_ADDR16_LO:
-        case R_PPC_SECTOFF_LO:
-        case R_PPC_EMB_NADDR16_LO: {
-            *(short *)target = value & 0xffff;
-            break;
-        } case R_PPC_ADDR14:
-        case R_PPC_REL14: {
-            *(int *)target =
-                (*(int *)target & 0xffff0003) | (value & 0x0000fffc);
-            break;
-        } case R_PPC_ADDR14_BRTAKEN:
-        case R_PPC_REL14_BRTAKEN: {
-            *(int *)target =
-                (*(int *)target & 0xffdf0003) | (value & 0x0000fffc) |
-                0x00200000;
-            break;
-        } case R_PPC_ADDR14_BRNTAKEN:
-        case R_PPC_REL14_BRNTAKEN: {
-            *(int *)target =
-                (*(int *)target & 0xffdf0003) | (value & 0x0000fffc);
-            break;
-        } case R_PPC_ADDR30: {
-            *(int *)target =
-                (*(int *)target & 0x00000003) | (value & 0xfffffffc);
+    switch (Link_Apply(
+            &module_link_target, &image, offset, (unsigned char)type, addend,
+            symbol_addr)) {
+        case LINK_OK: {
             break;
+        } case LINK_BRANCH_RANGE: {
+            printf("Branch at %p out of range\n", target);
+            goto exit_error;
+        } case LINK_SMALL_DATA_RANGE: {
+            printf("Small data at %p out of range\n", target);
+            goto exit_error;
         } default:
             goto exit_error;
     }
@@ -1137,105 +2637,411 @@ exit_error:
     return result;
 }
 
-static bool Module_ListLink(uint8_t **space) {
+/* Records a relocation against name, to be applied by Module_ListLinkFinal
+ * once the game's symbols are known. */
+static bool Module_RelocationAdd(
+        size_t index, const char *name, void *destination, size_t size,
+        size_t offset, char type, int addend) {
+    module_unresolved_relocation_t *reloc;
+    module_symbol_t *symbol;
+    size_t reloc_index;
+    
+    if (name == NULL)
+        return false;
+    
+    symbol = Module_SymbolFind(name, Symbol_NameHash(name), true);
+    if (symbol == NULL)
+        return false;
+    
+    reloc_index = module_relocations_count;
+    reloc = Module_ListAllocate(
+        &module_relocations,
+        sizeof(module_unresolved_relocation_t), 1,
+        &module_relocations_capacity,
+        &module_relocations_count,
+        MODULE_RELOCATIONS_CAPCITY_DEFAULT);
+    if (reloc == NULL)
+        return false;
+    
+    reloc->module = index;
+    reloc->symbol = symbol;
+    reloc->symbol_next = MODULE_RELOCATION_NONE;
+    reloc->address = destination;
+    reloc->size = size;
+    reloc->offset = offset;
+    reloc->type = type;
+    reloc->addend = addend;
+    
+    /* modules are linked in order, so the list stays in module order. */
+    if (symbol->relocation_first == MODULE_RELOCATION_NONE)
+        symbol->relocation_first = reloc_index;
+    else
+        module_relocations[symbol->relocation_last].symbol_next = reloc_index;
+    symbol->relocation_last = reloc_index;
+    
+    return true;
+}
+
+/* Returns the symbol called name, whose Symbol_NameHash is hash, making it if
+ * add is true and it doesn't exist yet. Hashes from the modules are checked
+ * by Module_ListNeeded before they get here. */
+static module_symbol_t *Module_SymbolFind(
+        const char *name, uint32_t hash, bool add) {
+    module_symbol_t *symbol, **list_ptr;
+    size_t bucket, length;
+    
+    assert(name != NULL);
+    
+    bucket = hash % MODULE_SYMBOLS_HASH_SIZE;
+    
+    for (symbol = module_symbols_hash[bucket];
+         symbol != NULL;
+         symbol = symbol->hash_next) {
+        if (symbol->hash == hash && strcmp(symbol->name, name) == 0)
+            return symbol;
+    }
+    
+    if (!add)
+        return NULL;
+    
+    list_ptr = Module_ListAllocate(
+        &module_symbols, sizeof(module_symbol_t *), 1,
+        &module_symbols_capacity, &module_symbols_count,
+        MODULE_SYMBOLS_CAPACITY_DEFAULT);
+    if (list_ptr == NULL)
+        return NULL;
+    
+    length = strlen(name);
+    symbol = malloc(sizeof(module_symbol_t) + length + 1);
+    if (symbol == NULL) {
+        module_symbols_count--;
+        return NULL;
+    }
+    
+    memcpy(symbol->name, name, length + 1);
+    symbol->hash = hash;
+    symbol->relocation_first = MODULE_RELOCATION_NONE;
+    symbol->relocation_last = MODULE_RELOCATION_NONE;
+    symbol->address = NULL;
+    symbol->resolved = false;
+    symbol->hash_next = module_symbols_hash[bucket];
+    module_symbols_hash[bucket] = symbol;
+    *list_ptr = symbol;
+    
+    return symbol;
+}
+
+/* Forgets the lookup of name, after a module has changed what it means. */
+static void Module_SymbolInvalidate(const char *name, uint32_t hash) {
+    module_symbol_t *symbol;
+    
+    symbol = Module_SymbolFind(name, hash, false);
+    if (symbol != NULL)
+        symbol->resolved = false;
+}
+
+static void Module_SymbolFreeAll(void) {
+    size_t i;
+    
+    for (i = 0; i < module_symbols_count; i++)
+        free(module_symbols[i]);
+    free(module_symbols);
+    module_symbols = NULL;
+    module_symbols_count = 0;
+    module_symbols_capacity = 0;
+    memset(module_symbols_hash, 0, sizeof(module_symbols_hash));
+}
+
+/* Chooses where every live section of every module goes, and so the size of
+ * the module space. The sections are sorted by alignment, biggest first, and
+ * then by size, so that they pack with as little padding as possible. The
+ * stubs for the replacements go after them, at the end of the space. Sections
+ * chosen by Module_LayoutMem2 are packed the same way in the MEM2 window. */
+static void Module_ListLayout(void) {
+    module_elf_section_t **sections = NULL;
+    size_t count, index, i, size, align, stubs;
+    size_t mem2_size, mem2_align, mem2_worst;
+    
+    count = 0;
+    stubs = 0;
+    align = 32;
+    mem2_align = 32;
+    mem2_worst = 0;
+    for (index = 0; index < module_elf_list_count; index++) {
+        module_elf_t *module;
+        
+        module = module_elf_list[index];
+        
+        for (i = 1; i < module->section_count; i++) {
+            if (!module->sections[i].live)
+                continue;
+            
+            if (strcmp(module->sections[i].name, ".bslug.load") == 0) {
+                stubs += Module_StubsSize(
+                    module,
+                    module->sections[i].shdr->sh_size /
+                    sizeof(bslug_loader_entry_t));
+                continue;
+            }
+            
+            count++;
+            
+            /* MEM2 sections go there while they surely fit the window. */
+            module->sections[i].mem2 =
+                Module_LayoutMem2(&module->sections[i]) &&
+                mem2_worst + module->sections[i].shdr->sh_size +
+                    Module_LayoutAlign(&module->sections[i]) <=
+                    (size_t)(MODULE_MEM2_END - MODULE_MEM2_START);
+            if (module->sections[i].mem2) {
+                mem2_worst +=
+                    module->sections[i].shdr->sh_size +
+                    Module_LayoutAlign(&module->sections[i]);
+                if (Module_LayoutAlign(&module->sections[i]) > mem2_align)
+                    mem2_align = Module_LayoutAlign(&module->sections[i]);
+            } else if (Module_LayoutAlign(&module->sections[i]) > align)
+                align = Module_LayoutAlign(&module->sections[i]);
+        }
+    }
+    
+    /* without memory to sort, the sections are packed in order instead. */
+    if (count > 0)
+        sections = malloc(count * sizeof(module_elf_section_t *));
+    
+    size = 0;
+    mem2_size = 0;
+    count = 0;
+    for (index = 0; index < module_elf_list_count; index++) {
+        module_elf_t *module;
+        
+        module = module_elf_list[index];
+        
+        for (i = 1; i < module->section_count; i++) {
+            if (!module->sections[i].live ||
+                strcmp(module->sections[i].name, ".bslug.load") == 0)
+                continue;
+            
+            if (sections != NULL)
+                sections[count++] = &module->sections[i];
+            else
+                Module_LayoutPlace(&module->sections[i], &size, &mem2_size);
+        }
+    }
+    
+    if (sections != NULL) {
+        qsort(
+            sections, count, sizeof(module_elf_section_t *),
+            &Module_LayoutCompare);
+        for (i = 0; i < count; i++)
+            Module_LayoutPlace(sections[i], &size, &mem2_size);
+        free(sections);
+    }
+    
+    /* the stubs are words. */
+    module_list_sections_size = size + (-size & 3);
+    size = module_list_sections_size + stubs;
+    
+    /* the start of the space must suit every section. The end is at least
+     * 32 byte aligned, so the start is too, for the apploader. */
+    module_list_base = (uint8_t *)((uint32_t)(MODULE_LIST_END - size) &
+        ~(align - 1));
+    module_list_size = MODULE_LIST_END - module_list_base;
+    
+    if (mem2_size > 0) {
+        /* the sections surely fit, as mem2_worst did. */
+        module_mem2_base = (uint8_t *)((uint32_t)(MODULE_MEM2_END - mem2_size) &
+            ~(mem2_align - 1));
+        module_mem2_size = MODULE_MEM2_END - module_mem2_base;
+        assert(module_mem2_base >= MODULE_MEM2_START);
+    }
+}
+
+static int Module_LayoutCompare(const void *left, const void *right) {
+    const module_elf_section_t *section_left, *section_right;
+    size_t align_left, align_right;
+    
+    section_left = *(const module_elf_section_t **)left;
+    section_right = *(const module_elf_section_t **)right;
+    align_left = Module_LayoutAlign(section_left);
+    align_right = Module_LayoutAlign(section_right);
+    
+    if (align_left != align_right)
+        return align_left > align_right ? -1 : 1;
+    if (section_left->shdr->sh_size != section_right->shdr->sh_size)
+        return section_left->shdr->sh_size > section_right->shdr->sh_size ?
+            -1 : 1;
+    /* qsort isn't stable, so keep the layout the same each time. */
+    if (section_left != section_right)
+        return section_left < section_right ? -1 : 1;
+    return 0;
+}
+
+static size_t Module_LayoutAlign(const module_elf_section_t *section) {
+    size_t align;
+    
+    /* sh_addralign is 0 or a power of 2. Anything else is treated as 1. */
+    align = section->shdr->sh_addralign;
+    if (align == 0 || (align & (align - 1)) != 0)
+        align = 1;
+    return align;
+}
+
+/* Whether a section goes in MEM2: those asking to with BSLUG_MEM2, and big
+ * read only data, which is unlikely to be used often. Code stays in MEM1,
+ * next to the game it calls, even if it asks for MEM2. */
+static bool Module_LayoutMem2(const module_elf_section_t *section) {
+    if (!Module_Mem2Usable() || (section->shdr->sh_flags & SHF_EXECINSTR))
+        return false;
+    if (strncmp(section->name, ".bslug.mem2", strlen(".bslug.mem2")) == 0)
+        return true;
+    
+    return
+        !(section->shdr->sh_flags & SHF_WRITE) &&
+        section->shdr->sh_type == SHT_PROGBITS &&
+        section->shdr->sh_size >= MODULE_MEM2_THRESHOLD;
+}
+
+/* Whether the MEM2 window is clear of the IOS heap, whose start depends on
+ * the IOS running. */
+static bool Module_Mem2Usable(void) {
+    return os1->ios_heap_start >= (uint32_t)MODULE_MEM2_END;
+}
+
+static void Module_LayoutPlace(
+        module_elf_section_t *section, size_t *size, size_t *mem2_size) {
+    if (section->mem2)
+        size = mem2_size;
+    
+    *size += -*size & (Module_LayoutAlign(section) - 1);
+    section->layout = *size;
+    *size += section->shdr->sh_size;
+}
+
+static uint8_t *Module_SectionAddress(const module_elf_section_t *section) {
+    return
+        (section->mem2 ? module_mem2_base : module_list_base) +
+        section->layout;
+}
+
+static bool Module_ListLink(void) {
     size_t i;
     bool result = false;
     
+    assert(module_elf_list_count == module_list_count);
+    
     for (i = 0; i < module_list_count; i++) {
-        if (!Module_LinkModule(i, module_list[i]->path, space))
+        bool linked;
+        
+        /* the sections are read from the file as they're loaded. */
+        module_elf_list[i]->fd = open(module_list[i]->path, O_RDONLY, 0);
+        linked =
+            module_elf_list[i]->fd != -1 &&
+            (module_elf_list[i]->prelink != NULL ?
+                Module_LinkModulePrelinked(i, module_elf_list[i]) :
+                Module_LinkModuleElf(i, module_elf_list[i]));
+        
+        /* the symbols and relocations aren't needed once it's linked. */
+        Module_ElfClose(module_elf_list[i]);
+        module_elf_list[i] = NULL;
+        
+        if (!linked)
             goto exit_error;
     }
     
     result = true;
 exit_error:
     if (!result) printf("Module_ListLink: exit_error\n");
+    for (; i < module_list_count; i++) {
+        if (module_elf_list[i] != NULL)
+            Module_ElfClose(module_elf_list[i]);
+    }
+    module_elf_list_count = 0;
+    module_elf_list_capacity = 0;
+    free(module_elf_list);
+    module_elf_list = NULL;
     return result;
 }
 
-static bool Module_LinkModule(size_t index, const char *path, uint8_t **space) {
-    int fd = -1;
-    Elf *elf = NULL;
-    bool result = false;
-    
-    /* check for compile errors */
-    assert(elf_version(EV_CURRENT) != EV_NONE);
-    
-    fd = open(path, O_RDONLY, 0);
+/* Adds the functions the modules replace to the symbols their relocations
+ * need, which together are all the search has to find. */
+static bool Module_ListNeeded(void) {
+    size_t i;
     
-    if (fd == -1)
-        goto exit_error;
+    for (i = 0; i < module_entries_count; i++) {
+        bslug_loader_entry_t *entry;
+        const char *name;
+        uint32_t hash;
         
-    elf = elf_begin(fd, ELF_C_READ, NULL);
-    
-    if (elf == NULL)
-        goto exit_error;
+        entry = module_entries + i;
+        name =
+            BSLUG_LOADER_ENTRY_TYPE(entry) == BSLUG_LOADER_ENTRY_EXPORT ?
+                entry->data.export.name :
+            BSLUG_LOADER_ENTRY_TYPE(entry) == BSLUG_LOADER_ENTRY_HOOK_AT ?
+                entry->data.hook.name :
+                entry->data.function.name;
+        if (name == NULL)
+            return false;
         
-    switch (elf_kind(elf)) {
-        case ELF_K_AR:
-            /* TODO */
-            goto exit_error;
-        case ELF_K_ELF:
-            if (!Module_LinkModuleElf(index, elf, space))
-                goto exit_error;
+        /* v0.1 modules don't hash their names, and a broken one may hash
+         * them wrongly; do it for them, so the rest of the loader can rely
+         * on it. */
+        hash = Symbol_NameHash(name);
+        if (BSLUG_LOADER_ENTRY_HASH(entry) != hash) {
+            if (BSLUG_LOADER_ENTRY_HASH(entry) != 0)
+                printf("Warning: Wrong hash of '%s'; using its own.\n", name);
+            entry->type = BSLUG_LOADER_ENTRY_TYPE(entry) | hash << 8;
+        }
+        
+        switch (BSLUG_LOADER_ENTRY_TYPE(entry)) {
+        case BSLUG_LOADER_ENTRY_EXPORT: {
             break;
-        default:
-            goto exit_error;
+        } case BSLUG_LOADER_ENTRY_FUNCTION:
+        case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY:
+        case BSLUG_LOADER_ENTRY_HOOK_AT: {
+            if (Module_SymbolFind(
+                    name, BSLUG_LOADER_ENTRY_HASH(entry), true) == NULL)
+                return false;
+            break;
+        } default:
+            return false;
+        }
     }
+    
+    return true;
+}
 
-    result = true;
-exit_error:
-    if (!result) printf("Module_LinkModule: exit_error\n");
-    if (elf != NULL)
-        elf_end(elf);
-    if (fd != -1)
-        close(fd);
-    return result;
+bool Module_SymbolNeeded(const char *name) {
+    assert(name != NULL);
+    
+    return Module_SymbolFind(name, Symbol_NameHash(name), false) != NULL;
 }
 
-static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space) {
-    Elf_Scn *scn;
-    size_t symtab_count, section_count, shstrndx, symtab_strndx, entries_count;
-    Elf32_Sym *symtab = NULL;
+static bool Module_LinkModuleElf(size_t index, module_elf_t *module) {
+    size_t i, entries_count;
+    Elf32_Sym *symtab = module->symtab;
+    size_t symtab_count = module->symtab_count;
     uint8_t **destinations = NULL;
     bslug_loader_entry_t *entries = NULL;
     bool result = false;
     
-    if (!Module_LoadElfSymtab(elf, &symtab, &symtab_count, &symtab_strndx))
-        goto exit_error;
-    
     assert(symtab != NULL);
-    
-    if (elf_getshdrnum(elf, &section_count) != 0)
-        goto exit_error;
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0)
-        goto exit_error;
-    
-    destinations = malloc(sizeof(uint8_t *) * section_count);
-    
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-        
+    
+    destinations = calloc(module->section_count, sizeof(uint8_t *));
+    if (destinations == NULL)
+        goto exit_error;
+    
+    for (i = 1; i < module->section_count; i++) {
         Elf32_Shdr *shdr;
         
-        shdr = elf32_getshdr(scn);
+        shdr = module->sections[i].shdr;
         if (shdr == NULL)
             continue;
         
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC)) {
-            
+        if (module->sections[i].live) {
             const char *name;
             
-            destinations[elf_ndxscn(scn)] = NULL;
+            name = module->sections[i].name;
             
-            name = elf_strptr(elf, shstrndx, shdr->sh_name);
-            if (name == NULL)
-                continue;
-            
-            if (strcmp(name, ".bslug.meta") == 0) {
-                continue;
-            } else if (strcmp(name, ".bslug.load") == 0) {
+            if (strcmp(name, ".bslug.load") == 0) {
                 if (entries != NULL)
                     goto exit_error;
                     
@@ -1248,52 +3054,44 @@ static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space) {
                 if (entries == NULL)
                     goto exit_error;
                 
-                destinations[elf_ndxscn(scn)] = (uint8_t *)entries;
-                if (!Module_ElfLoadSection(elf, scn, shdr, entries))
+                destinations[i] = (uint8_t *)entries;
+                if (!Module_ElfLoadSection(module, i, entries))
                     goto exit_error;
-                Module_ElfLoadSymbols(
-                    elf_ndxscn(scn), entries, symtab, symtab_count);
+                Module_ElfLoadSymbols(i, entries, symtab, symtab_count);
             } else {
-                *space -= shdr->sh_size;
-                if (shdr->sh_addralign > 3)
-                    *space = (uint8_t *)((int)*space &
-                        ~(shdr->sh_addralign - 1));
-                else 
-                    *space = (uint8_t *)((int)*space & ~3);
-                
-                destinations[elf_ndxscn(scn)] = *space;
+                destinations[i] =
+                    Module_SectionAddress(&module->sections[i]);
                 
-                assert(*space != NULL);
-                if (!Module_ElfLoadSection(elf, scn, shdr, *space))
+                assert(
+                    module->sections[i].layout + shdr->sh_size <=
+                    (module->sections[i].mem2 ?
+                        module_mem2_size : module_list_sections_size));
+                if (!Module_ElfLoadSection(module, i, destinations[i]))
                     goto exit_error;
                 Module_ElfLoadSymbols(
-                    elf_ndxscn(scn), *space, symtab, symtab_count);
+                    i, destinations[i], symtab, symtab_count);
             }
         }
     }
     
-    if (entries == NULL)
+    if (entries == NULL && !module->member)
         goto exit_error;
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-        
-        Elf32_Shdr *shdr;
+    if (module->member && !Module_ElfExport(module))
+        goto exit_error;
+    
+    /* one pass over all the relocations, now everything has an address. */
+    for (i = 0; i < module->relocations_count; i++) {
+        size_t target;
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
+        target = module->sections[module->relocations[i]].shdr->sh_info;
+        if (target >= module->section_count || destinations[target] == NULL)
             continue;
         
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC) &&
-            destinations[elf_ndxscn(scn)] != NULL) {
-            
-            if (!Module_ElfLink(
-                    index, elf, elf_ndxscn(scn), destinations[elf_ndxscn(scn)],
-                    symtab, symtab_count, symtab_strndx, true))
-                goto exit_error;
-        }
+        if (!Module_ElfLinkRelocations(
+                index, module, module->relocations[i], destinations[target],
+                true))
+            goto exit_error;
     }
         
     result = true;
@@ -1301,11 +3099,128 @@ exit_error:
     if (!result) printf("Module_LinkModuleElf: exit_error\n");
     if (destinations != NULL)
         free(destinations);
-    if (symtab != NULL)
-        free(symtab);
     return result;
 }
 
+/* Records the global symbols of a loaded archive member, so the modules
+ * which needed it can find them. */
+static bool Module_ElfExport(const module_elf_t *module) {
+    size_t i;
+    
+    for (i = 1; i < module->symtab_count; i++) {
+        const Elf32_Sym *symbol;
+        module_export_t *export;
+        const char *name;
+        
+        symbol = &module->symtab[i];
+        if (ELF32_ST_BIND(symbol->st_info) == STB_LOCAL ||
+            symbol->st_shndx == SHN_UNDEF || symbol->st_other != 1)
+            continue;
+        
+        name = elf_strptr(module->elf, module->symtab_strndx, symbol->st_name);
+        if (name == NULL)
+            return false;
+        
+        export = Module_ListAllocate(
+            &module_exports, sizeof(module_export_t), 1,
+            &module_exports_capacity, &module_exports_count,
+            MODULE_EXPORTS_CAPACITY_DEFAULT);
+        if (export == NULL)
+            return false;
+        
+        export->name = strdup(name);
+        if (export->name == NULL) {
+            module_exports_count--;
+            return false;
+        }
+        export->address = (void *)symbol->st_value;
+    }
+    
+    return true;
+}
+
+/* Loads a prelinked module. Only the fixups which depend on where the image
+ * is, or on other modules or the game, are left to do. */
+static bool Module_LinkModulePrelinked(size_t index, module_elf_t *module) {
+    const module_prelink_t *prelink = module->prelink;
+    uint8_t *image;
+    bslug_loader_entry_t *entries;
+    size_t i;
+    
+    image = Module_SectionAddress(&module->sections[1]);
+    if (prelink->header.flags & PRELINK_FLAG_COMPRESSED) {
+        uint8_t *stored;
+        bool result;
+        
+        /* decompress straight into place, so only the compressed data needs
+         * a buffer. */
+        stored = malloc(prelink->header.image_stored_size);
+        if (stored == NULL)
+            return false;
+        result =
+            Module_ElfRead(
+                module->fd, prelink->image_offset, stored,
+                prelink->header.image_stored_size) &&
+            LZ_Decompress(
+                stored, prelink->header.image_stored_size, image,
+                prelink->header.image_size);
+        free(stored);
+        if (!result)
+            return false;
+    } else if (!Module_ElfRead(
+            module->fd, prelink->image_offset, image,
+            prelink->header.image_size))
+        return false;
+    memset(
+        image + prelink->header.image_size, 0,
+        prelink->header.image_bss_size);
+    
+    entries = Module_ListAllocate(
+        &module_entries, sizeof(bslug_loader_entry_t),
+        prelink->header.load_size / sizeof(bslug_loader_entry_t),
+        &module_entries_capacity, &module_entries_count,
+        MODULE_ENTRIES_CAPACITY_DEFAULT);
+    if (entries == NULL)
+        return false;
+    if (!Module_ElfRead(
+            module->fd, prelink->load_offset, entries,
+            prelink->header.load_size))
+        return false;
+    
+    for (i = 0; i < prelink->header.fixup_count; i++) {
+        const prelink_fixup_t *fixup;
+        void *destination;
+        size_t size;
+        
+        /* Module_LoadPrelinked checked every fixup is inside its region. */
+        fixup = &prelink->fixups[i];
+        if (PRELINK_FIXUP_REGION(fixup->info) == PRELINK_REGION_IMAGE) {
+            destination = image;
+            size =
+                prelink->header.image_size + prelink->header.image_bss_size;
+        } else {
+            destination = entries;
+            size = prelink->header.load_size;
+        }
+        
+        if (fixup->info & PRELINK_FIXUP_EXTERNAL) {
+            if (!Module_RelocationAdd(
+                    index, prelink->name_list[fixup->symbol], destination,
+                    size, fixup->offset, PRELINK_FIXUP_TYPE(fixup->info),
+                    fixup->addend))
+                return false;
+        } else {
+            if (!Module_ElfLinkOne(
+                    PRELINK_FIXUP_TYPE(fixup->info), fixup->offset,
+                    fixup->addend, destination, size,
+                    (uint32_t)image + fixup->symbol))
+                return false;
+        }
+    }
+    
+    return true;
+}
+
 static bool Module_ListLoadSymbols(uint8_t **space) {
     size_t i;
     bool result = false;
@@ -1315,10 +3230,10 @@ static bool Module_ListLoadSymbols(uint8_t **space) {
 
         entry = module_entries + i;
         
-        switch (entry->type) {
+        switch (BSLUG_LOADER_ENTRY_TYPE(entry)) {
         case BSLUG_LOADER_ENTRY_EXPORT: {
             if (!Search_SymbolAdd(
-                entry->data.export.name,
+                entry->data.export.name, BSLUG_LOADER_ENTRY_HASH(entry),
                 (void *)entry->data.export.target)) {
                 
                 printf("Could not export '%s'\n", entry->data.export.name);
@@ -1327,29 +3242,81 @@ static bool Module_ListLoadSymbols(uint8_t **space) {
                 
             break;
         } case BSLUG_LOADER_ENTRY_FUNCTION:
-        case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY: {
+        case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY:
+        case BSLUG_LOADER_ENTRY_HOOK_AT: {
             break;
         } default:
             goto exit_error;
         }
     }
     
+    for (i = 0; i < module_exports_count; i++) {
+        if (!Search_SymbolAdd(
+            module_exports[i].name, Symbol_NameHash(module_exports[i].name),
+            module_exports[i].address)) {
+            
+            printf("Could not export '%s'\n", module_exports[i].name);
+            goto exit_error;
+        }
+    }
+    
     result = true;
 exit_error:
     if (!result) printf("Module_ListLoadSymbols: exit_error\n");
+    for (i = 0; i < module_exports_count; i++)
+        free(module_exports[i].name);
+    free(module_exports);
+    module_exports = NULL;
+    module_exports_count = 0;
+    module_exports_capacity = 0;
     return result;
 }
 
 static bool Module_ListLinkFinal(uint8_t **space) {
-    size_t relocation_index, entry_index, module_index;
+    size_t relocation_count, entry_index, module_index, i;
     bool result = false, has_error = false;
+    hook_chain_t *hooks;
     
-    relocation_index = 0;
+    relocation_count = 0;
     entry_index = 0;
     
+    module_link_target.sda_base = (uint32_t)Search_SymbolLookup("_SDA_BASE_");
+    module_link_target.sda2_base =
+        (uint32_t)Search_SymbolLookup("_SDA2_BASE_");
+    
+    /* every replacement of a function is known before any is made, so that
+     * each can call straight through to the next. */
+    hooks = malloc(module_entries_count * sizeof(hook_chain_t));
+    if (hooks == NULL && module_entries_count > 0)
+        goto exit_error;
+    for (i = 0; i < module_entries_count; i++) {
+        bslug_loader_entry_t *entry;
+        
+        entry = module_entries + i;
+        hooks[i].name = NULL;
+        if (BSLUG_LOADER_ENTRY_TYPE(entry) == BSLUG_LOADER_ENTRY_FUNCTION ||
+            BSLUG_LOADER_ENTRY_TYPE(entry) ==
+            BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY) {
+            hooks[i].name = entry->data.function.name;
+            hooks[i].hash = BSLUG_LOADER_ENTRY_HASH(entry);
+            hooks[i].target = (uint32_t)entry->data.function.target;
+        }
+    }
+    if (!Hook_ChainBuild(hooks, module_entries_count))
+        goto exit_error;
+    
+    /* the hooks go in first, while each name still means the function
+     * itself rather than a replacement of it. */
+    for (i = 0; i < module_entries_count; i++) {
+        if (BSLUG_LOADER_ENTRY_TYPE(module_entries + i) ==
+            BSLUG_LOADER_ENTRY_HOOK_AT &&
+            !Module_ListLinkFinalHookAt(space, module_entries + i))
+            goto exit_error;
+    }
+    
     /* Process the replacements the link each module in turn.
-     * It must be done in this order, otherwise two replacements to the same
-     * function will cause an infinite loop. */
+     * It must be done in this order, so that each module's name for a
+     * function it replaces means the next replacement. */
     for (module_index = 0; module_index < module_list_count; module_index++) {
         size_t limit;
         
@@ -1362,12 +3329,14 @@ static bool Module_ListLinkFinal(uint8_t **space) {
 
             entry = module_entries + entry_index;
                 
-            switch (entry->type) {
-            case BSLUG_LOADER_ENTRY_EXPORT: {
+            switch (BSLUG_LOADER_ENTRY_TYPE(entry)) {
+            case BSLUG_LOADER_ENTRY_EXPORT:
+            case BSLUG_LOADER_ENTRY_HOOK_AT: {
                 break;
             } case BSLUG_LOADER_ENTRY_FUNCTION:
             case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY: {
-                if (!Module_ListLinkFinalReplaceFunction(space, entry))
+                if (!Module_ListLinkFinalReplaceFunction(
+                        space, entry, hooks, entry_index))
                     goto exit_error;
                 break;
             } default:
@@ -1375,62 +3344,104 @@ static bool Module_ListLinkFinal(uint8_t **space) {
             }
         }
     
-        for (; 
-             relocation_index < module_relocations_count;
-             relocation_index++) {
+        /* Apply this module's relocations a symbol at a time. A replacement
+         * changes what later modules get for the name, so each symbol is
+         * looked up again if one has happened since. */
+        for (i = 0; i < module_symbols_count; i++) {
+            module_symbol_t *symbol;
             module_unresolved_relocation_t *reloc;
-            void *symbol;
             
-            reloc = module_relocations + relocation_index;
+            symbol = module_symbols[i];
             
-            if (reloc->module != module_index)
-                break;
+            if (symbol->relocation_first == MODULE_RELOCATION_NONE)
+                continue;
+            if (module_relocations[symbol->relocation_first].module !=
+                module_index)
+                continue;
             
-            assert(reloc->name != NULL);
-            symbol = Search_SymbolLookup(reloc->name);
+            if (!symbol->resolved) {
+                symbol->address =
+                    Search_SymbolLookupHash(symbol->name, symbol->hash);
+                symbol->resolved = true;
+            }
             
-            if (symbol == NULL) {
+            if (symbol->address == NULL) {
                 printf(
-                    "Missing symbol '%s' needed by '%s'\n", reloc->name,
+                    "Missing symbol '%s' needed by '%s'\n", symbol->name,
                     module_list[module_index]->name);
                 has_error = true;
-                continue;
             }
             
-            if (!Module_ElfLinkOne(
-                    reloc->type, reloc->offset, reloc->addend,
-                    reloc->address, (uint32_t)symbol))
-                goto exit_error;
+            for (;
+                 symbol->relocation_first != MODULE_RELOCATION_NONE;
+                 symbol->relocation_first = reloc->symbol_next) {
+                reloc = module_relocations + symbol->relocation_first;
+                
+                if (reloc->module != module_index)
+                    break;
+                
+                relocation_count++;
+                
+                if (symbol->address == NULL)
+                    continue;
+                
+                if (!Module_ElfLinkOne(
+                        reloc->type, reloc->offset, reloc->addend,
+                        reloc->address, reloc->size,
+                        (uint32_t)symbol->address))
+                    goto exit_error;
+            }
         }
     }
     
     assert(entry_index == module_entries_count);
-    assert(relocation_index == module_relocations_count);
+    assert(relocation_count == module_relocations_count);
     
     if (has_error)
         goto exit_error;
     
+    Module_Flush();
+    
     result = true;
 exit_error:
     if (!result) printf("Module_ListLinkFinal: exit_error\n");
+    free(hooks);
     module_relocations_count = 0;
     module_relocations_capacity = 0;
     free(module_relocations);
+    module_relocations = NULL;
+    Module_SymbolFreeAll();
     return result;
 }
 
+/* Puts hooks[hook], the replacement in entry, in place. The first
+ * replacement of a function patches the game and makes the trampoline to the
+ * original; the name then means the next replacement, or the trampoline after
+ * the last, so every call through is a single branch. */
 static bool Module_ListLinkFinalReplaceFunction(
-        uint8_t **space, bslug_loader_entry_t *entry) {
-    bool result = false;
-    uint32_t *data;
-    
-    assert(entry->type == BSLUG_LOADER_ENTRY_FUNCTION ||
-           entry->type == BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY);
+        uint8_t **space, bslug_loader_entry_t *entry,
+        hook_chain_t *hooks, size_t hook) {
+    bool result = false, missing = false;
+    uint32_t *data = NULL, *trampoline = NULL, hash, trampoline_address = 0;
+    uint32_t branch;
+    
+    assert(BSLUG_LOADER_ENTRY_TYPE(entry) == BSLUG_LOADER_ENTRY_FUNCTION ||
+           BSLUG_LOADER_ENTRY_TYPE(entry) ==
+           BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY);
     assert(entry->data.function.name != NULL);
-    data = Search_SymbolLookup(entry->data.function.name);
+    assert(hooks[hook].name == entry->data.function.name);
+    hash = BSLUG_LOADER_ENTRY_HASH(entry);
     
-    if (data == NULL) {
-        if (entry->type == BSLUG_LOADER_ENTRY_FUNCTION) {
+    if (hooks[hook].first) {
+        data = Search_SymbolLookupHash(entry->data.function.name, hash);
+        
+        if (data == NULL) {
+            if (BSLUG_LOADER_ENTRY_TYPE(entry) ==
+                BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY) {
+                printf("Missing symbol '%s'\n", entry->data.function.name);
+                goto exit_error;
+            }
+            
             *space -= 4;
             /* FIXME: this behaviour is bad; we should call abort or
              * some such.
@@ -1441,88 +3452,491 @@ static bool Module_ListLinkFinalReplaceFunction(
              * the purpose of relocation.
              */
             ((uint32_t *)*space)[0] = 0x48000000; /* spin loop */
-            Search_SymbolAdd(entry->data.function.name, *space);
-            goto exit_success;
+            missing = true;
         } else {
-            printf("Missing symbol '%s'\n", entry->data.function.name);
-            goto exit_error;
+            *space -= Hook_TrampolineSize(*data);
+            trampoline = (uint32_t *)*space;
         }
+        trampoline_address = (uint32_t)*space;
     }
     
-    switch (*data & 0xfc000002) {
-        case 0x40000000: { /* bc */
-            void *target;
-            int offset;
-                                
-            offset = *data & 0x0000fffc;
-            offset = (offset << 16) >> 16;
-            target = (char *)data + offset;
-        
-            *space -= 12;
-            /* Conditional branch to either target or next instruction.
-             * We can't just conditional branch to original target as
-             * it is probably too far for a single branch. */
-            ((uint32_t *)*space)[0] = (*data & 0xffff0003) | 8;
-            /* branch to second instruction of function.
-             * observe: we're branching from the second instruction of 
-             *     the stub to the second instruction of the method, so
-             *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
-                0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
-            /* branch to the target of the original branch. */
-            ((uint32_t *)*space)[2] =
-                0x48000000 + 
-                (((uint32_t)target - (uint32_t)(*space + 8))
-                    & 0x3fffffc);
-            break;
-        } case 0x48000000: { /* b */
-            void *target;
-            int offset;
+    if (!Hook_ChainLink(
+            hooks, hook, trampoline, trampoline_address,
+            data != NULL ? *data : 0, (uint32_t)data, &branch)) {
+        printf(
+            "Replacement for '%s' out of range\n", entry->data.function.name);
+        goto exit_error;
+    }
+    if (branch != 0)
+        Module_ListLinkFinalPatch(data, branch);
+    
+    if (missing) {
+        if (!Search_SymbolAdd(
+                entry->data.function.name, hash,
+                (void *)Hook_ChainCallThrough(hooks, hook)))
+            goto exit_error;
+    } else {
+        if (!Search_SymbolReplace(
+                entry->data.function.name, hash,
+                (void *)Hook_ChainCallThrough(hooks, hook)))
+            goto exit_error;
+    }
+    Module_SymbolInvalidate(entry->data.function.name, hash);
+
+    result = true;
+exit_error:
+    if (!result) printf("Module_ListLinkFinalReplaceFunction: exit_error\n");
+    return result;
+}
+
+/* Puts the BSLUG_HOOK_AT in entry in place: the instruction it names becomes
+ * a branch to a thunk, which calls the callback and then does the instruction.
+ * Hooking an instruction which is already hooked puts the new thunk in front
+ * of the old one. */
+static bool Module_ListLinkFinalHookAt(
+        uint8_t **space, bslug_loader_entry_t *entry) {
+    bool result = false;
+    const bslug_hook_t *hook;
+    uint32_t *data, *thunk, callback, branch;
+    
+    assert(BSLUG_LOADER_ENTRY_TYPE(entry) == BSLUG_LOADER_ENTRY_HOOK_AT);
+    assert(entry->data.hook.name != NULL);
+    
+    hook = entry->data.hook.hook;
+    if (hook == NULL || hook->callback == NULL || (hook->offset & 3) != 0) {
+        printf("Invalid hook of '%s'\n", entry->data.hook.name);
+        goto exit_error;
+    }
+    
+    data = Search_SymbolLookupHash(
+        entry->data.hook.name, BSLUG_LOADER_ENTRY_HASH(entry));
+    if (data == NULL) {
+        printf("Missing symbol '%s'\n", entry->data.hook.name);
+        goto exit_error;
+    }
+    data = (uint32_t *)((uint32_t)data + hook->offset);
+    
+    *space -= HOOK_THUNK_BODY * 4 + Hook_TrampolineSize(*data);
+    thunk = (uint32_t *)*space;
+    
+    callback = (uint32_t)hook->callback;
+    branch = (uint32_t)thunk;
+    if (!Link_BranchInRange((uint32_t)(thunk + HOOK_THUNK_CALL), callback) ||
+        !Link_BranchInRange((uint32_t)data, branch)) {
+        printf("Hook of '%s' out of range\n", entry->data.hook.name);
+        goto exit_error;
+    }
+    
+    Hook_Thunk(thunk, (uint32_t)thunk, callback, *data, (uint32_t)data);
+    Module_ListLinkFinalPatch(
+        data, 0x48000000 + ((branch - (uint32_t)data) & 0x3fffffc));
+    
+    result = true;
+exit_error:
+    if (!result) printf("Module_ListLinkFinalHookAt: exit_error\n");
+    return result;
+}
+
+/* Writes instruction over the game's at address, and remembers it for
+ * Module_Flush and the cache. */
+static void Module_ListLinkFinalPatch(uint32_t *address, uint32_t instruction) {
+    module_patch_t *patch;
+    
+    *address = instruction;
+    
+    patch = Module_ListAllocate(
+        &module_patches, sizeof(module_patch_t), 1,
+        &module_patches_capacity, &module_patches_count,
+        MODULE_PATCHES_CAPACITY_DEFAULT);
+    if (patch != NULL) {
+        patch->address = (uint32_t)address;
+        patch->instruction = instruction;
+    } else {
+        /* Module_Flush won't know about it. */
+        module_cache_incomplete = true;
+        Module_FlushRange((void *)((uint32_t)address & ~31), 32);
+    }
+}
+
+/* Writes back and invalidates everything the loader changed: each 32 byte
+ * line patched in the game, with neighbouring lines merged into one range, and
+ * the module spaces, including the stubs. Done once at the end,
+ * rather than as each change is made, as the game can't run before then. */
+static void Module_Flush(void) {
+    uint32_t *lines;
+    size_t i, count;
+    
+    lines = malloc(module_patches_count * sizeof(uint32_t));
+    if (lines == NULL && module_patches_count > 0) {
+        for (i = 0; i < module_patches_count; i++)
+            Module_FlushRange(
+                (void *)(module_patches[i].address & ~31), 32);
+    } else {
+        for (i = 0; i < module_patches_count; i++)
+            lines[i] = module_patches[i].address & ~31;
+        qsort(
+            lines, module_patches_count, sizeof(uint32_t),
+            &Module_FlushLineCompare);
+        
+        for (i = 0; i < module_patches_count; i = count) {
+            uint32_t end;
             
-            offset = *data & 0x03fffffc;
-            offset = (offset << 6) >> 6;
-            target = (char *)data + offset;
-            *space -= 8;
-            /* branch to the target of the original branch. */
-            ((uint32_t *)*space)[0] = 
-                (*data & 0xfc000003) + 
-                (((uint32_t)target - (uint32_t)*space) & 0x3fffffc);
-            /* branch to second instruction of function.
-             * observe: we're branching from the second instruction of 
-             *     the stub to the second instruction of the method, so
-             *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
-                0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
-            break;
-        } default: { /* other (inc ba, and bca) */
-            *space -= 8;
-            /* copy the original instruction. */
-            ((uint32_t *)*space)[0] = *data;
-            /* branch to second instruction of function.
-             * observe: we're branching from the second instruction of 
-             *     the stub to the second instruction of the method, so
-             *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
-                0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
-            break;
+            end = lines[i] + 32;
+            for (count = i + 1;
+                 count < module_patches_count && lines[count] <= end;
+                 count++)
+                end = lines[count] + 32;
+            
+            Module_FlushRange((void *)lines[i], end - lines[i]);
         }
+        free(lines);
     }
     
-    *data = 0x48000000 + 
-        (((uint32_t)entry->data.function.target
-            - (uint32_t)data) & 0x3fffffc);
-    DCFlushRange((void *)((uint32_t)data & ~31), 32);
-    ICInvalidateRange((void *)((uint32_t)data & ~31), 32);
+    Module_FlushRange(module_list_base, module_list_size);
+    if (module_mem2_size > 0)
+        Module_FlushRange(module_mem2_base, module_mem2_size);
+}
+
+static void Module_FlushRange(const void *start, size_t size) {
+    DCFlushRange((void *)start, size);
+    ICInvalidateRange((void *)start, size);
+    module_cache_op_count += 2;
+}
+
+static int Module_FlushLineCompare(const void *left, const void *right) {
+    uint32_t line_left, line_right;
+    
+    line_left = *(const uint32_t *)left;
+    line_right = *(const uint32_t *)right;
     
-    if (!Search_SymbolReplace(entry->data.function.name, *space))
-        goto exit_error;
+    if (line_left != line_right)
+        return line_left < line_right ? -1 : 1;
+    return 0;
+}
+
+/* Works out module_cache_key, and loads the cache if it matches. */
+static void Module_CacheCheck(void) {
+    Event_Wait(&main_event_fat_loaded);
+    Event_Wait(&apploader_event_disk_id);
+    
+    Module_CacheKey();
+    module_cache_hit = Module_CacheLoad();
+    
+    Event_Trigger(&module_event_cache_checked);
+}
+
+/* The key covers everything the linked space depends on: the game and its
+ * revision, which decide the code the symbols are found in, the symbol files
+ * and the modules. The files are known by their path, size and modification
+ * time, so that a hit doesn't have to read them all. */
+static void Module_CacheKey(void) {
+    char path[FILENAME_MAX];
+    uint32_t version;
+    
+    version = BSLUG_LOADER_VERSION;
+    module_cache_key = MODULE_CACHE_HASH_INIT;
+    module_cache_key = Module_CacheHash(
+        module_cache_key, &version, sizeof(version));
+    module_cache_key = Module_CacheHash(
+        module_cache_key, &os0->disc, offsetof(os_disc_id_t, streaming));
+    
+    assert(sizeof(path) > sizeof(module_path));
+    strcpy(path, module_path);
+    Module_CheckDirectory(path, &Module_CacheHashModule);
+    
+    assert(sizeof(path) > sizeof(module_symbols_path));
+    strcpy(path, module_symbols_path);
+    Module_CheckDirectory(path, &Module_CacheHashSymbols);
+}
+
+static uint64_t Module_CacheHash(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    size_t i;
+    
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= MODULE_CACHE_HASH_PRIME;
+    }
+    
+    return hash;
+}
 
-exit_success:
+/* Adds a file's name, size and modification time to module_cache_key. FAT
+ * keeps the time to 2 seconds, so only a file rewritten at the same size
+ * within 2 seconds of the cached one is missed, which moving the SD card to
+ * a computer and back can't do. A file which can't be stat'd still changes
+ * the key, so it can't match a cache made when it could. */
+static void Module_CacheHashFile(const char *path) {
+    struct stat stat_buf;
+    uint32_t size, time;
+    
+    module_cache_key = Module_CacheHash(
+        module_cache_key, path, strlen(path) + 1);
+    
+    if (stat(path, &stat_buf) != 0) {
+        size = (uint32_t)-1;
+        time = (uint32_t)-1;
+    } else {
+        size = (uint32_t)stat_buf.st_size;
+        time = (uint32_t)stat_buf.st_mtime;
+    }
+    module_cache_key = Module_CacheHash(module_cache_key, &size, sizeof(size));
+    module_cache_key = Module_CacheHash(module_cache_key, &time, sizeof(time));
+}
+
+static void Module_CacheHashModule(const char *path) {
+    if (Module_IsModule(path))
+        Module_CacheHashFile(path);
+}
+
+static void Module_CacheHashSymbols(const char *path) {
+    if (strcmp(Module_FileExtension(path), "xml") == 0)
+        Module_CacheHashFile(path);
+}
+
+static void Module_CacheFileName(char *path) {
+    assert(FILENAME_MAX > sizeof(module_cache_path) + 11);
+    sprintf(
+        path, "%s/%.4s%.2s.bin", module_cache_path, os0->disc.gamename,
+        os0->disc.company);
+}
+
+/* Loads the cache for this game if its key is module_cache_key. This fills
+ * in module_list, module_list_size and module_patches, and the module space
+ * itself. */
+static bool Module_CacheLoad(void) {
+    char path[FILENAME_MAX];
+    module_cache_header_t header;
+    module_cache_module_t *modules = NULL;
+    char *strings = NULL, *string;
+    struct stat stat_buf;
+    off_t offset;
+    size_t remaining, i;
+    int fd;
+    bool result = false;
+    
+    Module_CacheFileName(path);
+    fd = open(path, O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+    
+    if (!Module_ElfRead(fd, 0, &header, sizeof(header)))
+        goto exit_error;
+    if (memcmp(header.magic, MODULE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MODULE_CACHE_VERSION ||
+        header.key != module_cache_key ||
+        header.image_size % 32 != 0 ||
+        header.mem2_size % 32 != 0 ||
+        header.image_size > MODULE_LIST_SIZE_MAX ||
+        header.mem2_size > (size_t)(MODULE_MEM2_END - MODULE_MEM2_START) ||
+        (header.mem2_size > 0 && !Module_Mem2Usable()))
+        goto exit_error;
+    offset = sizeof(header);
+    
+    /* the counts must fit in the file, before anything is allocated for
+     * them. */
+    if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size < offset)
+        goto exit_error;
+    remaining = stat_buf.st_size - offset;
+    if (header.module_count > remaining / sizeof(module_cache_module_t))
+        goto exit_error;
+    remaining -= header.module_count * sizeof(module_cache_module_t);
+    if (header.strings_size > remaining)
+        goto exit_error;
+    remaining -= header.strings_size;
+    if (header.patch_count > remaining / sizeof(module_patch_t))
+        goto exit_error;
+    remaining -= header.patch_count * sizeof(module_patch_t);
+    if (header.image_size > remaining ||
+        header.mem2_size > remaining - header.image_size)
+        goto exit_error;
+    
+    modules = malloc(header.module_count * sizeof(module_cache_module_t));
+    strings = malloc(header.strings_size + 1);
+    if ((modules == NULL && header.module_count > 0) || strings == NULL)
+        goto exit_error;
+    if (!Module_ElfRead(
+            fd, offset, modules,
+            header.module_count * sizeof(module_cache_module_t)))
+        goto exit_error;
+    offset += header.module_count * sizeof(module_cache_module_t);
+    if (!Module_ElfRead(fd, offset, strings, header.strings_size))
+        goto exit_error;
+    strings[header.strings_size] = '\0';
+    offset += header.strings_size;
+    
+    string = strings;
+    for (i = 0; i < header.module_count; i++) {
+        const char *fields[6];
+        module_metadata_t **list_ptr;
+        size_t j;
+        
+        for (j = 0; j < 6; j++) {
+            if (string >= strings + header.strings_size)
+                goto exit_error;
+            fields[j] = string;
+            string += strlen(string) + 1;
+        }
+        
+        list_ptr = Module_ListAllocate(
+            &module_list, sizeof(module_metadata_t *), 1,
+            &module_list_capacity, &module_list_count,
+            MODULE_LIST_CAPACITY_DEFAULT);
+        if (list_ptr == NULL)
+            goto exit_error;
+        *list_ptr = Module_MetadataCreate(
+            fields[0], fields[1], fields[2], fields[3], fields[4], fields[5],
+            modules[i].entries_count);
+        if (*list_ptr == NULL) {
+            module_list_count--;
+            goto exit_error;
+        }
+        (*list_ptr)->size = modules[i].size;
+    }
+    
+    if (Module_ListAllocate(
+            &module_patches, sizeof(module_patch_t), header.patch_count,
+            &module_patches_capacity, &module_patches_count,
+            MODULE_PATCHES_CAPACITY_DEFAULT) == NULL &&
+        header.patch_count > 0)
+        goto exit_error;
+    if (!Module_ElfRead(
+            fd, offset, module_patches,
+            header.patch_count * sizeof(module_patch_t)))
+        goto exit_error;
+    offset += header.patch_count * sizeof(module_patch_t);
+    
+    module_list_size = header.image_size;
+    module_list_base = MODULE_LIST_END - module_list_size;
+    if (!Module_ElfRead(fd, offset, module_list_base, module_list_size))
+        goto exit_error;
+    offset += module_list_size;
+    
+    module_mem2_size = header.mem2_size;
+    module_mem2_base = MODULE_MEM2_END - module_mem2_size;
+    if (!Module_ElfRead(fd, offset, module_mem2_base, module_mem2_size))
+        goto exit_error;
+    
     result = true;
 exit_error:
-    if (!result) printf("Module_ListLinkFinalReplaceFunction: exit_error\n");
+    if (!result) {
+        for (i = 0; i < module_list_count; i++)
+            free(module_list[i]);
+        free(module_list);
+        module_list = NULL;
+        module_list_count = 0;
+        module_list_capacity = 0;
+        free(module_patches);
+        module_patches = NULL;
+        module_patches_count = 0;
+        module_patches_capacity = 0;
+        module_list_size = 0;
+        module_list_base = NULL;
+        module_mem2_size = 0;
+        module_mem2_base = NULL;
+    }
+    free(modules);
+    free(strings);
+    close(fd);
     return result;
 }
+
+/* Makes the changes to the game's code recorded in module_patches, which
+ * Module_Flush then makes visible. */
+static void Module_CachePatch(void) {
+    size_t i;
+    
+    for (i = 0; i < module_patches_count; i++) {
+        uint32_t *data;
+        
+        data = (uint32_t *)module_patches[i].address;
+        *data = module_patches[i].instruction;
+    }
+}
+
+/* Saves the linked modules for next time. Nothing is saved if there were any
+ * messages, so that they are shown again until they are dealt with. */
+static void Module_CacheSave(void) {
+    char path[FILENAME_MAX];
+    FILE *file;
+    bool result;
+    
+    if (module_cache_incomplete || module_has_info || search_has_info)
+        goto exit;
+    
+    mkdir(module_cache_path, 0777);
+    
+    Module_CacheFileName(path);
+    file = fopen(path, "wb");
+    if (file == NULL)
+        goto exit;
+    
+    result = Module_CacheWrite(file);
+    if (fclose(file) != 0 || !result)
+        remove(path);
+    
+exit:
+    free(module_patches);
+    module_patches = NULL;
+    module_patches_count = 0;
+    module_patches_capacity = 0;
+}
+
+static bool Module_CacheWrite(FILE *file) {
+    module_cache_header_t header;
+    size_t i, j;
+    
+    memcpy(header.magic, MODULE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MODULE_CACHE_VERSION;
+    header.key = module_cache_key;
+    header.module_count = module_list_count;
+    header.strings_size = 0;
+    header.patch_count = module_patches_count;
+    header.image_size = module_list_size;
+    header.mem2_size = module_mem2_size;
+    
+    for (i = 0; i < module_list_count; i++) {
+        const char *fields[6] = {
+            module_list[i]->path, module_list[i]->game, module_list[i]->name,
+            module_list[i]->author, module_list[i]->version,
+            module_list[i]->license
+        };
+        
+        for (j = 0; j < 6; j++)
+            header.strings_size += strlen(fields[j]) + 1;
+    }
+    
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return false;
+    
+    for (i = 0; i < module_list_count; i++) {
+        module_cache_module_t module;
+        
+        module.size = module_list[i]->size;
+        module.entries_count = module_list[i]->entries_count;
+        if (fwrite(&module, sizeof(module), 1, file) != 1)
+            return false;
+    }
+    
+    for (i = 0; i < module_list_count; i++) {
+        const char *fields[6] = {
+            module_list[i]->path, module_list[i]->game, module_list[i]->name,
+            module_list[i]->author, module_list[i]->version,
+            module_list[i]->license
+        };
+        
+        for (j = 0; j < 6; j++) {
+            if (fwrite(fields[j], strlen(fields[j]) + 1, 1, file) != 1)
+                return false;
+        }
+    }
+    
+    return
+        fwrite(
+            module_patches, sizeof(module_patch_t), module_patches_count,
+            file) == module_patches_count &&
+        fwrite(module_list_base, 1, module_list_size, file) ==
+            module_list_size &&
+        fwrite(module_mem2_base, 1, module_mem2_size, file) ==
+            module_mem2_size;
+}
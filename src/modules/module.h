@@ -27,9 +27,17 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "library/event.h"
 
+/* The top of MEM2, below the IOS heap, is reserved for module sections which
+ * needn't take memory from the game's MEM1. The game's MEM2 arena is only
+ * cut by what is used. The IOS heap starts at MODULE_MEM2_END under most
+ * IOSes; under any where it starts lower, the window isn't used. */
+#define MODULE_MEM2_START ((uint8_t *)0x93000000)
+#define MODULE_MEM2_END ((uint8_t *)0x933e0000)
+
 typedef struct {
     const char *path;
     const char *game;
@@ -43,15 +51,28 @@ typedef struct {
 
 extern event_t module_event_list_loaded;
 extern event_t module_event_complete;
+/* triggered once module_cache_hit is known. */
+extern event_t module_event_cache_checked;
+/* triggered once the modules are linked as far as they can be without the
+ * game, after which Module_SymbolNeeded is valid; or on error. */
+extern event_t module_event_linked;
 extern bool module_has_error;
+/* whether the modules were loaded from the cache, so no symbols are needed. */
+extern bool module_cache_hit;
 /* whether or not to delay loading for debug messages. */
 extern bool module_has_info;
 
 extern size_t module_list_size;
+/* how many data and instruction cache operations were done, for the stats. */
+extern size_t module_cache_op_count;
+/* the size of the sections put in MEM2, which end at MODULE_MEM2_END. */
+extern size_t module_mem2_size;
 extern module_metadata_t **module_list;
 extern size_t module_list_count;
 
 bool Module_Init(void);
 bool Module_RunBackground(void);
+/* whether the modules import or replace name, so the search must find it. */
+bool Module_SymbolNeeded(const char *name);
 
 #endif /* MODULE_H_ */
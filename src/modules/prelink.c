@@ -0,0 +1,62 @@
+/* prelink.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "prelink.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "link.h"
+
+bool Prelink_FixupValid(
+        const prelink_header_t *header, const prelink_fixup_t *fixup,
+        size_t name_count) {
+    size_t width;
+    uint32_t size;
+    
+    width = Link_Width(PRELINK_FIXUP_TYPE(fixup->info));
+    if (width == 0)
+        return false;
+    
+    switch (PRELINK_FIXUP_REGION(fixup->info)) {
+        case PRELINK_REGION_IMAGE: {
+            if (header->image_bss_size > UINT32_MAX - header->image_size)
+                return false;
+            size = header->image_size + header->image_bss_size;
+            break;
+        } case PRELINK_REGION_LOAD: {
+            size = header->load_size;
+            break;
+        } default:
+            return false;
+    }
+    
+    if (size < width || fixup->offset > size - width)
+        return false;
+    if ((fixup->info & PRELINK_FIXUP_EXTERNAL) && fixup->symbol >= name_count)
+        return false;
+    
+    return true;
+}
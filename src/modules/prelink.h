@@ -0,0 +1,97 @@
+/* prelink.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PRELINK_H_
+#define PRELINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The prelinked module format, made from a module's ELF file by
+ * tools/prelink so that the loader can load it without libelf.
+ *
+ * Everything in the file is big endian. The file starts with a
+ * prelink_header_t, which is followed by these, each padded to a multiple of
+ * 4 bytes:
+ *  - meta_size bytes: the contents of .bslug.meta.
+ *  - image_stored_size bytes: every other loaded section, in one block of
+ *    image_size bytes, with the relocations between them which don't depend
+ *    on where the block goes already applied. If flags has
+ *    PRELINK_FLAG_COMPRESSED, the block is compressed as in modules/lz.h,
+ *    otherwise image_stored_size is image_size. The block is followed by
+ *    image_bss_size zero bytes which aren't in the file, and must be
+ *    image_align byte aligned.
+ *  - load_size bytes: the contents of .bslug.load.
+ *  - fixup_count prelink_fixup_t: the relocations left to do.
+ *  - names_size bytes: the names of the external symbols, each ended by a
+ *    NUL. */
+
+#define PRELINK_MAGIC "BSLP"
+#define PRELINK_VERSION 2
+
+#define PRELINK_FLAG_COMPRESSED 0x1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t meta_size;
+    uint32_t image_size;
+    uint32_t image_stored_size;
+    uint32_t image_bss_size;
+    uint32_t image_align;
+    uint32_t load_size;
+    uint32_t fixup_count;
+    uint32_t names_size;
+} prelink_header_t;
+
+/* The blocks a fixup can be in. */
+#define PRELINK_REGION_IMAGE 0
+#define PRELINK_REGION_LOAD 1
+
+/* info is the relocation type, the region it is in, and whether it is
+ * against an external symbol. For external fixups, symbol is the index of the
+ * symbol's name. Otherwise, symbol is an offset in the image. */
+#define PRELINK_FIXUP_EXTERNAL 0x10000
+#define PRELINK_FIXUP_INFO(type, region, external) \
+    ((type) | ((region) << 8) | ((external) ? PRELINK_FIXUP_EXTERNAL : 0))
+#define PRELINK_FIXUP_TYPE(info) ((info) & 0xff)
+#define PRELINK_FIXUP_REGION(info) (((info) >> 8) & 0xff)
+
+typedef struct {
+    uint32_t offset;
+    uint32_t info;
+    int32_t addend;
+    uint32_t symbol;
+} prelink_fixup_t;
+
+/* Whether fixup is one the loader can do: a supported type, entirely inside
+ * its region, and if it is external, against one of the name_count names. The
+ * file doesn't go through libelf, so nothing else checks this. */
+bool Prelink_FixupValid(
+    const prelink_header_t *header, const prelink_fixup_t *fixup,
+    size_t name_count);
+
+#endif /* PRELINK_H_ */
@@ -51,14 +51,42 @@ typedef struct fsm_node_t {
     union {
         /* list of transitions given certain characters */
         struct fsm_node_t *transition[16];
-        /* default transition if no other applies */
-        struct fsm_node_t *next;
+        struct {
+            /* default transition if no other applies */
+            struct fsm_node_t *next;
+            /* how far the match address is before the current position. */
+            size_t offset;
+        };
     } payload;
 } fsm_node_t;
 
+/* Most nodes have nearly all their transitions going to the same node, so
+ * once an FSM is built FSM_Compact can replace its nodes with a much smaller
+ * table for the search. Each transitional node becomes a run of words in one
+ * shared table, and its state number is the start of that run. The first word
+ * is the default transition, the second a mask of the nibbles which don't use
+ * the default, and for each such nibble n word n + 2 is its transition. Runs
+ * are packed so that the words a node doesn't use may belong to another.
+ * Epsilon nodes are kept in a separate list, and their state numbers have
+ * FSM_EPSILON set. */
+
+#define FSM_EPSILON ((uint32_t)0x80000000)
+
+typedef struct {
+    symbol_index_t symbol;
+    uint32_t next;
+    size_t offset;
+} fsm_epsilon_t;
+
 struct fsm_t {
     fsm_node_t *initial;
     unsigned int node_count;
+    /* only present after FSM_Compact, in which case there are no nodes. */
+    uint32_t *table;
+    size_t table_size;
+    uint32_t table_initial;
+    fsm_epsilon_t *epsilons;
+    unsigned int epsilon_count;
 };
 
 typedef struct {
@@ -84,6 +112,325 @@ static fsm_node_t *FSM_AllocNode(fsm_t *fsm) {
     return node;
 }
  
+/* Symbols with a pattern are found in two steps. The FSM only matches the
+ * pattern's anchor: its first run of bytes which aren't anything, before any
+ * gap, so always the same distance from the start. Search_SymbolMatch then
+ * checks the whole pattern there with Symbol_PatternMatch, much as near hints
+ * are checked. Gaps and bytes of anything never reach the FSM, as every
+ * length or value they allow would multiply the sets of positions below.
+ *
+ * The anchor's FSM is built by the textbook subset construction. A position
+ * in the anchor is either just before a byte, or just after its high nibble,
+ * in which case the position remembers the high nibble if that changes which
+ * low nibbles are allowed. Each node of the FSM is then the set of positions
+ * that the data so far could have reached. */
+
+/* before byte, or with half = high nibble + 1 after it. The byte after the
+ * last is the end of the anchor. */
+#define FSM_PATTERN_CODE(byte, half) ((byte) * 17 + (half))
+
+typedef struct fsm_pattern_set_t {
+    struct fsm_pattern_set_t *hash_next;
+    fsm_node_t *node;
+    size_t count;
+    uint32_t codes[];
+} fsm_pattern_set_t;
+
+#define FSM_PATTERN_HASH_SIZE 1024
+
+typedef struct {
+    fsm_t *fsm;
+    const symbol_t *symbol;
+    /* the anchor is length elements from start. */
+    size_t start;
+    size_t length;
+    fsm_pattern_set_t *hash[FSM_PATTERN_HASH_SIZE];
+    /* every set, in the order they were made. */
+    fsm_pattern_set_t **sets;
+    size_t set_count;
+    size_t set_capacity;
+    uint32_t *scratch;
+} fsm_pattern_build_t;
+
+/* the low nibbles allowed after high nibble high. */
+static inline uint16_t FSM_PatternRow(
+        const uint32_t *accept, unsigned int high) {
+    return accept[high / 2] >> ((high % 2) * 16);
+}
+
+/* Returns true if the low nibbles allowed don't depend on the high nibble, in
+ * which case the position after the high nibble needn't remember it. */
+static bool FSM_PatternSplit(const uint32_t *accept) {
+    unsigned int i;
+    uint16_t row, common;
+    
+    common = 0;
+    for (i = 0; i < 16; i++) {
+        row = FSM_PatternRow(accept, i);
+        if (row == 0)
+            continue;
+        if (common != 0 && row != common)
+            return false;
+        common = row;
+    }
+    
+    return true;
+}
+
+/* Whether element is a byte of anything. */
+static bool FSM_PatternAny(const symbol_pattern_element_t *element) {
+    size_t i;
+    
+    for (i = 0; i < 8; i++)
+        if (element->accept[i] != 0xffffffff)
+            return false;
+    
+    return true;
+}
+
+/* Finds the anchor of a pattern. A pattern can't start with a gap, so if
+ * every byte before its first gap is anything, those bytes are the anchor. */
+static void FSM_PatternAnchor(fsm_pattern_build_t *build) {
+    const symbol_pattern_t *pattern;
+    size_t i;
+    
+    pattern = build->symbol->pattern;
+    
+    for (i = 0;
+         i < pattern->element_count && pattern->elements[i].gap_max == 0 &&
+         FSM_PatternAny(&pattern->elements[i]);
+         i++);
+    
+    if (i == pattern->element_count || pattern->elements[i].gap_max != 0) {
+        build->start = 0;
+        build->length = i;
+    } else {
+        build->start = i;
+        for (; i < pattern->element_count &&
+               pattern->elements[i].gap_max == 0 &&
+               !FSM_PatternAny(&pattern->elements[i]);
+             i++);
+        build->length = i - build->start;
+    }
+    
+    assert(build->length > 0);
+}
+
+/* Finds the set containing codes, making it if it doesn't exist yet. */
+static fsm_pattern_set_t *FSM_PatternSet(
+        fsm_pattern_build_t *build, const uint32_t *codes, size_t count) {
+    fsm_pattern_set_t *set, *rest;
+    unsigned int hash;
+    size_t i;
+    
+    hash = 2166136261u;
+    for (i = 0; i < count; i++)
+        hash = (hash ^ codes[i]) * 16777619u;
+    hash %= FSM_PATTERN_HASH_SIZE;
+    
+    for (set = build->hash[hash]; set != NULL; set = set->hash_next) {
+        if (set->count == count &&
+            memcmp(set->codes, codes, count * sizeof(uint32_t)) == 0)
+            return set;
+    }
+    
+    if (build->set_count == build->set_capacity) {
+        fsm_pattern_set_t **tmp;
+        
+        tmp = realloc(
+            build->sets,
+            (build->set_capacity * 2 + 16) * sizeof(fsm_pattern_set_t *));
+        if (tmp == NULL)
+            return NULL;
+        build->sets = tmp;
+        build->set_capacity = build->set_capacity * 2 + 16;
+    }
+    
+    set = malloc(sizeof(fsm_pattern_set_t) + count * sizeof(uint32_t));
+    if (set == NULL)
+        return NULL;
+    
+    set->count = count;
+    memcpy(set->codes, codes, count * sizeof(uint32_t));
+    
+    /* the codes are sorted, so the end of the anchor is last. A set which
+     * reaches it is a match, then carries on as the set without it. */
+    if (count > 0 && codes[count - 1] == FSM_PATTERN_CODE(build->length, 0)) {
+        rest = FSM_PatternSet(build, codes, count - 1);
+        if (rest == NULL) {
+            free(set);
+            return NULL;
+        }
+        
+        set->node = FSM_AllocNode(build->fsm);
+        if (set->node == NULL) {
+            free(set);
+            return NULL;
+        }
+        set->node->symbol = build->symbol->index;
+        set->node->payload.offset =
+            build->symbol->offset + build->start + build->length;
+        set->node->payload.next = rest->node;
+    } else {
+        set->node = FSM_AllocNode(build->fsm);
+        if (set->node == NULL) {
+            free(set);
+            return NULL;
+        }
+    }
+    
+    set->hash_next = build->hash[hash];
+    build->hash[hash] = set;
+    build->sets[build->set_count++] = set;
+    
+    return set;
+}
+
+/* Works out the set reached from set by nibble. */
+static fsm_pattern_set_t *FSM_PatternStep(
+        fsm_pattern_build_t *build, const fsm_pattern_set_t *set,
+        unsigned int nibble) {
+    const symbol_pattern_element_t *elements;
+    size_t i, count;
+    
+    elements = build->symbol->pattern->elements + build->start;
+    count = 0;
+    
+    if (set->count > 0 && set->codes[0] % 17 == 0) {
+        /* before a byte, so this is its high nibble. */
+        for (i = 0; i < set->count; i++) {
+            const uint32_t *accept;
+            size_t byte;
+            
+            byte = set->codes[i] / 17;
+            assert(byte < build->length);
+            accept = elements[byte].accept;
+            
+            if (FSM_PatternRow(accept, nibble) == 0)
+                continue;
+            
+            build->scratch[count++] = FSM_PATTERN_CODE(
+                byte, FSM_PatternSplit(accept) ? 1 : nibble + 1);
+        }
+    } else {
+        /* after a high nibble, so this is the low nibble. A match could also
+         * start at the next byte. */
+        build->scratch[count++] = FSM_PATTERN_CODE(0, 0);
+        
+        for (i = 0; i < set->count; i++) {
+            const uint32_t *accept;
+            size_t byte, half;
+            uint16_t row;
+            
+            byte = set->codes[i] / 17;
+            half = set->codes[i] % 17;
+            assert(half > 0);
+            accept = elements[byte].accept;
+            
+            if (FSM_PatternSplit(accept)) {
+                unsigned int high;
+                
+                row = 0;
+                for (high = 0; high < 16; high++)
+                    row |= FSM_PatternRow(accept, high);
+            } else
+                row = FSM_PatternRow(accept, half - 1);
+            
+            if (!(row & (1 << nibble)))
+                continue;
+            
+            /* several high nibbles can lead to the same place. */
+            if (build->scratch[count - 1] == FSM_PATTERN_CODE(byte + 1, 0))
+                continue;
+            
+            build->scratch[count++] = FSM_PATTERN_CODE(byte + 1, 0);
+        }
+    }
+    
+    return FSM_PatternSet(build, build->scratch, count);
+}
+ 
+static fsm_t *FSM_CreatePattern(const symbol_t *symbol) {
+    fsm_pattern_build_t *build = NULL;
+    fsm_pattern_set_t *set;
+    fsm_t *fsm = NULL;
+    size_t i;
+    unsigned int j;
+    
+    assert(symbol);
+    assert(symbol->pattern);
+    
+    build = calloc(1, sizeof(fsm_pattern_build_t));
+    fsm = malloc(sizeof(fsm_t));
+    if (build == NULL || fsm == NULL)
+        goto exit_error;
+    
+    fsm->initial = NULL;
+    fsm->node_count = 0;
+    fsm->table = NULL;
+    fsm->epsilons = NULL;
+    
+    build->fsm = fsm;
+    build->symbol = symbol;
+    FSM_PatternAnchor(build);
+    
+    /* a set can hold at most every position after a high nibble. */
+    build->scratch = malloc((build->length * 17 + 1) * sizeof(uint32_t));
+    if (build->scratch == NULL)
+        goto exit_error;
+    
+    /* initially, a match could start here. */
+    build->scratch[0] = FSM_PATTERN_CODE(0, 0);
+    set = FSM_PatternSet(build, build->scratch, 1);
+    if (set == NULL)
+        goto exit_error;
+    fsm->initial = set->node;
+    
+    /* sets are added as they're reached, so this visits them all. */
+    for (i = 0; i < build->set_count; i++) {
+        fsm_node_t *node;
+        
+        node = build->sets[i]->node;
+        if (node->symbol != SYMBOL_NULL)
+            continue;
+        
+        for (j = 0; j < 16; j++) {
+            set = FSM_PatternStep(build, build->sets[i], j);
+            if (set == NULL)
+                goto exit_error;
+            
+            /* build->sets may have moved. */
+            build->sets[i]->node->payload.transition[j] = set->node;
+        }
+    }
+    
+    for (i = 0; i < build->set_count; i++)
+        free(build->sets[i]);
+    free(build->sets);
+    free(build->scratch);
+    free(build);
+    
+    return fsm;
+exit_error:
+
+    if (build != NULL) {
+        /* each set owns its node, and an epsilon's next is another set's. */
+        for (i = 0; i < build->set_count; i++) {
+            free(build->sets[i]->node);
+            free(build->sets[i]);
+        }
+        free(build->sets);
+        free(build->scratch);
+        free(build);
+    }
+    
+    if (fsm != NULL)
+        free(fsm);
+
+    return NULL;
+}
+ 
+ 
 fsm_t *FSM_Create(symbol_index_t symbol_index) {
     typedef struct {
         fsm_node_t *node;
@@ -118,6 +465,9 @@ fsm_t *FSM_Create(symbol_index_t symbol_index) {
     
     assert(symbol);
 
+    if (symbol->pattern != NULL)
+        return FSM_CreatePattern(symbol);
+
     data = symbol->data;
     mask = symbol->mask;
     length = symbol->data_size;
@@ -144,7 +494,10 @@ fsm_t *FSM_Create(symbol_index_t symbol_index) {
     if (fsm == NULL)
         goto exit_error;
         
+    fsm->initial = NULL;
     fsm->node_count = 0;
+    fsm->table = NULL;
+    fsm->epsilons = NULL;
     
     if (mask[0] & 0xf0) {
         fallback = FSM_AllocNode(fsm);
@@ -302,6 +655,7 @@ fsm_t *FSM_Create(symbol_index_t symbol_index) {
                 
         current->node->symbol = symbol->index;
         current->node->payload.next = fallback;
+        current->node->payload.offset = symbol->offset;
     }
     
     free(queue1);
@@ -378,6 +732,7 @@ static bool FSM_BuildMergeNodeEpsilon(
         unsigned int common_index;
         
         node->symbol = left_node->symbol;
+        node->payload.offset = left_node->payload.offset;
         assert(left_node->payload.next);
         
         common_index = 
@@ -398,6 +753,7 @@ static bool FSM_BuildMergeNodeEpsilon(
         unsigned int common_index;
         
         node->symbol = right_node->symbol;
+        node->payload.offset = right_node->payload.offset;
         assert(right_node->payload.next);
         
         common_index = 
@@ -446,13 +802,17 @@ fsm_t *FSM_Merge(const fsm_t *left, const fsm_t *right) {
     unsigned int processed_nodes, i, common_index;
     
     assert(left != NULL && right != NULL);
+    assert(left->table == NULL && right->table == NULL);
     
     fsm = malloc(sizeof(fsm_t));
     
     if (fsm == NULL)
         goto exit_error;
     
+    fsm->initial = NULL;
     fsm->node_count = 0;
+    fsm->table = NULL;
+    fsm->epsilons = NULL;
     
     node_index = 
         calloc(left->node_count * right->node_count, sizeof(fsm_node_index_t));
@@ -481,7 +841,7 @@ fsm_t *FSM_Merge(const fsm_t *left, const fsm_t *right) {
                         fsm, left, right,
                         node_index, node_index[i].node,
                         node_index[i].left, node_index[i].right))
-                    return false;
+                    goto exit_error;
                 node_index[i].processed = true;
                 processed_nodes++;
             }
@@ -507,13 +867,22 @@ exit_error:
     return NULL;
 }
 
+size_t FSM_NodeCount(const fsm_t *fsm) {
+    assert(fsm);
+    assert(fsm->initial);
+    
+    return fsm->node_count;
+}
+
 void FSM_Free(fsm_t *fsm) {
-    fsm_node_t *nodes[fsm->node_count];
     unsigned int i, j, found;
         
     assert(fsm);
     
+    /* a compacted FSM has no nodes left. */
     if (fsm->initial != NULL) {
+        fsm_node_t *nodes[fsm->node_count];
+        
         for (i = 0; i < fsm->node_count; i++)
             nodes[i] = NULL;    
     
@@ -569,9 +938,308 @@ void FSM_Free(fsm_t *fsm) {
         }
     }
     
+    if (fsm->table != NULL)
+        free(fsm->table);
+    if (fsm->epsilons != NULL)
+        free(fsm->epsilons);
+    
     free(fsm);
 }
 
+/* Returns an array of all the nodes in fsm, indexed by their index. */
+static fsm_node_t **FSM_ListNodes(const fsm_t *fsm) {
+    fsm_node_t **nodes, **queue;
+    unsigned int i, j, found;
+    
+    assert(fsm);
+    assert(fsm->initial);
+    
+    nodes = calloc(fsm->node_count, sizeof(fsm_node_t *));
+    queue = malloc(fsm->node_count * sizeof(fsm_node_t *));
+    
+    if (nodes == NULL || queue == NULL) {
+        free(nodes);
+        free(queue);
+        return NULL;
+    }
+    
+    assert(fsm->initial->index < fsm->node_count);
+    nodes[fsm->initial->index] = fsm->initial;
+    queue[0] = fsm->initial;
+    found = 1;
+    
+    for (i = 0; i < found; i++) {
+        fsm_node_t *next[16];
+        unsigned int next_count;
+        
+        if (queue[i]->symbol == SYMBOL_NULL) {
+            /* transitional node */
+            for (j = 0; j < 16; j++)
+                next[j] = queue[i]->payload.transition[j];
+            next_count = 16;
+        } else {
+            /* epsilon node */
+            next[0] = queue[i]->payload.next;
+            next_count = 1;
+        }
+        
+        for (j = 0; j < next_count; j++) {
+            assert(next[j] != NULL);
+            assert(next[j]->index < fsm->node_count);
+            
+            if (nodes[next[j]->index] == NULL) {
+                nodes[next[j]->index] = next[j];
+                queue[found++] = next[j];
+            }
+        }
+    }
+    
+    assert(found == fsm->node_count);
+    
+    free(queue);
+    
+    return nodes;
+}
+
+bool FSM_Compact(fsm_t *fsm) {
+    fsm_node_t **nodes = NULL;
+    uint32_t *states = NULL, *table = NULL;
+    uint8_t *used = NULL;
+    fsm_epsilon_t *epsilons = NULL;
+    size_t table_capacity, table_size, first_free, base;
+    unsigned int i, j, epsilon_count;
+    
+    assert(fsm);
+    assert(fsm->initial);
+    assert(fsm->table == NULL);
+    
+    nodes = FSM_ListNodes(fsm);
+    if (nodes == NULL)
+        goto exit_error;
+    
+    states = malloc(fsm->node_count * sizeof(uint32_t));
+    epsilons = malloc(fsm->node_count * sizeof(fsm_epsilon_t));
+    if (states == NULL || epsilons == NULL)
+        goto exit_error;
+    
+    table_capacity = 0;
+    table_size = 0;
+    first_free = 0;
+    epsilon_count = 0;
+    
+    /* place each node, filling in the table with node indices for now. */
+    for (i = 0; i < fsm->node_count; i++) {
+        const fsm_node_t *node, *fallback;
+        unsigned int exceptions, best;
+        
+        node = nodes[i];
+        
+        if (node->symbol != SYMBOL_NULL) {
+            /* epsilon node */
+            epsilons[epsilon_count].symbol = node->symbol;
+            epsilons[epsilon_count].next = node->payload.next->index;
+            epsilons[epsilon_count].offset = node->payload.offset;
+            states[i] = FSM_EPSILON | epsilon_count;
+            epsilon_count++;
+            continue;
+        }
+        
+        /* the default transition is the most common one. */
+        fallback = NULL;
+        best = 0;
+        for (j = 0; j < 16; j++) {
+            unsigned int k, count;
+            
+            count = 0;
+            for (k = 0; k < 16; k++)
+                if (node->payload.transition[k] == node->payload.transition[j])
+                    count++;
+            
+            if (count > best) {
+                best = count;
+                fallback = node->payload.transition[j];
+            }
+        }
+        
+        exceptions = 0;
+        for (j = 0; j < 16; j++)
+            if (node->payload.transition[j] != fallback)
+                exceptions |= 1 << j;
+        
+        /* first fit; the table is mostly full before first_free. */
+        for (base = first_free; ; base++) {
+            if (base + 18 > table_capacity) {
+                uint32_t *tmp_table;
+                uint8_t *tmp_used;
+                size_t capacity;
+                
+                capacity = table_capacity * 2 + 64;
+                tmp_table = realloc(table, capacity * sizeof(uint32_t));
+                if (tmp_table == NULL)
+                    goto exit_error;
+                table = tmp_table;
+                tmp_used = realloc(used, capacity);
+                if (tmp_used == NULL)
+                    goto exit_error;
+                used = tmp_used;
+                
+                memset(table + table_capacity, 0,
+                       (capacity - table_capacity) * sizeof(uint32_t));
+                memset(used + table_capacity, 0, capacity - table_capacity);
+                table_capacity = capacity;
+            }
+            
+            if (used[base] || used[base + 1])
+                continue;
+            
+            for (j = 0; j < 16; j++)
+                if ((exceptions & (1 << j)) && used[base + 2 + j])
+                    break;
+            
+            if (j == 16)
+                break;
+        }
+        
+        assert(base < FSM_EPSILON);
+        
+        states[i] = base;
+        table[base] = fallback->index;
+        table[base + 1] = exceptions;
+        used[base] = used[base + 1] = 1;
+        for (j = 0; j < 16; j++) {
+            if (exceptions & (1 << j)) {
+                table[base + 2 + j] = node->payload.transition[j]->index;
+                used[base + 2 + j] = 1;
+            }
+        }
+        
+        /* lookups read up to base + 17. */
+        if (base + 18 > table_size)
+            table_size = base + 18;
+        
+        while (first_free < table_capacity && used[first_free])
+            first_free++;
+    }
+    
+    assert(table != NULL);
+    
+    /* now every node has a state number, so translate the indices. */
+    for (i = 0; i < fsm->node_count; i++) {
+        if (states[i] & FSM_EPSILON)
+            continue;
+        
+        base = states[i];
+        table[base] = states[table[base]];
+        for (j = 0; j < 16; j++)
+            if (table[base + 1] & (1 << j))
+                table[base + 2 + j] = states[table[base + 2 + j]];
+    }
+    for (i = 0; i < epsilon_count; i++)
+        epsilons[i].next = states[epsilons[i].next];
+    
+    {
+        uint32_t *tmp_table;
+        fsm_epsilon_t *tmp_epsilons;
+        
+        assert(table_size <= table_capacity);
+        
+        tmp_table = realloc(table, table_size * sizeof(uint32_t));
+        if (tmp_table != NULL)
+            table = tmp_table;
+        if (epsilon_count > 0) {
+            tmp_epsilons = realloc(
+                epsilons, epsilon_count * sizeof(fsm_epsilon_t));
+            if (tmp_epsilons != NULL)
+                epsilons = tmp_epsilons;
+        }
+    }
+    
+    fsm->table = table;
+    fsm->table_size = table_size;
+    fsm->table_initial = states[fsm->initial->index];
+    fsm->epsilons = epsilons;
+    fsm->epsilon_count = epsilon_count;
+    
+    for (i = 0; i < fsm->node_count; i++)
+        free(nodes[i]);
+    free(nodes);
+    free(states);
+    free(used);
+    
+    fsm->initial = NULL;
+    fsm->node_count = 0;
+    
+    return true;
+exit_error:
+    if (nodes != NULL)
+        free(nodes);
+    if (states != NULL)
+        free(states);
+    if (table != NULL)
+        free(table);
+    if (used != NULL)
+        free(used);
+    if (epsilons != NULL)
+        free(epsilons);
+    
+    return false;
+}
+
+static inline uint32_t FSM_CompactTransition(
+        const fsm_t *fsm, uint32_t state, unsigned int nibble) {
+    const uint32_t *run;
+    uint32_t select;
+    
+    assert((state & FSM_EPSILON) == 0);
+    assert(state + 18 <= fsm->table_size);
+    
+    run = fsm->table + state;
+    
+    /* all three words are loaded at once and one is picked without a branch,
+     * since which is taken is hard to predict. */
+    select = -((run[1] >> nibble) & 1);
+    
+    return (run[2 + nibble] & select) | (run[0] & ~select);
+}
+
+static void FSM_RunCompact(
+        const fsm_t *fsm, uint8_t *data,
+        size_t length, fsm_match_t match_fn) {
+    const fsm_epsilon_t *epsilon;
+    uint32_t state;
+    size_t i;
+    
+    assert(fsm->table != NULL);
+    
+    state = fsm->table_initial;
+    
+    for (i = 0; i < length; i++) {
+        /* process epsilons */
+        while (state & FSM_EPSILON) {
+            assert((state & ~FSM_EPSILON) < fsm->epsilon_count);
+            epsilon = &fsm->epsilons[state & ~FSM_EPSILON];
+            match_fn(
+                epsilon->symbol,
+                data + i - epsilon->offset);
+            state = epsilon->next;
+        }
+        
+        /* process transition */
+        state = FSM_CompactTransition(fsm, state, data[i] >> 4);
+        state = FSM_CompactTransition(fsm, state, data[i] & 0xf);
+    }
+    
+    /* process epsilons */
+    while (state & FSM_EPSILON) {
+        assert((state & ~FSM_EPSILON) < fsm->epsilon_count);
+        epsilon = &fsm->epsilons[state & ~FSM_EPSILON];
+        match_fn(
+            epsilon->symbol,
+            data + i - epsilon->offset);
+        state = epsilon->next;
+    }
+}
+
 void FSM_Run(
         const fsm_t *fsm, uint8_t *data,
         size_t length, fsm_match_t match_fn) {
@@ -579,10 +1247,16 @@ void FSM_Run(
     size_t i;
     
     assert(fsm != NULL);
-    assert(fsm->initial != NULL);
     assert(data != NULL);
     assert(match_fn != NULL);
     
+    if (fsm->table != NULL) {
+        FSM_RunCompact(fsm, data, length, match_fn);
+        return;
+    }
+    
+    assert(fsm->initial != NULL);
+    
     state = fsm->initial;
     
     for (i = 0; i < length; i++) {        
@@ -592,7 +1266,7 @@ void FSM_Run(
         while (state->symbol != SYMBOL_NULL) {
             match_fn(
                 state->symbol,
-                data + i - Symbol_GetSymbol(state->symbol)->offset);
+                data + i - state->payload.offset);
             state = state->payload.next;
             assert(state != NULL);
         }
@@ -609,9 +1283,310 @@ void FSM_Run(
     while (state->symbol != SYMBOL_NULL) {
         match_fn(
             state->symbol,
-            data + i - Symbol_GetSymbol(state->symbol)->offset);
+            data + i - state->payload.offset);
         state = state->payload.next;
         assert(state != NULL);
     }
 }
 
+
+/* When there are a great many symbols, the FSM made by merging them all can
+ * be too big to fit in memory. Instead, we can keep the FSMs for each symbol
+ * separately and only build the states of the merged FSM as the search
+ * actually reaches them. A state of the merged FSM is just a tuple containing
+ * one node from each separate FSM. These states are kept in a cache of fixed
+ * size, and when that fills up it is simply emptied, so that the memory used
+ * is bounded no matter how many symbols there are. Most of the game is made up
+ * of a handful of common states, so we should rarely have to build them. */
+
+#define FSM_LAZY_MIN_STATES 16
+ 
+typedef struct fsm_lazy_state_t {
+    /* NULL if the transition hasn't been built yet. */
+    struct fsm_lazy_state_t *transition[16];
+    struct fsm_lazy_state_t *hash_next;
+    unsigned int hash;
+    /* number of epsilon nodes passed through to reach this state. */
+    unsigned int match_count;
+    /* a node from each fsm, followed by the match_count epsilon nodes. */
+    const fsm_node_t *nodes[];
+} fsm_lazy_state_t;
+
+struct fsm_lazy_t {
+    fsm_t **fsms;
+    size_t fsm_count;
+    /* maximum number of epsilon nodes passed through in one transition. */
+    size_t match_max;
+    uint8_t *cache;
+    size_t cache_size;
+    size_t cache_used;
+    fsm_lazy_state_t **hash;
+    size_t hash_size;
+    const fsm_node_t **scratch;
+    /* incremented every time the cache is emptied. */
+    unsigned int flush_count;
+};
+
+static size_t FSM_LazyEpsilonMax(const fsm_t *fsm) {
+    fsm_node_t **nodes;
+    unsigned int i;
+    size_t result;
+    
+    assert(fsm);
+    
+    nodes = FSM_ListNodes(fsm);
+    if (nodes == NULL)
+        return SIZE_MAX;
+    
+    result = 0;
+    
+    for (i = 0; i < fsm->node_count; i++) {
+        const fsm_node_t *node;
+        size_t length;
+        
+        for (length = 0, node = nodes[i];
+             node->symbol != SYMBOL_NULL;
+             node = node->payload.next)
+            length++;
+        
+        if (length > result)
+            result = length;
+    }
+    
+    free(nodes);
+    
+    return result;
+}
+
+fsm_lazy_t *FSM_LazyCreate(fsm_t **fsms, size_t fsm_count, size_t cache_size) {
+    fsm_lazy_t *lazy = NULL;
+    size_t i, state_size;
+    
+    assert(fsms != NULL);
+    assert(fsm_count > 0);
+    
+    lazy = calloc(1, sizeof(fsm_lazy_t));
+    if (lazy == NULL)
+        goto exit_error;
+    
+    lazy->fsm_count = fsm_count;
+    lazy->match_max = 0;
+    
+    for (i = 0; i < fsm_count; i++) {
+        size_t epsilon_max;
+        
+        assert(fsms[i] != NULL);
+        assert(fsms[i]->table == NULL);
+        
+        epsilon_max = FSM_LazyEpsilonMax(fsms[i]);
+        if (epsilon_max == SIZE_MAX)
+            goto exit_error;
+        
+        lazy->match_max += epsilon_max;
+    }
+    
+    state_size =
+        sizeof(fsm_lazy_state_t) +
+        (fsm_count + lazy->match_max) * sizeof(const fsm_node_t *);
+    
+    /* the cache must at least be able to hold a few of the largest states. */
+    if (cache_size < FSM_LAZY_MIN_STATES * state_size)
+        cache_size = FSM_LAZY_MIN_STATES * state_size;
+    
+    /* one hash bucket for every state that could fit, as a power of two. */
+    lazy->hash_size = 1;
+    while (lazy->hash_size < cache_size / state_size)
+        lazy->hash_size <<= 1;
+    
+    lazy->fsms = malloc(fsm_count * sizeof(fsm_t *));
+    lazy->cache = malloc(cache_size);
+    lazy->hash = calloc(lazy->hash_size, sizeof(fsm_lazy_state_t *));
+    lazy->scratch =
+        malloc((fsm_count + lazy->match_max) * sizeof(const fsm_node_t *));
+    
+    if (lazy->fsms == NULL || lazy->cache == NULL ||
+        lazy->hash == NULL || lazy->scratch == NULL)
+        goto exit_error;
+    
+    memcpy(lazy->fsms, fsms, fsm_count * sizeof(fsm_t *));
+    lazy->cache_size = cache_size;
+    lazy->cache_used = 0;
+    lazy->flush_count = 0;
+    
+    return lazy;
+exit_error:
+    if (lazy != NULL) {
+        /* don't free the caller's FSMs if we fail. */
+        lazy->fsm_count = 0;
+        FSM_LazyFree(lazy);
+    }
+    
+    return NULL;
+}
+
+void FSM_LazyFree(fsm_lazy_t *lazy) {
+    size_t i;
+    
+    assert(lazy);
+    
+    for (i = 0; i < lazy->fsm_count; i++)
+        FSM_Free(lazy->fsms[i]);
+    
+    free(lazy->fsms);
+    free(lazy->cache);
+    free(lazy->hash);
+    free(lazy->scratch);
+    free(lazy);
+}
+
+/* Find or build the state whose nodes are in lazy->scratch. */
+static fsm_lazy_state_t *FSM_LazyState(
+        fsm_lazy_t *lazy, unsigned int match_count) {
+    fsm_lazy_state_t *state;
+    unsigned int hash;
+    size_t i, node_count, state_size;
+    
+    assert(lazy);
+    assert(match_count <= lazy->match_max);
+    
+    node_count = lazy->fsm_count + match_count;
+    
+    /* FNV-1a over the node indices. */
+    hash = 2166136261u;
+    for (i = 0; i < node_count; i++)
+        hash = (hash ^ lazy->scratch[i]->index) * 16777619u;
+    
+    for (state = lazy->hash[hash & (lazy->hash_size - 1)];
+         state != NULL;
+         state = state->hash_next) {
+        
+        if (state->hash == hash &&
+            state->match_count == match_count &&
+            memcmp(
+                state->nodes, lazy->scratch,
+                node_count * sizeof(const fsm_node_t *)) == 0)
+            return state;
+    }
+    
+    state_size =
+        sizeof(fsm_lazy_state_t) + node_count * sizeof(const fsm_node_t *);
+    /* keep the states pointer aligned. */
+    state_size += -state_size & (sizeof(void *) - 1);
+    
+    if (lazy->cache_used + state_size > lazy->cache_size) {
+        /* cache is full; throw it all away. */
+        memset(lazy->hash, 0, lazy->hash_size * sizeof(fsm_lazy_state_t *));
+        lazy->cache_used = 0;
+        lazy->flush_count++;
+    }
+    
+    assert(lazy->cache_used + state_size <= lazy->cache_size);
+    
+    state = (fsm_lazy_state_t *)(lazy->cache + lazy->cache_used);
+    lazy->cache_used += state_size;
+    
+    for (i = 0; i < 16; i++)
+        state->transition[i] = NULL;
+    state->hash = hash;
+    state->match_count = match_count;
+    memcpy(
+        state->nodes, lazy->scratch, node_count * sizeof(const fsm_node_t *));
+    state->hash_next = lazy->hash[hash & (lazy->hash_size - 1)];
+    lazy->hash[hash & (lazy->hash_size - 1)] = state;
+    
+    return state;
+}
+
+static fsm_lazy_state_t *FSM_LazyTransition(
+        fsm_lazy_t *lazy, fsm_lazy_state_t *state, unsigned int nibble) {
+    fsm_lazy_state_t *next;
+    unsigned int match_count, flush_count;
+    size_t i;
+    
+    assert(lazy);
+    assert(state);
+    assert(nibble < 16);
+    
+    match_count = 0;
+    
+    for (i = 0; i < lazy->fsm_count; i++) {
+        const fsm_node_t *node;
+        
+        assert(state->nodes[i]->symbol == SYMBOL_NULL);
+        
+        /* process transition, then any epsilons. */
+        for (node = state->nodes[i]->payload.transition[nibble];
+             node->symbol != SYMBOL_NULL;
+             node = node->payload.next) {
+            assert(match_count < lazy->match_max);
+            lazy->scratch[lazy->fsm_count + match_count++] = node;
+        }
+        
+        lazy->scratch[i] = node;
+    }
+    
+    flush_count = lazy->flush_count;
+    next = FSM_LazyState(lazy, match_count);
+    
+    /* if the cache was emptied, state no longer exists. */
+    if (flush_count == lazy->flush_count)
+        state->transition[nibble] = next;
+    
+    return next;
+}
+
+void FSM_LazyRun(
+        fsm_lazy_t *lazy, uint8_t *data,
+        size_t length, fsm_match_t match_fn) {
+    fsm_lazy_state_t *state, *next;
+    unsigned int j;
+    size_t i;
+    
+    assert(lazy != NULL);
+    assert(data != NULL);
+    assert(match_fn != NULL);
+    
+    for (i = 0; i < lazy->fsm_count; i++) {
+        assert(lazy->fsms[i]->initial->symbol == SYMBOL_NULL);
+        lazy->scratch[i] = lazy->fsms[i]->initial;
+    }
+    
+    state = FSM_LazyState(lazy, 0);
+    
+    for (i = 0; i < length; i++) {
+        assert(state != NULL);
+        
+        /* process epsilons */
+        for (j = 0; j < state->match_count; j++) {
+            const fsm_node_t *node;
+            
+            node = state->nodes[lazy->fsm_count + j];
+            match_fn(node->symbol, data + i - node->payload.offset);
+        }
+        
+        /* process transition */
+        next = state->transition[data[i] >> 4];
+        if (next == NULL) {
+            next = FSM_LazyTransition(lazy, state, data[i] >> 4);
+            assert(next != NULL);
+        }
+        state = next;
+        
+        assert(state->match_count == 0);
+        
+        next = state->transition[data[i] & 0xf];
+        if (next == NULL) {
+            next = FSM_LazyTransition(lazy, state, data[i] & 0xf);
+            assert(next != NULL);
+        }
+        state = next;
+    }
+    
+    /* process epsilons */
+    for (j = 0; j < state->match_count; j++) {
+        const fsm_node_t *node;
+        
+        node = state->nodes[lazy->fsm_count + j];
+        match_fn(node->symbol, data + i - node->payload.offset);
+    }
+}
@@ -28,12 +28,14 @@
 #ifndef FSM_H_
 #define FSM_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "symbol.h"
 
 typedef struct fsm_t fsm_t;
+typedef struct fsm_lazy_t fsm_lazy_t;
 
 /* function to run on a symbol match. */
 typedef void (*fsm_match_t)(symbol_index_t symbol, uint8_t *addr);
@@ -41,8 +43,21 @@ typedef void (*fsm_match_t)(symbol_index_t symbol, uint8_t *addr);
 fsm_t *FSM_Create(symbol_index_t symbol);
 fsm_t *FSM_Merge(const fsm_t *left, const fsm_t *right);
 void FSM_Free(fsm_t *fsm);
+/* The number of nodes in an FSM which hasn't been compacted. */
+size_t FSM_NodeCount(const fsm_t *fsm);
+/* Shrinks an FSM for searching. A compacted FSM can no longer be merged. */
+bool FSM_Compact(fsm_t *fsm);
 void FSM_Run(
     const fsm_t *fsm, uint8_t *data,
     size_t length, fsm_match_t match_fn);
 
+/* Lazily determinised union of several FSMs. On success, the lazy FSM takes
+ * ownership of the FSMs in fsms (but not of the array itself). At most
+ * cache_size bytes are used to cache states of the union. */
+fsm_lazy_t *FSM_LazyCreate(fsm_t **fsms, size_t fsm_count, size_t cache_size);
+void FSM_LazyFree(fsm_lazy_t *lazy);
+void FSM_LazyRun(
+    fsm_lazy_t *lazy, uint8_t *data,
+    size_t length, fsm_match_t match_fn);
+
 #endif /* FSM_H_ */
@@ -4,3 +4,4 @@ WD_LINKER := $(WD)
 SRC += $(WD)fsm.c
 SRC += $(WD)search.c
 SRC += $(WD)symbol.c
+SRC += $(WD)wumanber.c
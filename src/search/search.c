@@ -38,16 +38,21 @@
 #include "apploader/apploader.h"
 #include "library/dolphin_os.h"
 #include "library/event.h"
+#include "modules/module.h"
 #include "search/fsm.h"
 #include "search/symbol.h"
+#include "search/wumanber.h"
 #include "main.h"
 #include "threads.h"
 
 typedef struct {
     void *address;
     bool search_fail;
+    /* whether a module uses it, or it leads to one which is. */
+    bool needed;
 } search_symbol_global_t;
 typedef struct {
+    uint32_t hash;
     void *address;
     const char *name;
 } search_module_symbol_t;
@@ -68,19 +73,59 @@ bool search_has_error;
 bool search_has_info;
 
 static fsm_t *search_fsm = NULL;
+/* used instead of search_fsm if it would be too large. */
+static fsm_lazy_t *search_fsm_lazy = NULL;
+
+#define SEARCH_FSM_LAZY_CACHE_SIZE (256 * 1024)
+
+/* FSMs of at least this many nodes are compacted before the search. The
+ * compact form is under a third of the size, but on the host it scans
+ * less than half as fast, so by default it is only used for FSMs whose nodes
+ * would take several megabytes. */
+#ifndef SEARCH_FSM_COMPACT_NODES
+#define SEARCH_FSM_COMPACT_NODES 32768
+#endif
+
+typedef enum {
+    SEARCH_BACKEND_FSM,
+    SEARCH_BACKEND_WUMANBER,
+} search_backend_t;
+
+/* With SEARCH_BACKEND_WUMANBER, symbols which can be are found by a Wu-Manber
+ * search, which skips most of the game. The rest are still found by the FSM. */
+#ifndef SEARCH_BACKEND
+#define SEARCH_BACKEND SEARCH_BACKEND_WUMANBER
+#endif
+
+static search_backend_t search_backend = SEARCH_BACKEND;
+static wumanber_t *search_wumanber = NULL;
 
 static const char search_path[] = "sd:/bslug/symbols";
 
 static void *search_symbol__start;
 
+/* How many instructions Search_SmallDataBase looks at in each function. */
+#define SEARCH_SMALL_DATA_SCAN 64
+
 static void *Search_Main(void *arg);
 static void Search_SymbolsLoad(void);
 static void Search_CheckDirectory(char *path);
 static void Search_CheckFile(const char *path);
 static void Search_Load(const char *path);
 static bool Search_BuildFSM(void);
+static bool Search_BuildFSMLazy(void);
+static bool Search_BuildWuManber(void);
+static bool Search_SymbolInWuManber(const symbol_t *symbol);
+static bool Search_SymbolInFSM(const symbol_t *symbol);
+static void Search_SymbolsNeeded(bool all);
+static void Search_SymbolsNear(void);
+static bool Search_SymbolNear(const symbol_t *symbol);
 static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr);
 static int Search_ModuleSymbolCompare(const void *left, const void *right);
+static search_module_symbol_t *Search_ModuleSymbolFind(
+    const char *name, uint32_t hash);
+static void *Search_SmallDataBase(
+    const uint32_t *code, unsigned int reg, int depth);
 
 bool Search_Init(void) {
     return Event_Init(&search_event_complete);
@@ -103,22 +148,53 @@ bool Search_RunBackground(void) {
 }
 
 static void *Search_Main(void *arg) {
+    bool linked;
+    
+    /* the cached modules are already linked. */
+    Event_Wait(&module_event_cache_checked);
+    if (module_cache_hit) {
+        Event_Trigger(&search_event_complete);
+        return NULL;
+    }
+    
     Search_SymbolsLoad();
     
+    /* if the modules are still being read and linked, don't wait for them
+     * to say what they use: build the searches for every symbol meanwhile,
+     * as the loading would otherwise be added to the time to boot. */
+    linked = Event_Triggered(&module_event_linked);
+    
+    /* nothing will be linked, so there's nothing to find. */
+    if (linked && module_has_error) {
+        Event_Trigger(&search_event_complete);
+        return NULL;
+    }
+    
     if (symbol_count > 0) {
         symbol_index_t i;
         
-        if (!Search_BuildFSM())
-           goto exit_error;
-        
-        assert(search_fsm != NULL);
-        
         search_symbol_globals =
             malloc(symbol_count * sizeof(*search_symbol_globals));
+        if (search_symbol_globals == NULL)
+            goto exit_error;
         
         for (i = 0; i < symbol_count; i++) {
             search_symbol_globals[i].address = NULL;
             search_symbol_globals[i].search_fail = false;
+            search_symbol_globals[i].needed = false;
+        }
+        
+        Search_SymbolsNeeded(!linked);
+        
+        if (!Search_BuildWuManber())
+           goto exit_error;
+        if (!Search_BuildFSM())
+           goto exit_error;
+        
+        Event_Wait(&module_event_linked);
+        if (module_has_error) {
+            Event_Trigger(&search_event_complete);
+            return NULL;
         }
         
         Event_Wait(&apploader_event_complete);
@@ -127,14 +203,35 @@ static void *Search_Main(void *arg) {
             assert(apploader_app0_end != NULL);
             assert(apploader_app0_end >= apploader_app0_start);
             
-            FSM_Run(
-                search_fsm, apploader_app0_start,
-                apploader_app0_end - apploader_app0_start,
-                &Search_SymbolMatch);
+            if (search_wumanber != NULL)
+                WuManber_Run(
+                    search_wumanber, apploader_app0_start,
+                    apploader_app0_end - apploader_app0_start,
+                    &Search_SymbolMatch);
+            
+            if (search_fsm != NULL)
+                FSM_Run(
+                    search_fsm, apploader_app0_start,
+                    apploader_app0_end - apploader_app0_start,
+                    &Search_SymbolMatch);
+            else if (search_fsm_lazy != NULL)
+                FSM_LazyRun(
+                    search_fsm_lazy, apploader_app0_start,
+                    apploader_app0_end - apploader_app0_start,
+                    &Search_SymbolMatch);
+            
+            Search_SymbolsNear();
         }
         
-        FSM_Free(search_fsm);
+        if (search_fsm != NULL)
+            FSM_Free(search_fsm);
+        if (search_fsm_lazy != NULL)
+            FSM_LazyFree(search_fsm_lazy);
+        if (search_wumanber != NULL)
+            WuManber_Free(search_wumanber);
         search_fsm = NULL;
+        search_fsm_lazy = NULL;
+        search_wumanber = NULL;
     }
     
     Event_Trigger(&search_event_complete);
@@ -272,6 +369,9 @@ static bool Search_BuildFSM(void) {
     for (i = 0; i < symbol_count; i++) {
         fsm_t *fsm;
 
+        if (!Search_SymbolInFSM(Symbol_GetSymbolSize(i)))
+            continue;
+        
         fsm = FSM_Create(i);
         if (fsm == NULL)
             goto exit_error;
@@ -282,18 +382,29 @@ static bool Search_BuildFSM(void) {
             fsm_t *fsm_merge;
             
             fsm_merge = FSM_Merge(fsm_final, fsm);
+            FSM_Free(fsm);
+            
             if (fsm_merge == NULL) {
-                FSM_Free(fsm);
+                /* The merged FSM doesn't fit in memory, so instead build it as
+                 * the search goes along. */
+                FSM_Free(fsm_final);
+                fsm_final = NULL;
+                
+                result = Search_BuildFSMLazy();
                 goto exit_error;
             }
             
-            FSM_Free(fsm);
             FSM_Free(fsm_final);
             
             fsm_final = fsm_merge;
         }
     }
     
+    /* the compact form is much smaller, but is only an optimisation. */
+    if (fsm_final != NULL &&
+        FSM_NodeCount(fsm_final) >= SEARCH_FSM_COMPACT_NODES)
+        FSM_Compact(fsm_final);
+    
     /* store the final result and make sure we don't free it!! */
     search_fsm = fsm_final;
     fsm_final = NULL;
@@ -305,6 +416,244 @@ exit_error:
     return result;
 }
 
+static bool Search_BuildFSMLazy(void) {
+    bool result = false;
+    symbol_index_t i;
+    size_t fsm_count;
+    fsm_t **fsms;
+    
+    fsms = malloc(symbol_count * sizeof(fsm_t *));
+    if (fsms == NULL)
+        return false;
+    
+    fsm_count = 0;
+    
+    for (i = 0; i < symbol_count; i++) {
+        if (!Search_SymbolInFSM(Symbol_GetSymbolSize(i)))
+            continue;
+        
+        fsms[fsm_count] = FSM_Create(i);
+        if (fsms[fsm_count] == NULL)
+            goto exit_error;
+        fsm_count++;
+    }
+    
+    assert(fsm_count > 0);
+    
+    search_fsm_lazy = FSM_LazyCreate(
+        fsms, fsm_count, SEARCH_FSM_LAZY_CACHE_SIZE);
+    if (search_fsm_lazy == NULL)
+        goto exit_error;
+    
+    /* search_fsm_lazy now owns the FSMs. */
+    fsm_count = 0;
+    
+    result = true;
+exit_error:
+    while (fsm_count > 0)
+        FSM_Free(fsms[--fsm_count]);
+    free(fsms);
+    return result;
+}
+
+static bool Search_BuildWuManber(void) {
+    bool result = false;
+    symbol_index_t i;
+    size_t count;
+    symbol_index_t *symbols;
+    
+    if (search_backend != SEARCH_BACKEND_WUMANBER)
+        return true;
+    
+    symbols = malloc(symbol_count * sizeof(symbol_index_t));
+    if (symbols == NULL)
+        return false;
+    
+    count = 0;
+    
+    for (i = 0; i < symbol_count; i++) {
+        if (Search_SymbolInWuManber(Symbol_GetSymbolSize(i)))
+            symbols[count++] = i;
+    }
+    
+    if (count > 0) {
+        search_wumanber = WuManber_Create(symbols, count);
+        if (search_wumanber == NULL)
+            goto exit_error;
+    }
+    
+    result = true;
+exit_error:
+    free(symbols);
+    return result;
+}
+
+static bool Search_SymbolInWuManber(const symbol_t *symbol) {
+    if (search_backend != SEARCH_BACKEND_WUMANBER)
+        return false;
+    if (!search_symbol_globals[symbol->index].needed)
+        return false;
+    
+    return symbol->near == NULL && WuManber_SymbolEligible(symbol);
+}
+
+static bool Search_SymbolInFSM(const symbol_t *symbol) {
+    /* symbols with a near hint are found relative to another symbol once the
+     * search is complete, so shouldn't bloat the FSM. Patterns can only be
+     * found by the FSM. */
+    return search_symbol_globals[symbol->index].needed &&
+        (symbol->data_size > 0 || symbol->pattern != NULL) &&
+        symbol->near == NULL && !Search_SymbolInWuManber(symbol);
+}
+
+/* Marks the symbols worth searching for: those the modules use, those being
+ * debugged, and the anchors of any of them with a near hint. Most of the
+ * database is for functions no module uses, and leaving them out makes the
+ * searches smaller and quicker. If all, the modules aren't linked yet, so
+ * every symbol is marked. */
+static void Search_SymbolsNeeded(bool all) {
+    symbol_index_t i;
+    bool progress;
+    
+    for (i = 0; i < symbol_count; i++) {
+        const symbol_t *symbol;
+        
+        symbol = Symbol_GetSymbol(i);
+        search_symbol_globals[i].needed =
+            all || symbol->debugging || Module_SymbolNeeded(symbol->name);
+    }
+    
+    /* anchors may themselves have near hints. */
+    do {
+        progress = false;
+        
+        for (i = 0; i < symbol_count; i++) {
+            symbol_alphabetical_index_t symbol_global;
+            const symbol_t *symbol;
+            
+            symbol = Symbol_GetSymbol(i);
+            if (!search_symbol_globals[i].needed || symbol->near == NULL)
+                continue;
+            
+            for (symbol_global = Symbol_SearchSymbol(symbol->near);
+                 symbol_global != SYMBOL_NULL && symbol_global < symbol_count;
+                 symbol_global++) {
+                symbol_t *anchor = Symbol_GetSymbolAlphabetical(symbol_global);
+                
+                if (strcmp(anchor->name, symbol->near) != 0)
+                    break;
+                if (!search_symbol_globals[anchor->index].needed) {
+                    search_symbol_globals[anchor->index].needed = true;
+                    progress = true;
+                }
+            }
+        }
+    } while (progress);
+}
+
+static void Search_SymbolsNear(void) {
+    symbol_index_t i;
+    bool progress;
+    bool *done;
+    
+    done = calloc(symbol_count, sizeof(bool));
+    if (done == NULL)
+        return;
+    
+    /* Near symbols may themselves be relative to other near symbols, so keep
+     * going until nothing else can be found. */
+    do {
+        progress = false;
+        
+        for (i = 0; i < symbol_count; i++) {
+            const symbol_t *symbol;
+            
+            symbol = Symbol_GetSymbol(i);
+            if (symbol->near == NULL || done[i] ||
+                !search_symbol_globals[i].needed)
+                continue;
+            
+            if (Search_SymbolNear(symbol)) {
+                done[i] = true;
+                progress = true;
+            }
+        }
+    } while (progress);
+    
+    free(done);
+}
+
+static bool Search_SymbolNear(const symbol_t *symbol) {
+    symbol_alphabetical_index_t symbol_global;
+    
+    assert(symbol->near != NULL);
+    
+    /* can't search relative to an anchor that hasn't been found yet. */
+    for (symbol_global = Symbol_SearchSymbol(symbol->near);
+         symbol_global != SYMBOL_NULL && symbol_global < symbol_count;
+         symbol_global++) {
+         
+        symbol_t *anchor = Symbol_GetSymbolAlphabetical(symbol_global);
+        
+        if (strcmp(anchor->name, symbol->near) != 0)
+            break;
+        if (anchor->near != NULL &&
+            search_symbol_globals[anchor->index].address == NULL)
+            return false;
+    }
+    
+    for (symbol_global = Symbol_SearchSymbol(symbol->near);
+         symbol_global != SYMBOL_NULL && symbol_global < symbol_count;
+         symbol_global++) {
+         
+        symbol_t *anchor = Symbol_GetSymbolAlphabetical(symbol_global);
+        uint8_t *address, *address_end;
+        
+        if (strcmp(anchor->name, symbol->near) != 0)
+            break;
+        if (search_symbol_globals[anchor->index].address == NULL ||
+            search_symbol_globals[anchor->index].search_fail)
+            continue;
+        
+        address =
+            (uint8_t *)search_symbol_globals[anchor->index].address +
+            symbol->near_min;
+        address_end =
+            (uint8_t *)search_symbol_globals[anchor->index].address +
+            symbol->near_max;
+        
+        if (symbol->data_size == 0) {
+            /* no data means the symbol is at a fixed place. */
+            if (address == address_end)
+                Search_SymbolMatch(symbol->index, address);
+            continue;
+        }
+        
+        for (; address <= address_end; address++) {
+            const uint8_t *data;
+            size_t i;
+            
+            /* the data is offset from the symbol in the same way that the
+             * FSM would find it. */
+            data = address + symbol->offset - symbol->data_size;
+            
+            if (data < apploader_app0_start ||
+                data + symbol->data_size > apploader_app0_end)
+                continue;
+            
+            for (i = 0; i < symbol->data_size; i++)
+                if ((data[i] & symbol->mask[i]) !=
+                    (symbol->data[i] & symbol->mask[i]))
+                    break;
+            
+            if (i == symbol->data_size)
+                Search_SymbolMatch(symbol->index, address);
+        }
+    }
+    
+    return true;
+}
+
 static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr) {
     symbol_t *symbol_data;
     
@@ -312,6 +661,17 @@ static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr) {
     if (symbol_data == NULL)
         return;
     
+    /* the FSM only matched the anchor of a pattern; check all of it. */
+    if (symbol_data->pattern != NULL) {
+        uint8_t *start;
+        
+        start = addr + symbol_data->offset;
+        if (start < apploader_app0_start || start >= apploader_app0_end ||
+            !Symbol_PatternMatch(
+                symbol_data->pattern, start, apploader_app0_end - start))
+            return;
+    }
+    
     if (symbol_data->debugging) {
         printf("\t%p: found %s\n", addr, symbol_data->name);
         search_has_info = true;
@@ -337,7 +697,7 @@ static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr) {
     }
 }
 
-bool Search_SymbolAdd(const char *name, void *address) {
+bool Search_SymbolAdd(const char *name, uint32_t hash, void *address) {
     size_t index;
     
     assert(name != NULL);
@@ -374,6 +734,7 @@ bool Search_SymbolAdd(const char *name, void *address) {
     
     index = search_module_symbols_count++;
     
+    search_module_symbols[index].hash = hash;
     search_module_symbols[index].address = address;
     search_module_symbols[index].name = strdup(name);
     if (search_module_symbols[index].name == NULL) {
@@ -383,22 +744,31 @@ bool Search_SymbolAdd(const char *name, void *address) {
     
     return true;
 }
-bool Search_SymbolReplace(const char *name, void *address) {
+bool Search_SymbolReplace(const char *name, uint32_t hash, void *address) {
     symbol_alphabetical_index_t symbol_global;
     
+    search_module_symbol_t *symbol_module;
+    
     assert(name != NULL);
     
     if (strcmp(name, "_start") == 0) {
         search_symbol__start = address;
         return true;
     }
+    
+    /* a module's symbol hides the game's, so it is the one to change. */
+    symbol_module = Search_ModuleSymbolFind(name, hash);
+    if (symbol_module != NULL) {
+        symbol_module->address = address;
+        return true;
+    }
         
     /* The symbol search could in theory have multiple versions of a symbol,
      * for example if there are multiple versions of a method in the wild from
      * different versions of the library. Therefore, we can't just change the
      * value at Symbol_SearchSymbol, we must check the ones after it
      * sequentially too. */
-    for (symbol_global = Symbol_SearchSymbol(name);
+    for (symbol_global = Symbol_SearchSymbolHash(name, hash);
          symbol_global != SYMBOL_NULL && symbol_global < symbol_count;
          symbol_global++) {
          
@@ -420,26 +790,18 @@ bool Search_SymbolReplace(const char *name, void *address) {
     return true;
 }
 void *Search_SymbolLookup(const char *name) {
+    assert(name != NULL);
+    
+    return Search_SymbolLookupHash(name, Symbol_NameHash(name));
+}
+void *Search_SymbolLookupHash(const char *name, uint32_t hash) {
     symbol_alphabetical_index_t symbol_global;
-    search_module_symbol_t *symbol_module, key_module;
+    search_module_symbol_t *symbol_module;
     void *result;
     
     assert(name != NULL);
     
-    if (search_module_symbols_sorted != search_module_symbols_count) {
-        qsort(
-            search_module_symbols, search_module_symbols_count,
-            sizeof(*search_module_symbols), &Search_ModuleSymbolCompare);
-        search_module_symbols_sorted = search_module_symbols_count;
-    }
-    assert(search_module_symbols_sorted == search_module_symbols_count);
-    
-    key_module.name = name;
-    
-    symbol_module = bsearch(
-        &key_module, search_module_symbols, search_module_symbols_count,
-            sizeof(*search_module_symbols), &Search_ModuleSymbolCompare);
-            
+    symbol_module = Search_ModuleSymbolFind(name, hash);
     if (symbol_module != NULL)
         return symbol_module->address;
     
@@ -451,6 +813,12 @@ void *Search_SymbolLookup(const char *name) {
         return apploader_app0_start;
     } else if (strcmp(name, "bslug_game_end") == 0) {
         return apploader_app0_end;
+    } else if (strcmp(name, "_SDA_BASE_") == 0) {
+        return Search_SmallDataBase(
+            (const uint32_t *)apploader_game_entry_fn, 13, 1);
+    } else if (strcmp(name, "_SDA2_BASE_") == 0) {
+        return Search_SmallDataBase(
+            (const uint32_t *)apploader_game_entry_fn, 2, 1);
     }
     
     result = NULL;
@@ -461,7 +829,7 @@ void *Search_SymbolLookup(const char *name) {
      * value at Symbol_SearchSymbol, we must check the ones after it
      * sequentially too. If we have two symbols with the same name at different
      * addresses, we return NULL. */
-    for (symbol_global = Symbol_SearchSymbol(name);
+    for (symbol_global = Symbol_SearchSymbolHash(name, hash);
          symbol_global != SYMBOL_NULL && symbol_global < symbol_count;
          symbol_global++) {
          
@@ -492,8 +860,99 @@ void *Search_SymbolLookup(const char *name) {
     return result;
 }
 
+static search_module_symbol_t *Search_ModuleSymbolFind(
+        const char *name, uint32_t hash) {
+    search_module_symbol_t key_module;
+    
+    if (search_module_symbols_sorted != search_module_symbols_count) {
+        qsort(
+            search_module_symbols, search_module_symbols_count,
+            sizeof(*search_module_symbols), &Search_ModuleSymbolCompare);
+        search_module_symbols_sorted = search_module_symbols_count;
+    }
+    assert(search_module_symbols_sorted == search_module_symbols_count);
+    
+    key_module.hash = hash;
+    key_module.name = name;
+    
+    return bsearch(
+        &key_module, search_module_symbols, search_module_symbols_count,
+        sizeof(*search_module_symbols), &Search_ModuleSymbolCompare);
+}
+
+/* Orders by hash, so names are only compared when the hashes are equal. */
 static int Search_ModuleSymbolCompare(const void *left, const void *right) {
-    return strcmp(
-        ((const search_module_symbol_t *)left)->name,
-        ((const search_module_symbol_t *)right)->name);
+    const search_module_symbol_t *left_symbol, *right_symbol;
+    
+    left_symbol = (const search_module_symbol_t *)left;
+    right_symbol = (const search_module_symbol_t *)right;
+    
+    if (left_symbol->hash != right_symbol->hash)
+        return left_symbol->hash < right_symbol->hash ? -1 : 1;
+    return strcmp(left_symbol->name, right_symbol->name);
+}
+
+/* Finds the value the game gives register reg at start up. The EABI keeps
+ * r13 pointing into .sdata/.sbss and r2 into .sdata2/.sbss2 for the whole
+ * run; the SDK's __start calls __init_registers, which loads each with a lis
+ * and an ori. Functions called from code are searched up to depth deep. */
+static void *Search_SmallDataBase(
+        const uint32_t *code, unsigned int reg, int depth) {
+    uint32_t high = 0;
+    bool has_high = false;
+    size_t i;
+    
+    if ((const uint8_t *)code < apploader_app0_start ||
+        (const uint8_t *)code >= apploader_app0_end)
+        return NULL;
+    
+    for (i = 0;
+         i < SEARCH_SMALL_DATA_SCAN &&
+         (const uint8_t *)(code + i + 1) <= apploader_app0_end;
+         i++) {
+        uint32_t instruction = code[i];
+        unsigned int rd = (instruction >> 21) & 0x1f;
+        unsigned int ra = (instruction >> 16) & 0x1f;
+        
+        /* blr */
+        if (instruction == 0x4e800020)
+            break;
+        
+        switch (instruction >> 26) {
+            case 15: { /* lis */
+                if (rd == reg && ra == 0) {
+                    high = instruction << 16;
+                    has_high = true;
+                }
+                break;
+            } case 24: { /* ori */
+                if (has_high && rd == reg && ra == reg)
+                    return (void *)(high | (instruction & 0xffff));
+                break;
+            } case 14: { /* addi */
+                if (has_high && rd == reg && ra == reg)
+                    return (void *)(high + (int16_t)instruction);
+                break;
+            } case 18: { /* bl */
+                int32_t offset;
+                void *result;
+                
+                if ((instruction & 3) != 1 || depth <= 0)
+                    break;
+                
+                offset = instruction & 0x03fffffc;
+                if (offset & 0x02000000)
+                    offset -= 0x04000000;
+                
+                result = Search_SmallDataBase(
+                    (const uint32_t *)((const uint8_t *)(code + i) + offset),
+                    reg, depth - 1);
+                if (result != NULL)
+                    return result;
+                break;
+            }
+        }
+    }
+    
+    return NULL;
 }
\ No newline at end of file
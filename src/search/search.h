@@ -29,6 +29,7 @@
 #define SEARCH_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "library/event.h"
 
@@ -40,8 +41,10 @@ extern bool search_has_info;
 bool Search_Init(void);
 bool Search_RunBackground(void);
 
-bool Search_SymbolAdd(const char *name, void *address);
-bool Search_SymbolReplace(const char *name, void *address);
+/* hash is Symbol_NameHash(name), which callers often already have. */
+bool Search_SymbolAdd(const char *name, uint32_t hash, void *address);
+bool Search_SymbolReplace(const char *name, uint32_t hash, void *address);
 void *Search_SymbolLookup(const char *name);
+void *Search_SymbolLookupHash(const char *name, uint32_t hash);
 
 #endif /* SEARCH_H_ */
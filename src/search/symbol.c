@@ -28,6 +28,7 @@
 #include "symbol.h"
 
 #include <assert.h>
+#include <bslug_include/bslug.h>
 #include <elfdefinitions.h>
 #include <mxml.h>
 #include <stdbool.h>
@@ -41,7 +42,10 @@ typedef struct {
     symbol_index_t index;
 } symbol_size_index_entry_t;
 
+/* The "alphabetical" index is in order of Symbol_NameHash and then name, so
+ * that most lookups compare only hashes. Equal names are still adjacent. */
 typedef struct {
+    uint32_t hash;
     const char *name;
     symbol_index_t index;
 } symbol_alphabetical_index_entry_t;
@@ -69,6 +73,9 @@ const struct {
     
 #define SYMBOL_LIST_INITIAL_CAPACITY 128
 
+/* longest gap allowed in a pattern. */
+#define SYMBOL_PATTERN_GAP_MAX 0x1000
+
 symbol_index_t symbol_count = 0;
 
 static symbol_t *symbol_globals = NULL;
@@ -82,6 +89,9 @@ static symbol_t *Symbol_AllocSymbol(const char *name, size_t name_length);
 static symbol_relocation_t *Symbol_AddRelocation(
     symbol_t *symbol, const char *target,
     unsigned char type, size_t offset);
+static bool Symbol_DataIsPattern(mxml_node_t *xml_data);
+static bool Symbol_ParsePattern(
+    symbol_t *symbol, mxml_node_t *xml_data, uint8_t **data, uint8_t **mask);
 static int Symbol_CompareSize(const void *left_ptr, const void *right_ptr);
 static int Symbol_CompareName(const void *left_ptr, const void *right_ptr);
 
@@ -114,7 +124,7 @@ bool Symbol_ParseFile(FILE *file) {
         xml_symbols, xml_symbols, "symbol", NULL, NULL, MXML_DESCEND_FIRST);
     while (xml_symbol != NULL) {
         const char *name, *size_str, *offset_str;
-        mxml_node_t *xml_data = NULL, *xml_reloc = NULL;
+        mxml_node_t *xml_data = NULL, *xml_reloc = NULL, *xml_near = NULL;
         symbol_t *symbol;
         uint8_t *data, *mask;
 
@@ -150,7 +160,10 @@ bool Symbol_ParseFile(FILE *file) {
         /* <data>FF</data> */
         xml_data = mxmlFindElement(
             xml_symbol, xml_symbol, "data", NULL, NULL, MXML_DESCEND_FIRST);
-        if (xml_data != NULL) {
+        if (xml_data != NULL && Symbol_DataIsPattern(xml_data)) {
+            if (!Symbol_ParsePattern(symbol, xml_data, &data, &mask))
+                goto next_symbol;
+        } else if (xml_data != NULL) {
             mxml_node_t *xml_value;
             size_t data_size;
             unsigned int i;
@@ -247,6 +260,36 @@ bool Symbol_ParseFile(FILE *file) {
             symbol->data_size = 0;
         }
 
+        /* <near symbol="" min="" max="" /> */
+        xml_near = mxmlFindElement(
+            xml_symbol, xml_symbol, "near", NULL, NULL, MXML_DESCEND_FIRST);
+        if (xml_near != NULL) {
+            const char *near_str, *min_str, *max_str;
+            char *near_alloc;
+            
+            near_str = mxmlElementGetAttr(xml_near, "symbol");
+            min_str = mxmlElementGetAttr(xml_near, "min");
+            max_str = mxmlElementGetAttr(xml_near, "max");
+            
+            if (near_str == NULL || min_str == NULL || max_str == NULL)
+                goto next_symbol;
+            if (sscanf(min_str, "%i", &symbol->near_min) != 1 ||
+                sscanf(max_str, "%i", &symbol->near_max) != 1)
+                goto next_symbol;
+            if (symbol->near_min > symbol->near_max)
+                goto next_symbol;
+            /* near symbols are compared directly, so need plain data. */
+            if (symbol->pattern != NULL)
+                goto next_symbol;
+            
+            near_alloc = malloc(strlen(near_str) + 1);
+            if (near_alloc == NULL)
+                goto exit_error;
+            
+            strcpy(near_alloc, near_str);
+            symbol->near = near_alloc;
+        }
+
         /* <reloc type="" offset="" symbol="" /> */
         xml_reloc = mxmlFindElement(
             xml_symbol, xml_symbol, "reloc", NULL, NULL, MXML_DESCEND_FIRST);
@@ -283,10 +326,11 @@ bool Symbol_ParseFile(FILE *file) {
             if (offset + 4 > symbol->size)
                 goto next_reloc;
             if (offset >= symbol->offset && mask != NULL) {
-                mask[offset - symbol->offset + 0] &= relocation_mask[0];
-                mask[offset - symbol->offset + 1] &= relocation_mask[1];
-                mask[offset - symbol->offset + 2] &= relocation_mask[2];
-                mask[offset - symbol->offset + 3] &= relocation_mask[3];
+                /* the relocation may run past the end of the data. */
+                for (i = 0; i < 4; i++)
+                    if (offset - symbol->offset + i < symbol->data_size)
+                        mask[offset - symbol->offset + i] &=
+                            relocation_mask[i];
             }
 
             if (symbol_str != NULL) {
@@ -393,6 +437,13 @@ static symbol_t *Symbol_AllocSymbol(const char *name, size_t name_length) {
         strncpy(name_alloc, name, name_length + 1);
         symbol->name = name_alloc;
         symbol->relocation = NULL;
+        symbol->data = NULL;
+        symbol->mask = NULL;
+        symbol->data_size = 0;
+        symbol->pattern = NULL;
+        symbol->near = NULL;
+        symbol->near_min = 0;
+        symbol->near_max = 0;
         symbol->index = symbol - symbol_globals;
         symbol->debugging = false;
     } else {
@@ -430,6 +481,328 @@ static symbol_relocation_t *Symbol_AddRelocation(
     return relocation;
 }
 
+static bool Symbol_DataIsPattern(mxml_node_t *xml_data) {
+    mxml_node_t *xml_value;
+    
+    xml_value = mxmlGetFirstChild(xml_data);
+    while (xml_value != NULL &&
+           mxmlGetType(xml_value) == MXML_TEXT &&
+           mxmlGetText(xml_value, 0) != NULL) {
+        if (strpbrk(mxmlGetText(xml_value, 0), "[({") != NULL)
+            return true;
+        xml_value = mxmlGetNextSibling(xml_value);
+    }
+    
+    return false;
+}
+
+static symbol_pattern_element_t *Symbol_PatternAppend(
+        symbol_pattern_t **pattern, size_t *capacity) {
+    symbol_pattern_element_t *element;
+    
+    if ((*pattern)->element_count == *capacity) {
+        symbol_pattern_t *tmp;
+        
+        tmp = realloc(
+            *pattern, sizeof(symbol_pattern_t) +
+            *capacity * 2 * sizeof(symbol_pattern_element_t));
+        if (tmp == NULL)
+            return NULL;
+        
+        *pattern = tmp;
+        *capacity *= 2;
+    }
+    
+    element = &(*pattern)->elements[(*pattern)->element_count++];
+    element->gap_min = 0;
+    element->gap_max = 0;
+    memset(element->accept, 0, sizeof(element->accept));
+    
+    return element;
+}
+
+/* Returns the set of nibbles a hex digit or ? allows, or 0 if c is neither. */
+static uint16_t Symbol_PatternNibble(char c) {
+    if (c >= '0' && c <= '9')
+        return 1 << (c - '0');
+    if (c >= 'a' && c <= 'f')
+        return 1 << (c - 'a' + 10);
+    if (c >= 'A' && c <= 'F')
+        return 1 << (c - 'A' + 10);
+    if (c == '?')
+        return 0xffff;
+    return 0;
+}
+
+/* Adds the bytes made of any high nibble in high and low nibble in low. */
+static void Symbol_PatternAccept(
+        symbol_pattern_element_t *element, uint16_t high, uint16_t low) {
+    unsigned int i, j;
+    
+    for (i = 0; i < 16; i++)
+        if (high & (1 << i))
+            for (j = 0; j < 16; j++)
+                if (low & (1 << j))
+                    element->accept[i / 2] |= 1u << ((i % 2) * 16 + j);
+}
+
+/* Finds data and mask which allow exactly the bytes in accept, if possible. */
+static bool Symbol_PatternMask(
+        const uint32_t accept[8], uint8_t *data, uint8_t *mask) {
+    unsigned int i, count, all_and, all_or;
+    
+    count = 0;
+    all_and = 0xff;
+    all_or = 0x00;
+    
+    for (i = 0; i < 256; i++) {
+        if (accept[i / 32] & (1u << (i % 32))) {
+            count++;
+            all_and &= i;
+            all_or |= i;
+        }
+    }
+    
+    /* the bits which are the same in every byte are the mask. */
+    *mask = ~(all_and ^ all_or);
+    *data = all_and & *mask;
+    
+    for (i = 0; i < 256; i++)
+        if (((i & *mask) == *data) != ((accept[i / 32] >> (i % 32)) & 1))
+            return false;
+    
+    return count > 0;
+}
+
+/* Parses <data> that has bit masks in [], alternatives in () or gaps in {}.
+ * If the result can still be expressed as data and a mask it is stored that
+ * way, so that the symbol can use the faster searches. */
+static bool Symbol_ParsePattern(
+        symbol_t *symbol, mxml_node_t *xml_data,
+        uint8_t **data_out, uint8_t **mask_out) {
+    bool result = false, half, simple;
+    mxml_node_t *xml_value;
+    symbol_pattern_t *pattern = NULL;
+    symbol_pattern_element_t *element;
+    char *text = NULL, *c;
+    size_t text_size, capacity, variants, i;
+    uint16_t high;
+    uint8_t *data;
+    
+    /* join up the text, without the white space. */
+    text_size = 0;
+    xml_value = mxmlGetFirstChild(xml_data);
+    while (xml_value != NULL &&
+           mxmlGetType(xml_value) == MXML_TEXT &&
+           mxmlGetText(xml_value, 0) != NULL) {
+        text_size += strlen(mxmlGetText(xml_value, 0));
+        xml_value = mxmlGetNextSibling(xml_value);
+    }
+    
+    text = malloc(text_size + 1);
+    capacity = 16;
+    pattern = malloc(
+        sizeof(symbol_pattern_t) + capacity * sizeof(symbol_pattern_element_t));
+    if (text == NULL || pattern == NULL)
+        goto exit_error;
+    
+    c = text;
+    xml_value = mxmlGetFirstChild(xml_data);
+    while (xml_value != NULL &&
+           mxmlGetType(xml_value) == MXML_TEXT &&
+           mxmlGetText(xml_value, 0) != NULL) {
+        const char *value;
+        
+        for (value = mxmlGetText(xml_value, 0); *value != '\0'; value++)
+            if (strchr(" \t\r\n", *value) == NULL)
+                *c++ = *value;
+        xml_value = mxmlGetNextSibling(xml_value);
+    }
+    *c = '\0';
+    
+    pattern->element_count = 0;
+    half = false;
+    high = 0;
+    variants = 1;
+    
+    for (c = text; *c != '\0'; ) {
+        uint16_t nibbles[16];
+        size_t nibble_count;
+        
+        nibble_count = 0;
+        
+        if (*c == '[') {
+            /* [0111????] one bit per character, four per nibble. */
+            for (c++; *c != ']'; ) {
+                unsigned int bit, j;
+                
+                if (nibble_count == 16)
+                    goto exit_error;
+                
+                nibbles[nibble_count] = 0xffff;
+                for (bit = 0; bit < 4; bit++, c++) {
+                    if (*c != '0' && *c != '1' && *c != '?')
+                        goto exit_error;
+                    
+                    for (j = 0; j < 16; j++)
+                        if (*c != '?' && ((j >> (3 - bit)) & 1) != *c - '0')
+                            nibbles[nibble_count] &= ~(1 << j);
+                }
+                nibble_count++;
+            }
+            c++;
+            
+            if (nibble_count == 0)
+                goto exit_error;
+        } else if (*c == '(') {
+            /* (3|7) a nibble, or (38|3c) a byte, from the alternatives. */
+            uint16_t alternative[2];
+            size_t length;
+            
+            element = NULL;
+            length = 0;
+            
+            for (c++; ; c++) {
+                size_t j;
+                
+                for (j = 0; Symbol_PatternNibble(c[j]) != 0; j++) {
+                    if (j == 2)
+                        goto exit_error;
+                    alternative[j] = Symbol_PatternNibble(c[j]);
+                }
+                
+                if (j == 0 || (length != 0 && j != length))
+                    goto exit_error;
+                length = j;
+                c += j;
+                
+                if (length == 1) {
+                    if (nibble_count == 0)
+                        nibbles[nibble_count++] = 0;
+                    nibbles[0] |= alternative[0];
+                } else {
+                    if (half)
+                        goto exit_error;
+                    if (element == NULL) {
+                        element = Symbol_PatternAppend(&pattern, &capacity);
+                        if (element == NULL)
+                            goto exit_error;
+                    }
+                    Symbol_PatternAccept(
+                        element, alternative[0], alternative[1]);
+                }
+                
+                if (*c == ')')
+                    break;
+                if (*c != '|')
+                    goto exit_error;
+            }
+            c++;
+        } else if (*c == '{') {
+            /* {n,m} or {n} bytes of anything. */
+            unsigned long gap_min, gap_max;
+            
+            if (half)
+                goto exit_error;
+            
+            gap_min = strtoul(c + 1, &c, 10);
+            if (*c == ',')
+                gap_max = strtoul(c + 1, &c, 10);
+            else
+                gap_max = gap_min;
+            if (*c != '}' || gap_min > gap_max || gap_max == 0 ||
+                gap_max > SYMBOL_PATTERN_GAP_MAX)
+                goto exit_error;
+            c++;
+            
+            if (gap_min == gap_max) {
+                for (i = 0; i < gap_min; i++) {
+                    element = Symbol_PatternAppend(&pattern, &capacity);
+                    if (element == NULL)
+                        goto exit_error;
+                    Symbol_PatternAccept(element, 0xffff, 0xffff);
+                }
+            } else {
+                variants *= gap_max - gap_min + 1;
+                if (variants > SYMBOL_PATTERN_VARIANTS_MAX)
+                    goto exit_error;
+                
+                element = Symbol_PatternAppend(&pattern, &capacity);
+                if (element == NULL)
+                    goto exit_error;
+                element->gap_min = gap_min;
+                element->gap_max = gap_max;
+            }
+        } else {
+            nibbles[0] = Symbol_PatternNibble(*c);
+            if (nibbles[0] == 0)
+                goto exit_error;
+            nibble_count = 1;
+            c++;
+        }
+        
+        for (i = 0; i < nibble_count; i++) {
+            if (!half) {
+                high = nibbles[i];
+            } else {
+                element = Symbol_PatternAppend(&pattern, &capacity);
+                if (element == NULL)
+                    goto exit_error;
+                Symbol_PatternAccept(element, high, nibbles[i]);
+            }
+            half = !half;
+        }
+    }
+    
+    /* must be whole bytes, and not start or end with a gap. */
+    if (half || pattern->element_count == 0)
+        goto exit_error;
+    if (pattern->elements[0].gap_max != 0 ||
+        pattern->elements[pattern->element_count - 1].gap_max != 0)
+        goto exit_error;
+    
+    simple = true;
+    for (i = 0; i < pattern->element_count; i++) {
+        uint8_t byte_data, byte_mask;
+        
+        if (pattern->elements[i].gap_max != 0 ||
+            !Symbol_PatternMask(
+                pattern->elements[i].accept, &byte_data, &byte_mask)) {
+            simple = false;
+            break;
+        }
+    }
+    
+    if (simple) {
+        data = malloc(pattern->element_count * 2);
+        if (data == NULL)
+            goto exit_error;
+        
+        symbol->data = *data_out = data;
+        symbol->mask = *mask_out = data + pattern->element_count;
+        symbol->data_size = pattern->element_count;
+        
+        for (i = 0; i < pattern->element_count; i++)
+            Symbol_PatternMask(
+                pattern->elements[i].accept, &(*data_out)[i], &(*mask_out)[i]);
+    } else {
+        symbol->pattern = pattern;
+        symbol->data = *data_out = NULL;
+        symbol->mask = *mask_out = NULL;
+        symbol->data_size = 0;
+        pattern = NULL;
+    }
+    
+    result = true;
+exit_error:
+    if (text != NULL)
+        free(text);
+    if (pattern != NULL)
+        free(pattern);
+    
+    return result;
+}
+
 static int Symbol_CompareSize(const void *left_ptr, const void *right_ptr) {
     const symbol_size_index_entry_t *left, *right;
     
@@ -445,7 +818,9 @@ static int Symbol_CompareName(const void *left_ptr, const void *right_ptr) {
     left = (const symbol_alphabetical_index_entry_t *)left_ptr;
     right = (const symbol_alphabetical_index_entry_t *)right_ptr;
     
-    if (left->name == NULL && right->name == NULL)
+    if (left->hash != right->hash)
+        return left->hash < right->hash ? -1 : 1;
+    else if (left->name == NULL && right->name == NULL)
         return 0;
     else if (left->name == NULL)
         return -1;
@@ -456,6 +831,13 @@ static int Symbol_CompareName(const void *left_ptr, const void *right_ptr) {
 }
 
 symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name) {
+    assert(name != NULL);
+    
+    return Symbol_SearchSymbolHash(name, Symbol_NameHash(name));
+}
+
+symbol_alphabetical_index_t Symbol_SearchSymbolHash(
+        const char *name, uint32_t hash) {
     symbol_alphabetical_index_entry_t ref, *index_ptr;
     
     assert(name != NULL);
@@ -474,7 +856,11 @@ symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name) {
             return SYMBOL_NULL;
             
         for (i = 0; i < symbol_count; i++) {
-            symbol_alphabetical_index[i].name = Symbol_GetSymbol(i)->name;
+            const char *symbol_name = Symbol_GetSymbol(i)->name;
+            
+            symbol_alphabetical_index[i].hash =
+                symbol_name == NULL ? 0 : Symbol_NameHash(symbol_name);
+            symbol_alphabetical_index[i].name = symbol_name;
             symbol_alphabetical_index[i].index = i;
         }
             
@@ -485,6 +871,7 @@ symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name) {
     
     assert(symbol_alphabetical_index != NULL);
     
+    ref.hash = hash;
     ref.name = name;
     
     index_ptr = bsearch(
@@ -500,6 +887,8 @@ symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name) {
         index = index_ptr - symbol_alphabetical_index;
         
         while (index > 0 &&
+               symbol_alphabetical_index[index - 1].hash == hash &&
+               symbol_alphabetical_index[index - 1].name != NULL &&
                strcmp(symbol_alphabetical_index[index - 1].name, name) == 0)
             index--;
             
@@ -507,6 +896,60 @@ symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name) {
     }
 }
 
+static bool Symbol_PatternMatchFrom(
+        const symbol_pattern_t *pattern, size_t element_index,
+        const uint8_t *data, size_t length) {
+    for (; element_index < pattern->element_count; element_index++) {
+        const symbol_pattern_element_t *element;
+        
+        element = &pattern->elements[element_index];
+        
+        if (element->gap_max != 0) {
+            size_t gap;
+            
+            /* at most SYMBOL_PATTERN_VARIANTS_MAX ways, so this is short. */
+            for (gap = element->gap_min;
+                 gap <= element->gap_max && gap <= length;
+                 gap++) {
+                if (Symbol_PatternMatchFrom(
+                        pattern, element_index + 1, data + gap, length - gap))
+                    return true;
+            }
+            return false;
+        }
+        
+        if (length == 0 ||
+            !((element->accept[*data / 32] >> (*data % 32)) & 1))
+            return false;
+        data++;
+        length--;
+    }
+    
+    return true;
+}
+
+bool Symbol_PatternMatch(
+        const symbol_pattern_t *pattern, const uint8_t *data, size_t length) {
+    assert(pattern != NULL);
+    
+    return Symbol_PatternMatchFrom(pattern, 0, data, length);
+}
+
+/* Must match BSLUG_NAME_HASH in bslug.h, which modules use for literals. */
+uint32_t Symbol_NameHash(const char *name) {
+    uint32_t hash;
+    size_t length, i;
+    
+    assert(name != NULL);
+    
+    length = strlen(name);
+    hash = (2166136261u ^ (length & 0xff)) * 16777619u;
+    for (i = 0; i < BSLUG_NAME_HASH_LENGTH; i++)
+        hash = (hash ^ (i < length ? (uint8_t)name[i] : 0)) * 16777619u;
+    
+    return hash >> 8;
+}
+
 symbol_t *Symbol_GetSymbolAlphabetical(symbol_alphabetical_index_t index) {
     assert(symbol_globals != NULL);
     assert(symbol_alphabetical_index != NULL);
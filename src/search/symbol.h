@@ -43,6 +43,25 @@ typedef struct symbol_relocation_t {
     const struct symbol_relocation_t *next;
 } symbol_relocation_t;
 
+/* One byte of a pattern, or a gap between gap_min and gap_max bytes of
+ * anything if gap_max is not 0. */
+typedef struct {
+    size_t gap_min;
+    size_t gap_max;
+    /* bit n % 32 of accept[n / 32] is set if byte n is allowed. */
+    uint32_t accept[8];
+} symbol_pattern_element_t;
+
+/* most combinations of gap lengths allowed in one pattern, which bounds the
+ * work of Symbol_PatternMatch. */
+#define SYMBOL_PATTERN_VARIANTS_MAX 64
+
+/* Data using the extended syntax; see symbols/README. */
+typedef struct {
+    size_t element_count;
+    symbol_pattern_element_t elements[];
+} symbol_pattern_t;
+
 typedef struct {
     symbol_index_t index;
     const char *name;
@@ -51,8 +70,16 @@ typedef struct {
     const uint8_t *data;
     const uint8_t *mask;
     size_t data_size;
+    /* if not NULL, the data couldn't be expressed with just a mask, so data
+     * and mask are NULL and this is used instead. */
+    const symbol_pattern_t *pattern;
     bool debugging;
     const symbol_relocation_t *relocation;
+    /* if not NULL, the symbol is found between near_min and near_max bytes
+     * from this symbol, rather than by searching the whole game. */
+    const char *near;
+    int near_min;
+    int near_max;
 } symbol_t;
 
 #define SYMBOL_NULL ((symbol_index_t)0xffffffff)
@@ -63,6 +90,13 @@ symbol_t *Symbol_GetSymbol(symbol_index_t index);
 symbol_t *Symbol_GetSymbolSize(symbol_index_t index);
 symbol_t *Symbol_GetSymbolAlphabetical(symbol_alphabetical_index_t index);
 symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name);
+symbol_alphabetical_index_t Symbol_SearchSymbolHash(
+    const char *name, uint32_t hash);
+uint32_t Symbol_NameHash(const char *name);
+/* Whether pattern matches the start of the length bytes at data, with any
+ * lengths of its gaps. */
+bool Symbol_PatternMatch(
+    const symbol_pattern_t *pattern, const uint8_t *data, size_t length);
 bool Symbol_ParseFile(FILE *file);
 
 #endif /* SYMBOL_H_ */
@@ -0,0 +1,284 @@
+/* wumanber.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+ 
+#include "wumanber.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The search looks at a window of data at a time, and hashes the block at its
+ * end. If that block doesn't appear anywhere in any symbol's window, the
+ * window can jump forwards past it. If it can only appear further back in a
+ * window, it jumps just far enough to line the two up. Otherwise the block
+ * ends the window of some symbols, which are compared against the data. */
+
+/* bytes hashed at a time. WuManber_Hash assumes 3. */
+#define WUMANBER_BLOCK 3
+#define WUMANBER_HASH_BITS 12
+#define WUMANBER_HASH_SIZE (1 << WUMANBER_HASH_BITS)
+/* windows shorter than this would hardly skip anything. */
+#define WUMANBER_WINDOW_MIN 8
+/* windows longer than this would not fit the shift table. */
+#define WUMANBER_WINDOW_MAX 32
+
+typedef struct {
+    symbol_index_t symbol;
+    const uint8_t *data;
+    const uint8_t *mask;
+    size_t data_size;
+    /* start of the window within data. */
+    size_t anchor;
+} wumanber_pattern_t;
+
+struct wumanber_t {
+    size_t window;
+    /* how far the window can move on given the hash of its last block. */
+    uint8_t shift[WUMANBER_HASH_SIZE];
+    /* patterns whose window ends with a block of hash h are at indices
+     * candidate[h] to candidate[h + 1] - 1. */
+    uint32_t candidate[WUMANBER_HASH_SIZE + 1];
+    wumanber_pattern_t *patterns;
+    size_t pattern_count;
+};
+
+static inline unsigned int WuManber_Hash(const uint8_t *block) {
+    uint32_t value;
+    
+    value =
+        ((uint32_t)block[0] << 16) | ((uint32_t)block[1] << 8) | block[2];
+    
+    return (value * 2654435761u) >> (32 - WUMANBER_HASH_BITS);
+}
+
+/* Finds the longest run of unmasked bytes in a symbol. Returns its length, and
+ * stores the index just after it in end. */
+static size_t WuManber_LongestRun(const symbol_t *symbol, size_t *end) {
+    size_t i, run, best;
+    
+    run = 0;
+    best = 0;
+    *end = 0;
+    
+    for (i = 0; i < symbol->data_size; i++) {
+        if (symbol->mask[i] == 0xff)
+            run++;
+        else
+            run = 0;
+        
+        if (run > best) {
+            best = run;
+            *end = i + 1;
+        }
+    }
+    
+    return best;
+}
+
+bool WuManber_SymbolEligible(const symbol_t *symbol) {
+    size_t end;
+    
+    assert(symbol != NULL);
+    
+    if (symbol->data_size == 0)
+        return false;
+    
+    return WuManber_LongestRun(symbol, &end) >= WUMANBER_WINDOW_MIN;
+}
+
+wumanber_t *WuManber_Create(const symbol_index_t *symbols, size_t count) {
+    wumanber_t *wm = NULL;
+    wumanber_pattern_t *patterns = NULL;
+    size_t *run_end = NULL;
+    size_t i, j;
+    
+    assert(symbols != NULL);
+    assert(count > 0);
+    
+    wm = malloc(sizeof(wumanber_t));
+    patterns = malloc(count * sizeof(wumanber_pattern_t));
+    run_end = malloc(count * sizeof(size_t));
+    
+    if (wm == NULL || patterns == NULL || run_end == NULL)
+        goto exit_error;
+    
+    wm->window = WUMANBER_WINDOW_MAX;
+    
+    for (i = 0; i < count; i++) {
+        const symbol_t *symbol;
+        size_t run;
+        
+        symbol = Symbol_GetSymbolSize(symbols[i]);
+        assert(symbol != NULL);
+        
+        run = WuManber_LongestRun(symbol, &run_end[i]);
+        assert(run >= WUMANBER_WINDOW_MIN);
+        
+        if (run < wm->window)
+            wm->window = run;
+    }
+    
+    /* every window is the same length, so it's the end of each run. */
+    for (i = 0; i < WUMANBER_HASH_SIZE; i++)
+        wm->shift[i] = wm->window - WUMANBER_BLOCK + 1;
+    for (i = 0; i <= WUMANBER_HASH_SIZE; i++)
+        wm->candidate[i] = 0;
+    
+    for (i = 0; i < count; i++) {
+        const symbol_t *symbol;
+        const uint8_t *window;
+        
+        symbol = Symbol_GetSymbolSize(symbols[i]);
+        window = symbol->data + run_end[i] - wm->window;
+        
+        for (j = 0; j + WUMANBER_BLOCK <= wm->window; j++) {
+            unsigned int hash, shift;
+            
+            hash = WuManber_Hash(window + j);
+            shift = wm->window - WUMANBER_BLOCK - j;
+            
+            if (shift < wm->shift[hash])
+                wm->shift[hash] = shift;
+        }
+        
+        /* count the candidates for each hash, shifted by one so the prefix
+         * sum below gives the start of each list. */
+        wm->candidate[
+            WuManber_Hash(window + wm->window - WUMANBER_BLOCK) + 1]++;
+    }
+    
+    for (i = 0; i < WUMANBER_HASH_SIZE; i++)
+        wm->candidate[i + 1] += wm->candidate[i];
+    
+    for (i = 0; i < count; i++) {
+        const symbol_t *symbol;
+        unsigned int hash;
+        wumanber_pattern_t *pattern;
+        
+        symbol = Symbol_GetSymbolSize(symbols[i]);
+        hash = WuManber_Hash(symbol->data + run_end[i] - WUMANBER_BLOCK);
+        
+        /* candidate[hash] is used as the next free slot, so afterwards it
+         * holds the end of the list, which is the next list's start. */
+        pattern = &patterns[wm->candidate[hash]++];
+        pattern->symbol = symbol->index;
+        pattern->data = symbol->data;
+        pattern->mask = symbol->mask;
+        pattern->data_size = symbol->data_size;
+        pattern->anchor = run_end[i] - wm->window;
+    }
+    
+    for (i = WUMANBER_HASH_SIZE; i > 0; i--)
+        wm->candidate[i] = wm->candidate[i - 1];
+    wm->candidate[0] = 0;
+    
+    wm->patterns = patterns;
+    wm->pattern_count = count;
+    
+    free(run_end);
+    
+    return wm;
+exit_error:
+    if (wm != NULL)
+        free(wm);
+    if (patterns != NULL)
+        free(patterns);
+    if (run_end != NULL)
+        free(run_end);
+    
+    return NULL;
+}
+
+void WuManber_Free(wumanber_t *wm) {
+    assert(wm);
+    
+    free(wm->patterns);
+    free(wm);
+}
+
+static bool WuManber_Compare(
+        const wumanber_pattern_t *pattern, const uint8_t *data) {
+    size_t i;
+    
+    for (i = 0; i < pattern->data_size; i++)
+        if ((data[i] ^ pattern->data[i]) & pattern->mask[i])
+            return false;
+    
+    return true;
+}
+
+size_t WuManber_Run(
+        const wumanber_t *wm, uint8_t *data,
+        size_t length, fsm_match_t match_fn) {
+    size_t i, examined;
+    
+    assert(wm != NULL);
+    assert(data != NULL);
+    assert(match_fn != NULL);
+    
+    examined = 0;
+    
+    /* i is the end of the window. */
+    for (i = wm->window; i <= length; ) {
+        unsigned int hash;
+        uint32_t k;
+        
+        hash = WuManber_Hash(data + i - WUMANBER_BLOCK);
+        examined++;
+        
+        if (wm->shift[hash] > 0) {
+            i += wm->shift[hash];
+            continue;
+        }
+        
+        for (k = wm->candidate[hash]; k < wm->candidate[hash + 1]; k++) {
+            const wumanber_pattern_t *pattern;
+            size_t start;
+            
+            pattern = &wm->patterns[k];
+            
+            if (i - wm->window < pattern->anchor)
+                continue;
+            
+            start = i - wm->window - pattern->anchor;
+            if (start + pattern->data_size > length)
+                continue;
+            
+            if (WuManber_Compare(pattern, data + start))
+                match_fn(
+                    pattern->symbol,
+                    data + start + pattern->data_size -
+                    Symbol_GetSymbol(pattern->symbol)->offset);
+        }
+        
+        i++;
+    }
+    
+    return examined;
+}
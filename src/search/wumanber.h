@@ -0,0 +1,55 @@
+/* wumanber.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+ 
+#ifndef WUMANBER_H_
+#define WUMANBER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "symbol.h"
+
+/* A Wu-Manber search finds many symbols at once while skipping over most of
+ * the data. Each symbol is found by a fixed length window of its data with no
+ * masked bits, so only symbols with a long enough such run can use it. The
+ * rest must still be found by an FSM. */
+
+typedef struct wumanber_t wumanber_t;
+
+bool WuManber_SymbolEligible(const symbol_t *symbol);
+/* Like FSM_Create, symbols are indices for Symbol_GetSymbolSize. */
+wumanber_t *WuManber_Create(const symbol_index_t *symbols, size_t count);
+void WuManber_Free(wumanber_t *wm);
+/* Calls match_fn exactly as FSM_Run would. Returns the number of positions at
+ * which the data was examined. */
+size_t WuManber_Run(
+    const wumanber_t *wm, uint8_t *data,
+    size_t length, fsm_match_t match_fn);
+
+#endif /* WUMANBER_H_ */
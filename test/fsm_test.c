@@ -549,3 +549,523 @@ int FSMTest_Run4(void) {
         
     return fsm3 == NULL;
 }
+
+int FSMTest_Lazy0(void) {
+    fsm_t *fsms[2];
+    fsm_lazy_t *lazy = NULL;
+    symbol_t *sym;
+    const uint8_t *results1[3];
+    const uint8_t *results2[3];
+    uint8_t data1[] = { 0x00, 0x01, 0x00, 0x00 };
+    uint8_t mask1[] = { 0x00, 0xff, 0xff, 0x00 };
+    uint8_t data2[] = { 0x01, 0x00, 0x00, 0x00 };
+    uint8_t mask2[] = { 0xff, 0x00, 0x00, 0xff };
+    uint8_t test[] = { 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x03 };
+    
+    sym = Symbol_GetSymbol(0);
+    sym->index = 0;
+    sym->data = data1;
+    sym->mask = mask1;
+    sym->data_size = sizeof(data1);
+    sym->offset = 4;
+    sym->name = (const char *)results1;
+    sym->size = 0;
+    
+    sym = Symbol_GetSymbol(1);
+    sym->index = 1;
+    sym->data = data2;
+    sym->mask = mask2;
+    sym->data_size = sizeof(data2);
+    sym->offset = 4;
+    sym->name = (const char *)results2;
+    sym->size = 0;
+    
+    fsms[0] = FSM_Create(0);
+    fsms[1] = FSM_Create(1);
+    
+    if (fsms[0] && fsms[1]) { 
+        lazy = FSM_LazyCreate(fsms, 2, 0);
+        
+        if (lazy) {
+            FSM_LazyRun(lazy, test, sizeof(test), FSMTest_SymbolDetect);
+        
+            FSM_LazyFree(lazy);
+        }
+    }
+    
+    if (lazy == NULL) {
+        if (fsms[0])
+            FSM_Free(fsms[0]);
+        if (fsms[1])
+            FSM_Free(fsms[1]);
+        return 1;
+    }
+        
+    if (Symbol_GetSymbol(0)->size != 3)
+        return 101;
+    if (results1[0] != &test[0])
+        return 102;
+    if (results1[1] != &test[3])
+        return 103;
+    if (results1[2] != &test[5])
+        return 104;
+    if (Symbol_GetSymbol(1)->size != 2)
+        return 105;
+    if (results2[0] != &test[0])
+        return 106;
+    if (results2[1] != &test[4])
+        return 107;
+        
+    return 0;
+}
+
+static unsigned int fsm_test_count[4];
+static uint32_t fsm_test_sum[4];
+
+void FSMTest_SymbolCount(const symbol_index_t symbol, uint8_t *address) {
+    fsm_test_count[symbol]++;
+    fsm_test_sum[symbol] += (uint32_t)(uintptr_t)address;
+}
+
+/* the end of the data, for FSMTest_PatternCount. */
+static uint8_t *fsm_test_end;
+
+/* Counts matches as Search_SymbolMatch does: the FSM only finds the anchor of
+ * a pattern, so the whole pattern is checked. */
+static void FSMTest_PatternCount(
+        const symbol_index_t symbol, uint8_t *address) {
+    const symbol_t *sym;
+    
+    sym = Symbol_GetSymbol(symbol);
+    if (sym->pattern != NULL &&
+        !Symbol_PatternMatch(
+            sym->pattern, address + sym->offset,
+            fsm_test_end - (address + sym->offset)))
+        return;
+    
+    FSMTest_SymbolCount(symbol, address);
+}
+
+static const uint8_t fsm_test_random_data[4][4] = {
+    { 0x38, 0x60, 0x00, 0x00 },
+    { 0x4e, 0x80, 0x00, 0x20 },
+    { 0x7c, 0x08, 0x02, 0xa6 },
+    { 0x90, 0x01, 0x00, 0x00 },
+};
+static const uint8_t fsm_test_random_mask[4][4] = {
+    { 0xff, 0xe0, 0x00, 0x00 },
+    { 0xff, 0xff, 0xff, 0xff },
+    { 0xff, 0x1f, 0xff, 0xff },
+    { 0xfc, 0x1f, 0xff, 0x00 },
+};
+
+/* Sets up 4 symbols, and fills test with semi random data that matches them
+ * frequently. */
+static void FSMTest_RandomSetup(uint8_t *test, size_t length) {
+    symbol_t *sym;
+    uint32_t seed;
+    size_t i;
+    
+    seed = 1;
+    for (i = 0; i + 4 <= length; i += 4) {
+        seed = seed * 1103515245 + 12345;
+        memcpy(test + i, fsm_test_random_data[(seed >> 16) & 3], 4);
+        test[i + (seed >> 20) % 4] ^= seed >> 24;
+    }
+    
+    for (i = 0; i < 4; i++) {
+        sym = Symbol_GetSymbol(i);
+        sym->index = i;
+        sym->data = fsm_test_random_data[i];
+        sym->mask = fsm_test_random_mask[i];
+        sym->data_size = sizeof(fsm_test_random_data[i]);
+        sym->offset = 4;
+    }
+}
+
+/* Merges the 4 symbols from FSMTest_RandomSetup. */
+static fsm_t *FSMTest_RandomMerge(void) {
+    fsm_t *merge = NULL, *fsm, *tmp;
+    unsigned int i;
+    
+    for (i = 0; i < 4; i++) {
+        fsm = FSM_Create(i);
+        if (fsm == NULL)
+            goto exit_error;
+        
+        if (merge == NULL) {
+            merge = fsm;
+        } else {
+            tmp = FSM_Merge(merge, fsm);
+            FSM_Free(fsm);
+            FSM_Free(merge);
+            merge = tmp;
+            if (merge == NULL)
+                goto exit_error;
+        }
+    }
+    
+    return merge;
+exit_error:
+    if (merge != NULL)
+        FSM_Free(merge);
+    return NULL;
+}
+
+int FSMTest_Lazy1(void) {
+    fsm_t *fsms[4], *merge;
+    fsm_lazy_t *lazy = NULL;
+    unsigned int count[4], i, flush_count = 0;
+    uint32_t sum[4];
+    uint8_t test[4096];
+    
+    FSMTest_RandomSetup(test, sizeof(test));
+    
+    for (i = 0; i < 4; i++) {
+        fsms[i] = FSM_Create(i);
+        if (fsms[i] == NULL)
+            return 1;
+    }
+    
+    merge = FSMTest_RandomMerge();
+    if (merge == NULL)
+        return 1;
+    
+    lazy = FSM_LazyCreate(fsms, 4, 0);
+    if (lazy == NULL)
+        return 1;
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    FSM_Run(merge, test, sizeof(test), FSMTest_SymbolCount);
+    memcpy(count, fsm_test_count, sizeof(count));
+    memcpy(sum, fsm_test_sum, sizeof(sum));
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    FSM_LazyRun(lazy, test, sizeof(test), FSMTest_SymbolCount);
+    flush_count = lazy->flush_count;
+    
+    FSM_LazyFree(lazy);
+    FSM_Free(merge);
+    
+    for (i = 0; i < 4; i++) {
+        if (count[i] == 0)
+            return 101;
+        if (fsm_test_count[i] != count[i])
+            return 102;
+        if (fsm_test_sum[i] != sum[i])
+            return 103;
+    }
+    /* the cache is tiny, so must have been emptied. */
+    if (flush_count == 0)
+        return 104;
+    
+    return 0;
+}
+
+int FSMTest_Compact0(void) {
+    fsm_t *merge;
+    unsigned int count[4], i, node_count;
+    uint32_t sum[4];
+    uint8_t test[4096];
+    
+    FSMTest_RandomSetup(test, sizeof(test));
+    
+    merge = FSMTest_RandomMerge();
+    if (merge == NULL)
+        return 1;
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    FSM_Run(merge, test, sizeof(test), FSMTest_SymbolCount);
+    memcpy(count, fsm_test_count, sizeof(count));
+    memcpy(sum, fsm_test_sum, sizeof(sum));
+    
+    node_count = merge->node_count;
+    
+    if (!FSM_Compact(merge)) {
+        FSM_Free(merge);
+        return 1;
+    }
+    
+    if (merge->node_count != 0 || merge->table == NULL)
+        return 101;
+    /* most transitions should be defaults, so the table should be much
+     * smaller than 16 transitions per node. */
+    if (merge->table_size + merge->epsilon_count * 2 >= node_count * 8)
+        return 102;
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    FSM_Run(merge, test, sizeof(test), FSMTest_SymbolCount);
+    
+    FSM_Free(merge);
+    
+    for (i = 0; i < 4; i++) {
+        if (count[i] == 0)
+            return 103;
+        if (fsm_test_count[i] != count[i])
+            return 104;
+        if (fsm_test_sum[i] != sum[i])
+            return 105;
+    }
+    
+    return 0;
+}
+
+/* (38|7c) [011111??] {1,3} 4e 80 (2|3)0, which has a class that isn't a mask
+ * and a gap. */
+static symbol_pattern_t *FSMTest_PatternCreate(void) {
+    symbol_pattern_t *pattern;
+    symbol_pattern_element_t *element;
+    unsigned int i;
+    
+    pattern = calloc(
+        1, sizeof(symbol_pattern_t) + 6 * sizeof(symbol_pattern_element_t));
+    if (pattern == NULL)
+        return NULL;
+    
+    pattern->element_count = 6;
+    element = pattern->elements;
+    element[0].accept[0x38 / 32] |= 1u << (0x38 % 32);
+    element[0].accept[0x7c / 32] |= 1u << (0x7c % 32);
+    for (i = 0x7c; i <= 0x7f; i++)
+        element[1].accept[i / 32] |= 1u << (i % 32);
+    element[2].gap_min = 1;
+    element[2].gap_max = 3;
+    element[3].accept[0x4e / 32] |= 1u << (0x4e % 32);
+    element[4].accept[0x80 / 32] |= 1u << (0x80 % 32);
+    element[5].accept[0x20 / 32] |= 1u << (0x20 % 32);
+    element[5].accept[0x30 / 32] |= 1u << (0x30 % 32);
+    
+    return pattern;
+}
+
+/* Returns true if the pattern matches at test with the gap being gap long. */
+static bool FSMTest_PatternMatch(
+        const symbol_pattern_t *pattern, const uint8_t *test, size_t length,
+        size_t gap) {
+    size_t i, j;
+    
+    for (i = 0, j = 0; i < pattern->element_count; i++) {
+        const symbol_pattern_element_t *element;
+        
+        element = &pattern->elements[i];
+        if (element->gap_max != 0) {
+            j += gap;
+            continue;
+        }
+        
+        if (j >= length)
+            return false;
+        if (!((element->accept[test[j] / 32] >> (test[j] % 32)) & 1))
+            return false;
+        j++;
+    }
+    
+    return true;
+}
+
+int FSMTest_Pattern0(void) {
+    fsm_t *fsm, *plain, *merge;
+    symbol_t *sym;
+    symbol_pattern_t *pattern;
+    unsigned int count[2], i;
+    uint32_t sum[2];
+    uint8_t test[4096];
+    uint32_t seed;
+    size_t j, gap;
+    
+    pattern = FSMTest_PatternCreate();
+    if (pattern == NULL)
+        return 1;
+    
+    /* noise, with frequent partial and whole matches. */
+    seed = 1;
+    for (j = 0; j < sizeof(test); ) {
+        static const uint8_t match[] = {
+            0x7c, 0x7d, 0x00, 0x11, 0x22, 0x4e, 0x80, 0x30 };
+        size_t k;
+        
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 4 == 0) {
+            for (k = 0; k < sizeof(match) && j < sizeof(test); k++, j++)
+                test[j] = match[k];
+            /* change a byte, to make the gap shorter or break the match. */
+            test[j - 1 - (seed >> 20) % sizeof(match)] ^= seed >> 24;
+        } else {
+            test[j++] = seed >> 24;
+        }
+    }
+    
+    sym = Symbol_GetSymbol(0);
+    sym->index = 0;
+    sym->data = NULL;
+    sym->mask = NULL;
+    sym->data_size = 0;
+    sym->pattern = pattern;
+    sym->offset = 0;
+    
+    sym = Symbol_GetSymbol(1);
+    sym->index = 1;
+    sym->data = fsm_test_random_data[1];
+    sym->mask = fsm_test_random_mask[1];
+    sym->data_size = sizeof(fsm_test_random_data[1]);
+    sym->pattern = NULL;
+    sym->offset = 4;
+    
+    /* one match wherever any gap length fits. */
+    memset(count, 0, sizeof(count));
+    memset(sum, 0, sizeof(sum));
+    for (j = 0; j < sizeof(test); j++) {
+        for (gap = 1; gap <= 3; gap++) {
+            if (FSMTest_PatternMatch(
+                    pattern, test + j, sizeof(test) - j, gap)) {
+                count[0]++;
+                sum[0] += (uint32_t)(uintptr_t)(test + j);
+                break;
+            }
+        }
+        if (j + 4 <= sizeof(test) &&
+            memcmp(test + j, fsm_test_random_data[1], 4) == 0) {
+            count[1]++;
+            sum[1] += (uint32_t)(uintptr_t)(test + j);
+        }
+    }
+    
+    fsm_test_end = test + sizeof(test);
+    fsm = FSM_Create(0);
+    plain = FSM_Create(1);
+    if (fsm == NULL || plain == NULL)
+        return 1;
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    FSM_Run(fsm, test, sizeof(test), FSMTest_PatternCount);
+    
+    if (count[0] == 0)
+        return 101;
+    if (fsm_test_count[0] != count[0])
+        return 102;
+    if (fsm_test_sum[0] != sum[0])
+        return 103;
+    
+    merge = FSM_Merge(fsm, plain);
+    FSM_Free(fsm);
+    FSM_Free(plain);
+    if (merge == NULL)
+        return 1;
+    
+    for (i = 0; i < 2; i++) {
+        memset(fsm_test_count, 0, sizeof(fsm_test_count));
+        memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+        FSM_Run(merge, test, sizeof(test), FSMTest_PatternCount);
+        
+        if (fsm_test_count[0] != count[0])
+            return 104;
+        if (fsm_test_sum[0] != sum[0])
+            return 105;
+        if (fsm_test_count[1] != count[1])
+            return 106;
+        if (fsm_test_sum[1] != sum[1])
+            return 107;
+        
+        /* and again once compacted. */
+        if (i == 0 && !FSM_Compact(merge)) {
+            FSM_Free(merge);
+            return 1;
+        }
+    }
+    
+    FSM_Free(merge);
+    free(pattern);
+    
+    return 0;
+}
+
+/* 94 21 ff ?? {4,67} (38|7c) 08 02 a6, whose gap would make the FSM huge if
+ * it were in it. */
+int FSMTest_Pattern1(void) {
+    fsm_t *fsm;
+    symbol_t *sym;
+    symbol_pattern_t *pattern;
+    symbol_pattern_element_t *element;
+    static const uint8_t bytes[] = {
+        0x94, 0x21, 0xff, 0x00, 0x00, 0x00, 0x08, 0x02, 0xa6 };
+    uint8_t test[512];
+    unsigned int count;
+    uint32_t sum;
+    size_t i, j, gap;
+    
+    pattern = calloc(
+        1, sizeof(symbol_pattern_t) + 9 * sizeof(symbol_pattern_element_t));
+    if (pattern == NULL)
+        return 1;
+    
+    pattern->element_count = 9;
+    element = pattern->elements;
+    for (i = 0; i < 9; i++) {
+        if (i == 3)
+            memset(element[i].accept, 0xff, sizeof(element[i].accept));
+        else if (i != 4 && i != 5)
+            element[i].accept[bytes[i] / 32] |= 1u << (bytes[i] % 32);
+    }
+    element[4].gap_min = 4;
+    element[4].gap_max = 67;
+    element[5].accept[0x38 / 32] |= 1u << (0x38 % 32);
+    element[5].accept[0x7c / 32] |= 1u << (0x7c % 32);
+    
+    /* anchors everywhere, few of which are followed by the rest. */
+    for (j = 0; j < sizeof(test); j++)
+        test[j] = bytes[j % 4];
+    memcpy(test + 100, "\x7c\x08\x02\xa6", 4);
+    memcpy(test + 300, "\x38\x08\x02\xa6", 4);
+    memcpy(test + 500, "\x7c\x08\x02\xa6", 4);
+    
+    count = 0;
+    sum = 0;
+    for (j = 0; j < sizeof(test); j++) {
+        for (gap = 4; gap <= 67; gap++) {
+            if (FSMTest_PatternMatch(
+                    pattern, test + j, sizeof(test) - j, gap)) {
+                count++;
+                sum += (uint32_t)(uintptr_t)(test + j);
+                break;
+            }
+        }
+    }
+    
+    sym = Symbol_GetSymbol(0);
+    sym->index = 0;
+    sym->data = NULL;
+    sym->mask = NULL;
+    sym->data_size = 0;
+    sym->pattern = pattern;
+    sym->offset = 0;
+    
+    fsm = FSM_Create(0);
+    if (fsm == NULL)
+        return 1;
+    
+    /* only 94 21 ff is in the FSM. */
+    if (FSM_NodeCount(fsm) > 16)
+        return 101;
+    
+    memset(fsm_test_count, 0, sizeof(fsm_test_count));
+    memset(fsm_test_sum, 0, sizeof(fsm_test_sum));
+    fsm_test_end = test + sizeof(test);
+    FSM_Run(fsm, test, sizeof(test), FSMTest_PatternCount);
+    FSM_Free(fsm);
+    sym->pattern = NULL;
+    free(pattern);
+    
+    if (count == 0)
+        return 102;
+    if (fsm_test_count[0] != count)
+        return 103;
+    if (fsm_test_sum[0] != sum)
+        return 104;
+    
+    return 0;
+}
@@ -37,5 +37,10 @@ int FSMTest_Run1(void);
 int FSMTest_Run2(void);
 int FSMTest_Run3(void);
 int FSMTest_Run4(void);
+int FSMTest_Lazy0(void);
+int FSMTest_Lazy1(void);
+int FSMTest_Compact0(void);
+int FSMTest_Pattern0(void);
+int FSMTest_Pattern1(void);
 
 #endif /* FSM_TEST_H_ */
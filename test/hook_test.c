@@ -0,0 +1,293 @@
+/* hook_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/modules/hook.c"
+ 
+#include "hook_test.h"
+
+#include <stdint.h>
+
+/* where a b or bc at address goes. */
+static uint32_t HookTest_BranchTarget(uint32_t instruction, uint32_t address) {
+    int32_t offset;
+    
+    switch (instruction >> 26) {
+        case 18: {
+            offset = instruction & 0x03fffffc;
+            if (offset & 0x02000000)
+                offset -= 0x04000000;
+            break;
+        } case 16: {
+            offset = instruction & 0x0000fffc;
+            if (offset & 0x00008000)
+                offset -= 0x00010000;
+            break;
+        } default:
+            return 0;
+    }
+    
+    if (instruction & 2)
+        return offset;
+    return address + offset;
+}
+
+int HookTest_Chain0(void) {
+    /* three modules: A replaces f; B replaces f and g; C replaces f and h,
+     * whose hash is the same as f's. */
+    hook_chain_t hooks[] = {
+        { .name = "f", .hash = 1, .target = 0x81000000 },
+        { .name = NULL },
+        { .name = "f", .hash = 1, .target = 0x81001000 },
+        { .name = "g", .hash = 2, .target = 0x81002000 },
+        { .name = "f", .hash = 1, .target = 0x81003000 },
+        { .name = "h", .hash = 1, .target = 0x81004000 },
+    };
+    const size_t count = sizeof(hooks) / sizeof(*hooks);
+    uint32_t f[2] = { 0x9421fff0, 0x7c0802a6 }, g[2] = { 0x48001000, 0 };
+    uint32_t f_trampoline[HOOK_TRAMPOLINE_MAX];
+    uint32_t g_trampoline[HOOK_TRAMPOLINE_MAX], branch;
+    const uint32_t f_address = 0x80004000, g_address = 0x80005000;
+    const uint32_t space = 0x817ff000;
+    size_t i;
+    
+    if (!Hook_ChainBuild(hooks, count))
+        return 1;
+    
+    if (!hooks[0].first || hooks[2].first || !hooks[3].first ||
+        hooks[4].first || hooks[1].first || !hooks[5].first)
+        return 2;
+    if (hooks[0].next != 2 || hooks[2].next != 4 ||
+        hooks[4].next != HOOK_CHAIN_END || hooks[3].next != HOOK_CHAIN_END ||
+        hooks[5].next != HOOK_CHAIN_END)
+        return 3;
+    
+    /* h is missing from the game, so its trampoline is made elsewhere. */
+    if (!Hook_ChainLink(hooks, 5, NULL, space + 0x200, 0, 0, &branch) ||
+        branch != 0)
+        return 4;
+    
+    /* the rest in entry order, as the loader does. */
+    for (i = 0; i < count - 1; i++) {
+        uint32_t *function, *trampoline, address, trampoline_address;
+        
+        if (hooks[i].name == NULL)
+            continue;
+        if (hooks[i].name[0] == 'f') {
+            function = f;
+            address = f_address;
+            trampoline = f_trampoline;
+            trampoline_address = space;
+        } else {
+            function = g;
+            address = g_address;
+            trampoline = g_trampoline;
+            trampoline_address = space + 0x100;
+        }
+        
+        if (!Hook_ChainLink(
+                hooks, i, trampoline, trampoline_address, function[0], address,
+                &branch))
+            return 5;
+        if ((branch != 0) != hooks[i].first)
+            return 18;
+        if (branch != 0)
+            function[0] = branch;
+    }
+    
+    /* the game goes to the outermost replacement. */
+    if (HookTest_BranchTarget(f[0], f_address) != 0x81000000)
+        return 6;
+    if (HookTest_BranchTarget(g[0], g_address) != 0x81002000)
+        return 7;
+    
+    /* each calls straight through to the next, and the last to the single
+     * trampoline. */
+    if (Hook_ChainCallThrough(hooks, 0) != 0x81001000)
+        return 8;
+    if (Hook_ChainCallThrough(hooks, 2) != 0x81003000)
+        return 9;
+    if (Hook_ChainCallThrough(hooks, 4) != space)
+        return 10;
+    if (Hook_ChainCallThrough(hooks, 3) != space + 0x100)
+        return 11;
+    if (Hook_ChainCallThrough(hooks, 5) != space + 0x200)
+        return 16;
+    
+    /* the trampolines do the first instruction and carry on. */
+    if (f_trampoline[0] != 0x9421fff0)
+        return 12;
+    if (HookTest_BranchTarget(f_trampoline[1], space + 4) != f_address + 4)
+        return 13;
+    if (HookTest_BranchTarget(g_trampoline[0], space + 0x100) !=
+        g_address + 0x1000)
+        return 14;
+    if (HookTest_BranchTarget(g_trampoline[1], space + 0x104) != g_address + 4)
+        return 15;
+    
+    /* a replacement the game can't branch to is refused, untouched. */
+    hooks[0].target = f_address + 0x2000000;
+    hooks[0].trampoline = 0;
+    if (Hook_ChainLink(
+            hooks, 0, f_trampoline, space, 0x9421fff0, f_address, &branch) ||
+        hooks[0].trampoline != 0)
+        return 17;
+    
+    return 0;
+}
+
+int HookTest_Trampoline0(void) {
+    uint32_t trampoline[HOOK_TRAMPOLINE_MAX];
+    const uint32_t address = 0x80004000, trampoline_address = 0x817ff000;
+    
+    /* beq +12 needs an extra branch to reach from the trampoline. */
+    if (Hook_TrampolineSize(0x4182000c) != 12)
+        return 1;
+    if (Hook_Trampoline(
+            trampoline, trampoline_address, 0x4182000c, address) != 3)
+        return 2;
+    if ((trampoline[0] & 0xffff0003) != 0x41820000)
+        return 3;
+    if (HookTest_BranchTarget(trampoline[0], trampoline_address) !=
+        trampoline_address + 8)
+        return 4;
+    if (HookTest_BranchTarget(trampoline[1], trampoline_address + 4) !=
+        address + 4)
+        return 5;
+    if (HookTest_BranchTarget(trampoline[2], trampoline_address + 8) !=
+        address + 12)
+        return 6;
+    
+    /* bl keeps its link bit, going backwards. */
+    if (Hook_Trampoline(
+            trampoline, trampoline_address, 0x4bfffff1, address) != 2)
+        return 7;
+    if ((trampoline[0] & 3) != 1)
+        return 8;
+    if (HookTest_BranchTarget(trampoline[0], trampoline_address) !=
+        address - 16)
+        return 9;
+    
+    /* an absolute branch is just copied. */
+    if (Hook_Trampoline(
+            trampoline, trampoline_address, 0x48000102, address) != 2)
+        return 10;
+    if (trampoline[0] != 0x48000102)
+        return 11;
+    
+    return 0;
+}
+
+/* the offset from r1 of the context field the thunk stores r0 in, just after
+ * the instruction mf which reads a special register into r0. */
+static int32_t HookTest_ThunkSaved(const uint32_t *thunk, uint32_t mf) {
+    size_t i;
+    
+    for (i = 0; i + 1 < HOOK_THUNK_CALL; i++) {
+        if (thunk[i] == mf && (thunk[i + 1] & 0xffff0000) == 0x90010000)
+            return (int16_t)(thunk[i + 1] & 0xffff);
+    }
+    return -1;
+}
+
+int HookTest_Thunk0(void) {
+    uint32_t thunk[HOOK_THUNK_SIZE / 4];
+    const uint32_t address = 0x80004010, thunk_address = 0x817ff000;
+    const uint32_t callback = 0x81700000;
+    int32_t frame;
+    
+    /* a hook of a mflr r0. */
+    if (Hook_Thunk(thunk, thunk_address, callback, 0x7c0802a6, address) !=
+        HOOK_THUNK_BODY + 2)
+        return 1;
+    
+    /* stwu r1, -frame(r1), big enough for the context and aligned. */
+    if ((thunk[0] & 0xffff0000) != 0x94210000)
+        return 2;
+    frame = -(int16_t)(thunk[0] & 0xffff);
+    if (frame < 8 + (int32_t)sizeof(bslug_context_t) || frame % 8 != 0)
+        return 3;
+    if (thunk[HOOK_THUNK_BODY - 1] != (0x38210000 | frame))
+        return 4;
+    
+    /* the registers are where bslug_context_t says. */
+    if (thunk[1] != (0x90010000 | (8 + offsetof(bslug_context_t, gpr[0]))))
+        return 5;
+    if (thunk[2] != (0xbc410000 | (8 + offsetof(bslug_context_t, gpr[2]))))
+        return 6;
+    if (HookTest_ThunkSaved(thunk, 0x7c000026) !=
+        8 + offsetof(bslug_context_t, cr))
+        return 7;
+    if (HookTest_ThunkSaved(thunk, 0x7c0802a6) !=
+        8 + offsetof(bslug_context_t, lr))
+        return 8;
+    if (HookTest_ThunkSaved(thunk, 0x7c0902a6) !=
+        8 + offsetof(bslug_context_t, ctr))
+        return 9;
+    if (HookTest_ThunkSaved(thunk, 0x7c0102a6) !=
+        8 + offsetof(bslug_context_t, xer))
+        return 10;
+    if (thunk[HOOK_THUNK_CALL - 32] !=
+        (0xd9a10000 | (8 + offsetof(bslug_context_t, fpr[13]))))
+        return 11;
+    
+    /* ps1 of f13, by way of ps_merge11 f13, f13, f13, then FPSCR. */
+    if (thunk[HOOK_THUNK_CALL - 5] != 0x11ad6ce0 ||
+        thunk[HOOK_THUNK_CALL - 4] !=
+        (0xd1a10000 | (8 + offsetof(bslug_context_t, ps1[13]))))
+        return 12;
+    if (thunk[HOOK_THUNK_CALL - 3] != 0xfc00048e ||
+        thunk[HOOK_THUNK_CALL - 2] !=
+        (0xd8010000 | (8 + offsetof(bslug_context_t, fpscr_pad))))
+        return 13;
+    
+    /* the callback gets the context in r3, and is linked to. */
+    if (thunk[HOOK_THUNK_CALL - 1] != 0x38610008)
+        return 14;
+    if ((thunk[HOOK_THUNK_CALL] & 3) != 1 ||
+        HookTest_BranchTarget(
+            thunk[HOOK_THUNK_CALL], thunk_address + HOOK_THUNK_CALL * 4) !=
+        callback)
+        return 15;
+    
+    /* FPSCR comes back first, then ps1 before ps0 of each register. */
+    if (thunk[HOOK_THUNK_CALL + 1] !=
+        (0xc8010000 | (8 + offsetof(bslug_context_t, fpscr_pad))) ||
+        thunk[HOOK_THUNK_CALL + 2] != 0xfdfe058e)
+        return 16;
+    if (thunk[HOOK_THUNK_CALL + 29] !=
+        (0xc1a10000 | (8 + offsetof(bslug_context_t, ps1[13]))) ||
+        thunk[HOOK_THUNK_CALL + 30] !=
+        (0xc9a10000 | (8 + offsetof(bslug_context_t, fpr[13]))))
+        return 17;
+    
+    /* then the hooked instruction, and back to the one after. */
+    if (thunk[HOOK_THUNK_BODY] != 0x7c0802a6)
+        return 18;
+    if (HookTest_BranchTarget(
+            thunk[HOOK_THUNK_BODY + 1],
+            thunk_address + (HOOK_THUNK_BODY + 1) * 4) != address + 4)
+        return 19;
+    
+    return 0;
+}
@@ -0,0 +1,242 @@
+/* link_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/modules/link.c"
+#include "../src/modules/prelink.c"
+ 
+#include "link_test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LinkTest_Apply0(void) {
+    uint8_t data[24];
+    const link_image_t image = { data, 0x81700000, sizeof(data) };
+    link_target_t target;
+    
+    memset(&target, 0, sizeof(target));
+    memset(data, 0, sizeof(data));
+    
+    /* the words are big endian, whatever the host. */
+    if (Link_Apply(&target, &image, 0, R_PPC_ADDR32, 4, 0x80001230) !=
+        LINK_OK)
+        return 1;
+    if (memcmp(data, "\x80\x00\x12\x34", 4) != 0)
+        return 2;
+    
+    /* lis and addi of an address with bit 15 set. */
+    Link_Put32(data + 4, 0x3c600000);
+    Link_Put32(data + 8, 0x38630000);
+    if (Link_Apply(&target, &image, 6, R_PPC_ADDR16_HA, 0, 0x8000a000) !=
+        LINK_OK ||
+        Link_Apply(&target, &image, 10, R_PPC_ADDR16_LO, 0, 0x8000a000) !=
+        LINK_OK)
+        return 3;
+    if (Link_Get32(data + 4) != 0x3c608001 ||
+        Link_Get32(data + 8) != 0x3863a000)
+        return 4;
+    
+    /* bl backwards, keeping the link bit. */
+    Link_Put32(data + 12, 0x48000001);
+    if (Link_Apply(&target, &image, 12, R_PPC_REL24, 0, 0x81600000) !=
+        LINK_OK)
+        return 5;
+    if (Link_Get32(data + 12) != 0x4bf00001 - 12)
+        return 6;
+    
+    /* the offset in the section, whatever the address. */
+    if (Link_Apply(&target, &image, 16, R_PPC_SECTOFF, 8, 0) != LINK_OK ||
+        Link_Get32(data + 16) != 24)
+        return 7;
+    
+    /* nothing outside the image is changed. */
+    if (Link_Apply(&target, &image, 22, R_PPC_ADDR32, 0, 0) != LINK_OUTSIDE)
+        return 8;
+    if (Link_Apply(&target, &image, 0, R_PPC_NONE, 0, 0) != LINK_UNSUPPORTED)
+        return 9;
+    
+    return 0;
+}
+
+int LinkTest_Range0(void) {
+    uint8_t data[8];
+    const link_image_t image = { data, 0x81700000, sizeof(data) };
+    link_target_t target;
+    
+    memset(&target, 0, sizeof(target));
+    
+    /* branches must reach, as nothing is put between. */
+    Link_Put32(data, 0x48000001);
+    if (Link_Apply(&target, &image, 0, R_PPC_REL24, 0, 0x90000000) !=
+        LINK_BRANCH_RANGE)
+        return 1;
+    Link_Put32(data, 0x41820000);
+    if (Link_Apply(&target, &image, 0, R_PPC_REL14, 0, 0x81708000) !=
+        LINK_BRANCH_RANGE)
+        return 2;
+    
+    /* a bl at the far end of the range, keeping the link bit. */
+    Link_Put32(data, 0x48000001);
+    if (Link_Apply(&target, &image, 0, R_PPC_REL24, 0, 0x836ffffc) !=
+        LINK_OK ||
+        Link_Get32(data) != 0x49fffffd)
+        return 3;
+    
+    /* lwz r3, x@sda21(0) picks r13, r2 or r0 by what reaches. */
+    target.sda_base = 0x80500000;
+    target.sda2_base = 0x80510000;
+    Link_Put32(data + 4, 0x80600000);
+    if (Link_Apply(&target, &image, 6, R_PPC_EMB_SDA21, 0, 0x804ffff0) !=
+        LINK_OK ||
+        Link_Get32(data + 4) != 0x806dfff0)
+        return 4;
+    if (Link_Apply(&target, &image, 6, R_PPC_EMB_SDA21, 0, 0x80510008) !=
+        LINK_OK ||
+        Link_Get32(data + 4) != 0x80620008)
+        return 5;
+    if (Link_Apply(&target, &image, 6, R_PPC_EMB_SDA21, 0, 0x00000010) !=
+        LINK_OK ||
+        Link_Get32(data + 4) != 0x80600010)
+        return 6;
+    if (Link_Apply(&target, &image, 6, R_PPC_EMB_SDA21, 0, 0x80400000) !=
+        LINK_SMALL_DATA_RANGE)
+        return 7;
+    /* SDAREL16 is only for r13. */
+    if (Link_Apply(&target, &image, 6, R_PPC_SDAREL16, 0, 0x80510008) !=
+        LINK_SMALL_DATA_RANGE)
+        return 8;
+    
+    return 0;
+}
+
+int LinkTest_Prelinked0(void) {
+    FILE *file;
+    uint8_t buffer[512], *image, *load, *fixups;
+    prelink_header_t header;
+    prelink_fixup_t fixup;
+    link_image_t region;
+    link_target_t target;
+    size_t length, offset, i;
+    
+    file = fopen("link_test_prelinked0.mod", "rb");
+    if (!file)
+        return 6;
+    length = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    if (length < 44)
+        return 1;
+    
+    /* the file is big endian, whatever the host. */
+    memcpy(header.magic, buffer, sizeof(header.magic));
+    header.version = Link_Get32(buffer + 4);
+    header.flags = Link_Get32(buffer + 8);
+    header.meta_size = Link_Get32(buffer + 12);
+    header.image_size = Link_Get32(buffer + 16);
+    header.image_stored_size = Link_Get32(buffer + 20);
+    header.image_bss_size = Link_Get32(buffer + 24);
+    header.image_align = Link_Get32(buffer + 28);
+    header.load_size = Link_Get32(buffer + 32);
+    header.fixup_count = Link_Get32(buffer + 36);
+    header.names_size = Link_Get32(buffer + 40);
+    if (memcmp(header.magic, PRELINK_MAGIC, 4) != 0 ||
+        header.version != PRELINK_VERSION || header.flags != 0)
+        return 2;
+    
+    offset = 44 + header.meta_size + (-header.meta_size & 3);
+    image = calloc(1, header.image_size + header.image_bss_size);
+    if (image == NULL)
+        return 7;
+    memcpy(image, buffer + offset, header.image_size);
+    offset += header.image_size + (-header.image_size & 3);
+    load = buffer + offset;
+    offset += header.load_size + (-header.load_size & 3);
+    fixups = buffer + offset;
+    if (offset + header.fixup_count * 16 + header.names_size != length) {
+        free(image);
+        return 3;
+    }
+    
+    /* the internal fixups, as the loader does them, with the image at
+     * 0x81000000. The module's two names are OSReport and sdvar. */
+    memset(&target, 0, sizeof(target));
+    for (i = 0; i < header.fixup_count; i++) {
+        fixup.offset = Link_Get32(fixups + i * 16);
+        fixup.info = Link_Get32(fixups + i * 16 + 4);
+        fixup.addend = Link_Get32(fixups + i * 16 + 8);
+        fixup.symbol = Link_Get32(fixups + i * 16 + 12);
+        
+        if (!Prelink_FixupValid(&header, &fixup, 2)) {
+            free(image);
+            return 4;
+        }
+        if (fixup.info & PRELINK_FIXUP_EXTERNAL)
+            continue;
+        
+        if (PRELINK_FIXUP_REGION(fixup.info) == PRELINK_REGION_IMAGE) {
+            region.data = image;
+            region.size = header.image_size + header.image_bss_size;
+        } else {
+            region.data = load;
+            region.size = header.load_size;
+        }
+        region.address = 0x81000000;
+        if (Link_Apply(
+                &target, &region, fixup.offset,
+                PRELINK_FIXUP_TYPE(fixup.info), fixup.addend,
+                0x81000000 + fixup.symbol) != LINK_OK) {
+            free(image);
+            return 5;
+        }
+    }
+    free(image);
+    if (Link_Get32(load + 4) != 0x81000000 ||
+        Link_Get32(load + 8) != 0x81000020)
+        return 8;
+    
+    /* a fixup running off the end of its region is refused, and can't be
+     * applied anyway. */
+    fixup.offset = header.load_size - 2;
+    if (Prelink_FixupValid(&header, &fixup, 2))
+        return 9;
+    region.data = load;
+    region.size = header.load_size;
+    if (Link_Apply(
+            &target, &region, fixup.offset, PRELINK_FIXUP_TYPE(fixup.info),
+            fixup.addend, 0x81000000) != LINK_OUTSIDE)
+        return 10;
+    fixup.offset = 0xfffffffe;
+    if (Prelink_FixupValid(&header, &fixup, 2))
+        return 11;
+    
+    /* so is an external fixup against a name which isn't there. */
+    fixup.offset = 0;
+    fixup.info |= PRELINK_FIXUP_EXTERNAL;
+    fixup.symbol = 2;
+    if (Prelink_FixupValid(&header, &fixup, 2))
+        return 12;
+    
+    return 0;
+}
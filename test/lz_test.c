@@ -0,0 +1,117 @@
+/* lz_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/modules/lz.c"
+ 
+#include "lz_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* "abcabcabcabcabcabcabcab" hand compressed: 3 literals then a 20 byte match
+ * at offset 3, then a last sequence with no literals. */
+static const uint8_t lz_test_compressed[] = {
+    0x3f, 'a', 'b', 'c', 0x03, 0x00, 0x01, 0x00
+};
+
+int LZTest_Decompress0(void) {
+    const char *expected = "abcabcabcabcabcabcabcab";
+    uint8_t out[23];
+    
+    if (!LZ_Decompress(
+            lz_test_compressed, sizeof(lz_test_compressed), out, sizeof(out)))
+        return 1;
+    if (memcmp(out, expected, sizeof(out)) != 0)
+        return 2;
+    
+    /* the output must be exactly the given size. */
+    if (LZ_Decompress(
+            lz_test_compressed, sizeof(lz_test_compressed), out,
+            sizeof(out) - 1))
+        return 3;
+    /* the match can't reach before the start. */
+    if (LZ_Decompress(
+            lz_test_compressed + 3, sizeof(lz_test_compressed) - 3, out,
+            sizeof(out)))
+        return 4;
+    /* truncated in the match length. */
+    if (LZ_Decompress(
+            lz_test_compressed, sizeof(lz_test_compressed) - 2, out,
+            sizeof(out)))
+        return 5;
+    
+    return 0;
+}
+
+int LZTest_Compress0(void) {
+    static uint8_t test[16384], compressed[LZ_BOUND(16384)], out[16384];
+    uint32_t seed;
+    size_t i, j, size, length, offset;
+    
+    /* semi random data with runs and repeats, like code and zero filled
+     * tables. */
+    seed = 1;
+    for (i = 0; i < sizeof(test); i++) {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 28) == 0 && i >= 300) {
+            length = 4 + ((seed >> 16) & 255);
+            if (i + length > sizeof(test))
+                length = sizeof(test) - i;
+            offset = 1 + ((seed >> 8) & 255);
+            for (j = 0; j < length; j++)
+                test[i + j] = test[i + j - offset];
+            i += length - 1;
+        } else if ((seed >> 28) == 1) {
+            test[i] = 0;
+        } else
+            test[i] = seed >> 24;
+    }
+    
+    /* every size including the small ones which are all literals. */
+    for (size = 0; size <= sizeof(test); size += size < 64 ? 1 : 997) {
+        length = LZ_Compress(test, size, compressed);
+        if (length > LZ_BOUND(size))
+            return 1;
+        if (!LZ_Decompress(compressed, length, out, size))
+            return 2;
+        if (memcmp(out, test, size) != 0)
+            return 3;
+    }
+    
+    length = LZ_Compress(test, sizeof(test), compressed);
+    if (length >= sizeof(test) * 3 / 4)
+        return 4;
+    
+    /* long runs need the extended lengths. */
+    memset(test, 0x60, sizeof(test));
+    length = LZ_Compress(test, sizeof(test), compressed);
+    if (length >= 128)
+        return 5;
+    if (!LZ_Decompress(compressed, length, out, sizeof(test)))
+        return 6;
+    if (memcmp(out, test, sizeof(test)) != 0)
+        return 7;
+    
+    return 0;
+}
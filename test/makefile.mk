@@ -3,8 +3,17 @@ WD_SRC := $(WD)
 
 SRC  += $(WD)fsm_test.c
 INC_DIRS += $(WD)../src/linker
-TEST += 0 1 2 3 4 5 6 7 8 9 10 11
+TEST += 0 1 2 3 4 5 6 7 8 9 10 11 16 17 19 23 33
+SRC  += $(WD)hook_test.c
+TEST += 27 28 29
+SRC  += $(WD)link_test.c
+TEST += 30 31 32
+SRC  += $(WD)lz_test.c
+TEST += 24 25
 SRC  += $(WD)regression.c
 SRC  += $(WD)symbol_test.c
 INC_DIRS += $(WD)../src/libelf
-TEST += 12 13 14 15
+INC_DIRS += $(WD)..
+TEST += 12 13 14 15 18 22 26
+SRC  += $(WD)wumanber_test.c
+TEST += 20 21
@@ -25,7 +25,11 @@
 #include <stdlib.h>
 
 #include "fsm_test.h"
+#include "hook_test.h"
+#include "link_test.h"
+#include "lz_test.h"
 #include "symbol_test.h"
+#include "wumanber_test.h"
 
 typedef int (*test_t)(void);
 
@@ -46,6 +50,24 @@ test_t tests[] = {
     SymbolTest_Parse1,
     SymbolTest_Parse2,
     SymbolTest_Parse3,
+    FSMTest_Lazy0,
+    FSMTest_Lazy1,
+    SymbolTest_Parse4,
+    FSMTest_Compact0,
+    WuManberTest_Run0,
+    WuManberTest_Run1,
+    SymbolTest_Parse5,
+    FSMTest_Pattern0,
+    LZTest_Decompress0,
+    LZTest_Compress0,
+    SymbolTest_NameHash0,
+    HookTest_Chain0,
+    HookTest_Trampoline0,
+    HookTest_Thunk0,
+    LinkTest_Apply0,
+    LinkTest_Range0,
+    LinkTest_Prelinked0,
+    FSMTest_Pattern1,
 };
 
 #define TEST_COUNT (sizeof(tests) / sizeof(*tests))
@@ -33,6 +33,7 @@
 
 #include "../src/search/symbol.h"
 #include "../src/search/fsm.h"
+#include <bslug_include/bslug.h>
 
 int SymbolTest_Parse0(void) {
     FILE *file;
@@ -280,3 +281,161 @@ int SymbolTest_Parse3(void) {
     return 0;
 }
 
+int SymbolTest_Parse4(void) {
+    FILE *file;
+    symbol_t *symbol;
+
+    file = fopen("symbol_test_parse4.xml", "r");
+
+    if (!file)
+        return 6;
+    if (!Symbol_ParseFile(file))
+        return 101;
+    /* the invalid near hint still allocates a symbol. */
+    if (symbol_count != 3)
+        return 102;
+
+    symbol = Symbol_GetSymbol(0);
+    
+    if (strcmp(symbol->name, "GXSetViewportJitter") != 0)
+        return 103;
+    if (symbol->near != NULL)
+        return 104;
+    
+    symbol = Symbol_GetSymbol(1);
+    
+    if (strcmp(symbol->name, "GXSetViewport") != 0)
+        return 105;
+    if (symbol->near != NULL)
+        return 106;
+    
+    symbol = Symbol_GetSymbol(2);
+    
+    if (strcmp(symbol->name, "GXSetViewport") != 0)
+        return 107;
+    if (symbol->offset != 0xc)
+        return 108;
+    if (symbol->data_size != 12)
+        return 109;
+    if (symbol->near == NULL)
+        return 110;
+    if (strcmp(symbol->near, "GXSetViewportJitter") != 0)
+        return 111;
+    if (symbol->near_min != 0x3c)
+        return 112;
+    if (symbol->near_max != 0x100)
+        return 113;
+        
+    return 0;
+}
+
+int SymbolTest_Parse5(void) {
+    FILE *file;
+    symbol_t *symbol;
+    const symbol_pattern_element_t *element;
+
+    file = fopen("symbol_test_parse5.xml", "r");
+
+    if (!file)
+        return 6;
+    if (!Symbol_ParseFile(file))
+        return 101;
+    if (symbol_count != 3)
+        return 102;
+
+    /* only bit masks, so it should become data and a mask. */
+    symbol = Symbol_GetSymbol(0);
+    
+    if (strcmp(symbol->name, "Bits") != 0)
+        return 103;
+    if (symbol->pattern != NULL)
+        return 104;
+    if (symbol->data_size != 8)
+        return 105;
+    if (symbol->data[0] != 0x7c || symbol->mask[0] != 0xfe)
+        return 106;
+    if (symbol->data[3] != 0xa6 || symbol->mask[3] != 0xff)
+        return 107;
+    if (symbol->data[4] != 0x38 || symbol->mask[4] != 0xfb)
+        return 108;
+    
+    symbol = Symbol_GetSymbol(1);
+    
+    if (strcmp(symbol->name, "Gap") != 0)
+        return 109;
+    if (symbol->pattern == NULL)
+        return 110;
+    if (symbol->data != NULL || symbol->data_size != 0)
+        return 111;
+    if (symbol->offset != 4)
+        return 112;
+    if (symbol->pattern->element_count != 9)
+        return 113;
+    
+    element = &symbol->pattern->elements[4];
+    if (element->gap_min != 2 || element->gap_max != 4)
+        return 114;
+    
+    element = &symbol->pattern->elements[5];
+    if (element->gap_max != 0)
+        return 115;
+    if (!(element->accept[0x38 / 32] & (1u << (0x38 % 32))) ||
+        !(element->accept[0x7c / 32] & (1u << (0x7c % 32))) ||
+        (element->accept[0x3c / 32] & (1u << (0x3c % 32))))
+        return 116;
+    
+    element = &symbol->pattern->elements[6];
+    if (!(element->accept[0x60 / 32] & (1u << (0x60 % 32))) ||
+        !(element->accept[0x70 / 32] & (1u << (0x70 % 32))) ||
+        (element->accept[0x50 / 32] & (1u << (0x50 % 32))))
+        return 117;
+    
+    /* patterns can't start with a gap. */
+    symbol = Symbol_GetSymbol(2);
+    
+    if (strcmp(symbol->name, "LeadingGap") != 0)
+        return 118;
+    if (symbol->pattern != NULL || symbol->data_size != 0)
+        return 119;
+        
+    return 0;
+}
+
+int SymbolTest_NameHash0(void) {
+    FILE *file;
+    symbol_alphabetical_index_t index;
+    
+    /* the loader must agree with the hashes modules are built with. */
+    if (Symbol_NameHash("") != BSLUG_NAME_HASH(""))
+        return 101;
+    if (Symbol_NameHash("IOS_Ioctl") != BSLUG_NAME_HASH("IOS_Ioctl"))
+        return 102;
+    if (Symbol_NameHash("0123456789abcdef0123456789abcdef") !=
+        BSLUG_NAME_HASH("0123456789abcdef0123456789abcdef"))
+        return 103;
+    if (Symbol_NameHash("__ct__Q34nw4r3snd18SoundArchivePlayerFv") !=
+        BSLUG_NAME_HASH("__ct__Q34nw4r3snd18SoundArchivePlayerFv"))
+        return 104;
+    if (BSLUG_NAME_HASH("IOS_Ioctl") == BSLUG_NAME_HASH("IOS_Ioctlv"))
+        return 105;
+    if (BSLUG_NAME_HASH("IOS_Ioctl") >> 24 != 0)
+        return 106;
+    
+    file = fopen("symbol_test_parse1.xml", "r");
+
+    if (!file)
+        return 6;
+    if (!Symbol_ParseFile(file))
+        return 107;
+    
+    index = Symbol_SearchSymbolHash(
+        "IOS_Ioctl", BSLUG_NAME_HASH("IOS_Ioctl"));
+    if (index == SYMBOL_NULL)
+        return 108;
+    if (strcmp(Symbol_GetSymbolAlphabetical(index)->name, "IOS_Ioctl") != 0)
+        return 109;
+    if (Symbol_SearchSymbol("IOS_Ioctlv") != SYMBOL_NULL)
+        return 110;
+        
+    return 0;
+}
@@ -29,5 +29,8 @@ int SymbolTest_Parse0(void);
 int SymbolTest_Parse1(void);
 int SymbolTest_Parse2(void);
 int SymbolTest_Parse3(void);
+int SymbolTest_Parse4(void);
+int SymbolTest_Parse5(void);
+int SymbolTest_NameHash0(void);
 
 #endif /* SYMBOL_TEST_H_*/
@@ -0,0 +1,173 @@
+/* wumanber_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/search/symbol.h"
+
+#define Symbol_GetSymbol(index) (&wumanber_test_symbol[index])
+#define Symbol_GetSymbolSize(index) (&wumanber_test_symbol[index])
+
+symbol_t wumanber_test_symbol[4];
+
+#include "../src/search/wumanber.c"
+ 
+#include "wumanber_test.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+static const uint8_t wumanber_test_data[4][12] = {
+    { 0x94, 0x21, 0xff, 0xe0, 0x7c, 0x08, 0x02, 0xa6, 0x90, 0x01, 0x00, 0x00 },
+    { 0x38, 0x60, 0x00, 0x00, 0x4e, 0x80, 0x00, 0x20, 0x80, 0x01, 0x00, 0x24 },
+    { 0x7c, 0x08, 0x02, 0xa6, 0x90, 0x01, 0x00, 0x24, 0x48, 0x00, 0x00, 0x00 },
+    { 0x80, 0x01, 0x00, 0x24, 0x7c, 0x08, 0x03, 0xa6, 0x38, 0x21, 0x00, 0x20 },
+};
+static const uint8_t wumanber_test_mask[4][12] = {
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x0f },
+    { 0xff, 0xe0, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfc, 0x00, 0x00, 0x03 },
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+};
+
+static unsigned int wumanber_test_count[4];
+static uint32_t wumanber_test_sum[4];
+
+static void WuManberTest_SymbolCount(
+        const symbol_index_t symbol, uint8_t *address) {
+    wumanber_test_count[symbol]++;
+    wumanber_test_sum[symbol] += (uint32_t)(uintptr_t)address;
+}
+
+/* Sets up 4 symbols, and fills test with semi random data that matches them
+ * occasionally. */
+static void WuManberTest_RandomSetup(uint8_t *test, size_t length) {
+    symbol_t *sym;
+    uint32_t seed;
+    size_t i;
+    
+    seed = 1;
+    for (i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        test[i] = seed >> 24;
+        
+        if (i % 64 == 0 && i + 12 <= length) {
+            memcpy(test + i, wumanber_test_data[(seed >> 16) & 3], 12);
+            /* sometimes corrupt it, possibly only in a masked bit. */
+            if ((seed >> 20) & 1)
+                test[i + (seed >> 21) % 12] ^= 1 << ((seed >> 25) & 7);
+            i += 11;
+        }
+    }
+    
+    for (i = 0; i < 4; i++) {
+        sym = Symbol_GetSymbol(i);
+        sym->index = i;
+        sym->data = wumanber_test_data[i];
+        sym->mask = wumanber_test_mask[i];
+        sym->data_size = sizeof(wumanber_test_data[i]);
+        sym->offset = 12 + i;
+        sym->near = NULL;
+    }
+}
+
+int WuManberTest_Run0(void) {
+    symbol_index_t symbols[4] = { 0, 1, 2, 3 };
+    wumanber_t *wm;
+    unsigned int count[4], i;
+    uint32_t sum[4];
+    uint8_t test[4096];
+    size_t j;
+    
+    WuManberTest_RandomSetup(test, sizeof(test));
+    
+    for (i = 0; i < 4; i++) {
+        if (!WuManber_SymbolEligible(Symbol_GetSymbol(i)))
+            return 101;
+    }
+    
+    /* find every match the slow way. */
+    for (i = 0; i < 4; i++) {
+        count[i] = 0;
+        sum[i] = 0;
+        
+        for (j = 0; j + 12 <= sizeof(test); j++) {
+            size_t k;
+            
+            for (k = 0; k < 12; k++)
+                if ((test[j + k] ^ wumanber_test_data[i][k]) &
+                    wumanber_test_mask[i][k])
+                    break;
+            
+            if (k == 12) {
+                count[i]++;
+                sum[i] += (uint32_t)(uintptr_t)(test + j - i);
+            }
+        }
+    }
+    
+    wm = WuManber_Create(symbols, 4);
+    if (wm == NULL)
+        return 1;
+    
+    memset(wumanber_test_count, 0, sizeof(wumanber_test_count));
+    memset(wumanber_test_sum, 0, sizeof(wumanber_test_sum));
+    WuManber_Run(wm, test, sizeof(test), WuManberTest_SymbolCount);
+    
+    WuManber_Free(wm);
+    
+    for (i = 0; i < 4; i++) {
+        if (count[i] == 0)
+            return 102;
+        if (wumanber_test_count[i] != count[i])
+            return 103;
+        if (wumanber_test_sum[i] != sum[i])
+            return 104;
+    }
+    
+    return 0;
+}
+
+int WuManberTest_Run1(void) {
+    symbol_index_t symbols[4] = { 0, 1, 2, 3 };
+    wumanber_t *wm;
+    uint8_t test[4096];
+    size_t examined;
+    
+    WuManberTest_RandomSetup(test, sizeof(test));
+    
+    wm = WuManber_Create(symbols, 4);
+    if (wm == NULL)
+        return 1;
+    
+    examined = WuManber_Run(wm, test, sizeof(test), WuManberTest_SymbolCount);
+    
+    WuManber_Free(wm);
+    
+    /* the data is mostly random, so most of it should be skipped. */
+    if (examined == 0)
+        return 101;
+    if (examined >= sizeof(test) / 3)
+        return 102;
+    
+    return 0;
+}
@@ -0,0 +1,1023 @@
+/* prelink.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Makes a prelinked module (see src/modules/prelink.h) from a module's ELF
+ * file, so that the loader needn't parse it or redo the relocations within
+ * it on every boot.
+ *
+ * Usage: prelink [-z] input.mod output.mod
+ *        prelink -t input.mod...
+ *
+ * With -z the image is compressed, which makes the file smaller and so
+ * quicker to read from the SD card; it is left as it is if that doesn't
+ * help.
+ *
+ * With -t each module is instead linked completely, as the loader would, into
+ * memory standing in for the Wii's. Every symbol from the game is given a
+ * made up address. Each relocation left to the loader is read back and
+ * checked, and the time taken and the number of relocations are reported,
+ * along with the size of the image with -z and how fast it decompresses. */
+
+#include <elfdefinitions.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "modules/link.h"
+#include "modules/lz.h"
+#include "modules/prelink.h"
+
+typedef struct {
+    const char *path;
+    uint8_t *file;
+    size_t file_size;
+    Elf32_Shdr *shdrs;
+    size_t shdr_count;
+    const char *shstrtab;
+    size_t shstrtab_size;
+    Elf32_Sym *symtab;
+    size_t symtab_count;
+    const char *strtab;
+    size_t strtab_size;
+    /* for each section in the image, its offset there, or -1. */
+    long *image_offsets;
+    size_t meta_shndx;
+    size_t load_shndx;
+    /* the output. */
+    prelink_header_t header;
+    uint8_t *image;
+    /* the image as it is in the file; either image or compressed. */
+    const uint8_t *image_stored;
+    uint8_t *compressed;
+    uint8_t *load;
+    prelink_fixup_t *fixups;
+    size_t fixup_capacity;
+    char *names;
+    size_t names_capacity;
+    size_t name_count;
+    /* every relocation of a loaded section, done here or left as a fixup. */
+    size_t relocation_count;
+} prelink_t;
+
+#define PRELINK_NAME_NONE ((uint32_t)-1)
+
+/* the made up memory map for -t: the image ends where the loader's module
+ * space does, and the game's functions and small data are below it. */
+#define PRELINK_TEST_LIST_END 0x81800000
+#define PRELINK_TEST_LOAD 0x81000000
+#define PRELINK_TEST_GAME 0x80004000
+#define PRELINK_TEST_SDA_BASE 0x80500000
+#define PRELINK_TEST_SDA2_BASE 0x80510000
+
+static uint32_t Prelink_Get32(const uint8_t *data);
+static uint16_t Prelink_Get16(const uint8_t *data);
+static void Prelink_Put32(uint8_t *data, uint32_t value);
+static bool Prelink_ReadFile(prelink_t *prelink);
+static bool Prelink_ReadElf(prelink_t *prelink);
+static const char *Prelink_SectionName(const prelink_t *prelink, size_t shndx);
+static bool Prelink_Layout(prelink_t *prelink);
+static bool Prelink_Relocate(prelink_t *prelink);
+static bool Prelink_Compress(prelink_t *prelink, bool compress);
+static bool Prelink_RelocateOne(
+    prelink_t *prelink, size_t target, uint32_t offset, uint32_t info,
+    int32_t addend, bool has_addend);
+static bool Prelink_Apply(
+    const prelink_t *prelink, size_t target, uint8_t *data,
+    uint32_t position, uint32_t offset, unsigned int type, int32_t addend,
+    uint32_t symbol);
+static bool Prelink_AddFixup(
+    prelink_t *prelink, uint32_t offset, uint32_t info, int32_t addend,
+    uint32_t symbol);
+static uint32_t Prelink_Name(prelink_t *prelink, const char *name);
+static bool Prelink_Write(const prelink_t *prelink, const char *path);
+static bool Prelink_WriteBlock(FILE *file, const void *data, size_t size);
+static void Prelink_Free(prelink_t *prelink);
+static int Prelink_Test(int count, char *paths[]);
+static bool Prelink_TestLink(prelink_t *prelink, size_t *checked);
+static bool Prelink_TestCompress(prelink_t *prelink, double *rate);
+static bool Prelink_TestCheck(
+    const link_target_t *target, const link_image_t *image, uint32_t offset,
+    unsigned int type, uint32_t value, bool *checked);
+
+int main(int argc, char *argv[]) {
+    prelink_t prelink;
+    bool compress;
+    int result = 1;
+    
+    if (argc >= 3 && strcmp(argv[1], "-t") == 0)
+        return Prelink_Test(argc - 2, argv + 2);
+    
+    compress = argc == 4 && strcmp(argv[1], "-z") == 0;
+    if (argc != 3 + compress) {
+        fprintf(
+            stderr,
+            "Usage: %s [-z] input.mod output.mod\n"
+            "       %s -t input.mod...\n", argv[0], argv[0]);
+        return 2;
+    }
+    argv += compress;
+    
+    memset(&prelink, 0, sizeof(prelink));
+    prelink.path = argv[1];
+    
+    if (!Prelink_ReadFile(&prelink))
+        goto exit_error;
+    if (!Prelink_ReadElf(&prelink))
+        goto exit_error;
+    if (!Prelink_Layout(&prelink))
+        goto exit_error;
+    if (!Prelink_Relocate(&prelink))
+        goto exit_error;
+    if (!Prelink_Compress(&prelink, compress))
+        goto exit_error;
+    if (!Prelink_Write(&prelink, argv[2]))
+        goto exit_error;
+    
+    result = 0;
+exit_error:
+    Prelink_Free(&prelink);
+    return result;
+}
+
+static void Prelink_Free(prelink_t *prelink) {
+    free(prelink->file);
+    free(prelink->shdrs);
+    free(prelink->symtab);
+    free(prelink->image_offsets);
+    free(prelink->image);
+    free(prelink->compressed);
+    free(prelink->load);
+    free(prelink->fixups);
+    free(prelink->names);
+}
+
+static uint32_t Prelink_Get32(const uint8_t *data) {
+    return
+        ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+        ((uint32_t)data[2] << 8) | data[3];
+}
+
+static uint16_t Prelink_Get16(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+}
+
+static void Prelink_Put32(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static bool Prelink_ReadFile(prelink_t *prelink) {
+    FILE *file;
+    long size;
+    
+    file = fopen(prelink->path, "rb");
+    if (file == NULL) {
+        perror(prelink->path);
+        return false;
+    }
+    
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET) != 0) {
+        perror(prelink->path);
+        fclose(file);
+        return false;
+    }
+    
+    prelink->file_size = size;
+    prelink->file = malloc(prelink->file_size + 1);
+    if (prelink->file == NULL ||
+        fread(prelink->file, 1, prelink->file_size, file) !=
+            prelink->file_size) {
+        fprintf(stderr, "%s: could not read file\n", prelink->path);
+        fclose(file);
+        return false;
+    }
+    
+    fclose(file);
+    return true;
+}
+
+static bool Prelink_ReadElf(prelink_t *prelink) {
+    const uint8_t *file = prelink->file;
+    uint32_t shoff;
+    size_t i, symtab_shndx;
+    
+    if (prelink->file_size < 52 ||
+        file[EI_MAG0] != ELFMAG0 || file[EI_MAG1] != ELFMAG1 ||
+        file[EI_MAG2] != ELFMAG2 || file[EI_MAG3] != ELFMAG3 ||
+        file[EI_CLASS] != ELFCLASS32 || file[EI_DATA] != ELFDATA2MSB) {
+        fprintf(
+            stderr, "%s: not a 32 bit big endian ELF file\n", prelink->path);
+        return false;
+    }
+    if (Prelink_Get16(file + 16) != ET_REL ||
+        Prelink_Get16(file + 18) != EM_PPC) {
+        fprintf(
+            stderr, "%s: not a relocatable PowerPC ELF file\n", prelink->path);
+        return false;
+    }
+    
+    shoff = Prelink_Get32(file + 32);
+    prelink->shdr_count = Prelink_Get16(file + 48);
+    if (Prelink_Get16(file + 46) != 40 || shoff > prelink->file_size ||
+        prelink->shdr_count > (prelink->file_size - shoff) / 40) {
+        fprintf(stderr, "%s: invalid section headers\n", prelink->path);
+        return false;
+    }
+    
+    prelink->shdrs = calloc(prelink->shdr_count, sizeof(Elf32_Shdr));
+    prelink->image_offsets = malloc(prelink->shdr_count * sizeof(long));
+    if (prelink->shdrs == NULL || prelink->image_offsets == NULL) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        return false;
+    }
+    
+    for (i = 0; i < prelink->shdr_count; i++) {
+        const uint8_t *shdr = file + shoff + i * 40;
+        
+        prelink->shdrs[i].sh_name = Prelink_Get32(shdr + 0);
+        prelink->shdrs[i].sh_type = Prelink_Get32(shdr + 4);
+        prelink->shdrs[i].sh_flags = Prelink_Get32(shdr + 8);
+        prelink->shdrs[i].sh_addr = Prelink_Get32(shdr + 12);
+        prelink->shdrs[i].sh_offset = Prelink_Get32(shdr + 16);
+        prelink->shdrs[i].sh_size = Prelink_Get32(shdr + 20);
+        prelink->shdrs[i].sh_link = Prelink_Get32(shdr + 24);
+        prelink->shdrs[i].sh_info = Prelink_Get32(shdr + 28);
+        prelink->shdrs[i].sh_addralign = Prelink_Get32(shdr + 32);
+        prelink->shdrs[i].sh_entsize = Prelink_Get32(shdr + 36);
+        prelink->image_offsets[i] = -1;
+        
+        if (prelink->shdrs[i].sh_type != SHT_NOBITS &&
+            (prelink->shdrs[i].sh_offset > prelink->file_size ||
+             prelink->shdrs[i].sh_size >
+                prelink->file_size - prelink->shdrs[i].sh_offset)) {
+            fprintf(stderr, "%s: section %zu is truncated\n", prelink->path, i);
+            return false;
+        }
+    }
+    
+    i = Prelink_Get16(file + 50);
+    if (i >= prelink->shdr_count || prelink->shdrs[i].sh_type != SHT_STRTAB) {
+        fprintf(stderr, "%s: no section names\n", prelink->path);
+        return false;
+    }
+    prelink->shstrtab = (const char *)file + prelink->shdrs[i].sh_offset;
+    prelink->shstrtab_size = prelink->shdrs[i].sh_size;
+    
+    symtab_shndx = 0;
+    for (i = 1; i < prelink->shdr_count; i++) {
+        const char *name;
+        
+        if (prelink->shdrs[i].sh_type == SHT_SYMTAB && symtab_shndx == 0)
+            symtab_shndx = i;
+        
+        name = Prelink_SectionName(prelink, i);
+        if (strcmp(name, ".bslug.meta") == 0)
+            prelink->meta_shndx = i;
+        else if (strcmp(name, ".bslug.load") == 0)
+            prelink->load_shndx = i;
+    }
+    
+    if (symtab_shndx == 0 ||
+        prelink->shdrs[symtab_shndx].sh_link >= prelink->shdr_count) {
+        fprintf(stderr, "%s: no symbol table\n", prelink->path);
+        return false;
+    }
+    if (prelink->meta_shndx == 0 || prelink->load_shndx == 0) {
+        fprintf(stderr, "%s: not a BSLUG module file\n", prelink->path);
+        return false;
+    }
+    
+    prelink->strtab = (const char *)file +
+        prelink->shdrs[prelink->shdrs[symtab_shndx].sh_link].sh_offset;
+    prelink->strtab_size =
+        prelink->shdrs[prelink->shdrs[symtab_shndx].sh_link].sh_size;
+    
+    prelink->symtab_count = prelink->shdrs[symtab_shndx].sh_size / 16;
+    prelink->symtab = calloc(prelink->symtab_count, sizeof(Elf32_Sym));
+    if (prelink->symtab == NULL && prelink->symtab_count > 0) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        return false;
+    }
+    
+    for (i = 0; i < prelink->symtab_count; i++) {
+        const uint8_t *sym =
+            file + prelink->shdrs[symtab_shndx].sh_offset + i * 16;
+        
+        prelink->symtab[i].st_name = Prelink_Get32(sym + 0);
+        prelink->symtab[i].st_value = Prelink_Get32(sym + 4);
+        prelink->symtab[i].st_size = Prelink_Get32(sym + 8);
+        prelink->symtab[i].st_info = sym[12];
+        prelink->symtab[i].st_other = sym[13];
+        prelink->symtab[i].st_shndx = Prelink_Get16(sym + 14);
+    }
+    
+    return true;
+}
+
+static const char *Prelink_SectionName(const prelink_t *prelink, size_t shndx) {
+    size_t name;
+    
+    name = prelink->shdrs[shndx].sh_name;
+    if (name >= prelink->shstrtab_size ||
+        memchr(prelink->shstrtab + name, '\0',
+               prelink->shstrtab_size - name) == NULL)
+        return "";
+    return prelink->shstrtab + name;
+}
+
+/* Puts every loaded section other than .bslug.meta and .bslug.load in the
+ * image, with the SHT_NOBITS ones at the end so they needn't be stored. */
+static bool Prelink_Layout(prelink_t *prelink) {
+    size_t i, size, pass;
+    uint32_t align;
+    
+    size = 0;
+    align = 1;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 1; i < prelink->shdr_count; i++) {
+            const Elf32_Shdr *shdr = &prelink->shdrs[i];
+            uint32_t section_align;
+            
+            if (!(shdr->sh_flags & SHF_ALLOC) ||
+                i == prelink->meta_shndx || i == prelink->load_shndx)
+                continue;
+            if (shdr->sh_type != (pass == 0 ? SHT_PROGBITS : SHT_NOBITS))
+                continue;
+            
+            section_align = shdr->sh_addralign;
+            if (section_align == 0 ||
+                (section_align & (section_align - 1)) != 0)
+                section_align = 1;
+            if (section_align > align)
+                align = section_align;
+            
+            size += -size & (section_align - 1);
+            prelink->image_offsets[i] = size;
+            size += shdr->sh_size;
+        }
+        
+        if (pass == 0)
+            prelink->header.image_size = size;
+    }
+    
+    prelink->header.image_bss_size = size - prelink->header.image_size;
+    prelink->header.image_align = align;
+    prelink->header.meta_size = prelink->shdrs[prelink->meta_shndx].sh_size;
+    prelink->header.load_size = prelink->shdrs[prelink->load_shndx].sh_size;
+    
+    prelink->image = calloc(prelink->header.image_size + 1, 1);
+    prelink->load = malloc(prelink->header.load_size + 1);
+    if (prelink->image == NULL || prelink->load == NULL) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        return false;
+    }
+    
+    for (i = 1; i < prelink->shdr_count; i++) {
+        if (prelink->image_offsets[i] != -1 &&
+            prelink->shdrs[i].sh_type == SHT_PROGBITS)
+            memcpy(
+                prelink->image + prelink->image_offsets[i],
+                prelink->file + prelink->shdrs[i].sh_offset,
+                prelink->shdrs[i].sh_size);
+    }
+    memcpy(
+        prelink->load,
+        prelink->file + prelink->shdrs[prelink->load_shndx].sh_offset,
+        prelink->header.load_size);
+    
+    return true;
+}
+
+static bool Prelink_Relocate(prelink_t *prelink) {
+    size_t i, j;
+    
+    for (i = 1; i < prelink->shdr_count; i++) {
+        const Elf32_Shdr *shdr = &prelink->shdrs[i];
+        size_t entry_size;
+        
+        if (shdr->sh_type != SHT_REL && shdr->sh_type != SHT_RELA)
+            continue;
+        if (shdr->sh_info >= prelink->shdr_count)
+            continue;
+        
+        if (shdr->sh_info == prelink->meta_shndx) {
+            fprintf(
+                stderr, "%s: .bslug.meta contains relocations\n",
+                prelink->path);
+            return false;
+        }
+        /* relocations of debugging information aren't needed. */
+        if (prelink->image_offsets[shdr->sh_info] == -1 &&
+            shdr->sh_info != prelink->load_shndx)
+            continue;
+        
+        entry_size = shdr->sh_type == SHT_REL ? 8 : 12;
+        for (j = 0; j < shdr->sh_size / entry_size; j++) {
+            const uint8_t *entry;
+            
+            entry = prelink->file + shdr->sh_offset + j * entry_size;
+            prelink->relocation_count++;
+            if (!Prelink_RelocateOne(
+                    prelink, shdr->sh_info, Prelink_Get32(entry),
+                    Prelink_Get32(entry + 4),
+                    shdr->sh_type == SHT_RELA ? Prelink_Get32(entry + 8) : 0,
+                    shdr->sh_type == SHT_RELA))
+                return false;
+        }
+    }
+    
+    return true;
+}
+
+/* Does one relocation in section target if it doesn't depend on where the
+ * module is loaded, or records a fixup for the loader if it does. */
+static bool Prelink_RelocateOne(
+        prelink_t *prelink, size_t target, uint32_t offset, uint32_t info,
+        int32_t addend, bool has_addend) {
+    const Elf32_Sym *symbol;
+    unsigned int type, region;
+    uint8_t *data;
+    uint32_t position;
+    
+    type = ELF32_R_TYPE(info);
+    if (target == prelink->load_shndx) {
+        region = PRELINK_REGION_LOAD;
+        data = prelink->load;
+        position = offset;
+    } else {
+        region = PRELINK_REGION_IMAGE;
+        data = prelink->image;
+        position = prelink->image_offsets[target] + offset;
+    }
+    
+    /* SHT_REL relocations read a word for the addend. */
+    if (offset > prelink->shdrs[target].sh_size ||
+        prelink->shdrs[target].sh_size - offset < (has_addend ? 2 : 4) ||
+        prelink->shdrs[target].sh_type != SHT_PROGBITS) {
+        fprintf(
+            stderr, "%s: relocation outside section %s\n", prelink->path,
+            Prelink_SectionName(prelink, target));
+        return false;
+    }
+    if (ELF32_R_SYM(info) >= prelink->symtab_count) {
+        fprintf(stderr, "%s: invalid symbol\n", prelink->path);
+        return false;
+    }
+    
+    /* SHT_REL keeps the addend in place, as the loader does. */
+    if (!has_addend)
+        addend = Prelink_Get32(data + position);
+    
+    symbol = &prelink->symtab[ELF32_R_SYM(info)];
+    switch (symbol->st_shndx) {
+        case SHN_UNDEF: {
+            uint32_t name;
+            
+            if (symbol->st_name >= prelink->strtab_size ||
+                memchr(prelink->strtab + symbol->st_name, '\0',
+                       prelink->strtab_size - symbol->st_name) == NULL) {
+                fprintf(stderr, "%s: invalid symbol name\n", prelink->path);
+                return false;
+            }
+            
+            name = Prelink_Name(prelink, prelink->strtab + symbol->st_name);
+            if (name == PRELINK_NAME_NONE) {
+                fprintf(stderr, "%s: out of memory\n", prelink->path);
+                return false;
+            }
+            
+            return Prelink_AddFixup(
+                prelink, position, PRELINK_FIXUP_INFO(type, region, true),
+                addend, name);
+        } case SHN_ABS: {
+            switch (type) {
+                case R_PPC_REL24:
+                case R_PPC_REL14:
+                case R_PPC_REL14_BRTAKEN:
+                case R_PPC_REL14_BRNTAKEN:
+                case R_PPC_REL32:
+                case R_PPC_ADDR30:
+                    break;
+                default:
+                    return Prelink_Apply(
+                        prelink, target, data, position, offset, type, addend,
+                        symbol->st_value);
+            }
+            
+            fprintf(
+                stderr, "%s: relative relocation to an absolute symbol\n",
+                prelink->path);
+            return false;
+        } default: {
+            uint32_t value;
+            
+            if (symbol->st_shndx >= prelink->shdr_count ||
+                prelink->image_offsets[symbol->st_shndx] == -1) {
+                fprintf(
+                    stderr, "%s: relocation against symbol in %s\n",
+                    prelink->path,
+                    symbol->st_shndx >= prelink->shdr_count ? "?" :
+                    Prelink_SectionName(prelink, symbol->st_shndx));
+                return false;
+            }
+            
+            value = prelink->image_offsets[symbol->st_shndx] +
+                symbol->st_value;
+            
+            switch (type) {
+                case R_PPC_REL24:
+                case R_PPC_REL14:
+                case R_PPC_REL14_BRTAKEN:
+                case R_PPC_REL14_BRNTAKEN:
+                case R_PPC_REL32:
+                case R_PPC_ADDR30: {
+                    /* within the image, the distance is fixed. */
+                    if (region == PRELINK_REGION_IMAGE)
+                        return Prelink_Apply(
+                            prelink, target, data, position, offset, type,
+                            addend, value);
+                    break;
+                } case R_PPC_SECTOFF:
+                case R_PPC_SECTOFF_LO:
+                case R_PPC_SECTOFF_HI:
+                case R_PPC_SECTOFF_HA: {
+                    return Prelink_Apply(
+                        prelink, target, data, position, offset, type,
+                        addend, value);
+                }
+            }
+            
+            return Prelink_AddFixup(
+                prelink, position, PRELINK_FIXUP_INFO(type, region, false),
+                addend, value);
+        }
+    }
+}
+
+/* Does a relocation with Link_Apply, as the loader does, on the copy of
+ * section target in data. position is where the relocation is, in the same
+ * terms as symbol, and offset is where it is in the section. */
+static bool Prelink_Apply(
+        const prelink_t *prelink, size_t target, uint8_t *data,
+        uint32_t position, uint32_t offset, unsigned int type, int32_t addend,
+        uint32_t symbol) {
+    link_target_t link_target;
+    link_image_t image;
+    
+    /* modules can't be given small data bases in advance. */
+    memset(&link_target, 0, sizeof(link_target));
+    image.data = data + position - offset;
+    image.address = position - offset;
+    image.size = prelink->shdrs[target].sh_size;
+    
+    switch (Link_Apply(&link_target, &image, offset, type, addend, symbol)) {
+        case LINK_OK:
+            return true;
+        case LINK_UNSUPPORTED:
+            fprintf(
+                stderr, "%s: unsupported relocation type %u\n", prelink->path,
+                type);
+            return false;
+        case LINK_BRANCH_RANGE:
+            fprintf(stderr, "%s: branch out of range\n", prelink->path);
+            return false;
+        case LINK_SMALL_DATA_RANGE:
+            fprintf(stderr, "%s: small data out of range\n", prelink->path);
+            return false;
+        default:
+            fprintf(
+                stderr, "%s: relocation outside section %s\n", prelink->path,
+                Prelink_SectionName(prelink, target));
+            return false;
+    }
+}
+
+static bool Prelink_AddFixup(
+        prelink_t *prelink, uint32_t offset, uint32_t info, int32_t addend,
+        uint32_t symbol) {
+    prelink_fixup_t *fixup;
+    
+    if (prelink->header.fixup_count == prelink->fixup_capacity) {
+        prelink_fixup_t *tmp;
+        
+        tmp = realloc(
+            prelink->fixups,
+            (prelink->fixup_capacity * 2 + 64) * sizeof(prelink_fixup_t));
+        if (tmp == NULL) {
+            fprintf(stderr, "%s: out of memory\n", prelink->path);
+            return false;
+        }
+        prelink->fixups = tmp;
+        prelink->fixup_capacity = prelink->fixup_capacity * 2 + 64;
+    }
+    
+    fixup = &prelink->fixups[prelink->header.fixup_count++];
+    fixup->offset = offset;
+    fixup->info = info;
+    fixup->addend = addend;
+    fixup->symbol = symbol;
+    
+    return true;
+}
+
+/* Returns the index of name in the names, adding it if needed, or
+ * PRELINK_NAME_NONE if there isn't memory to. */
+static uint32_t Prelink_Name(prelink_t *prelink, const char *name) {
+    size_t offset, length;
+    uint32_t index;
+    
+    index = 0;
+    for (offset = 0;
+         offset < prelink->header.names_size;
+         offset += strlen(prelink->names + offset) + 1) {
+        if (strcmp(prelink->names + offset, name) == 0)
+            return index;
+        index++;
+    }
+    
+    length = strlen(name) + 1;
+    if (prelink->header.names_size + length > prelink->names_capacity) {
+        char *tmp;
+        
+        tmp = realloc(
+            prelink->names, prelink->names_capacity * 2 + length + 256);
+        if (tmp == NULL)
+            return PRELINK_NAME_NONE;
+        prelink->names = tmp;
+        prelink->names_capacity = prelink->names_capacity * 2 + length + 256;
+    }
+    
+    memcpy(prelink->names + prelink->header.names_size, name, length);
+    prelink->header.names_size += length;
+    prelink->name_count++;
+    
+    return index;
+}
+
+static bool Prelink_Compress(prelink_t *prelink, bool compress) {
+    size_t size;
+    
+    prelink->image_stored = prelink->image;
+    prelink->header.image_stored_size = prelink->header.image_size;
+    if (!compress)
+        return true;
+    
+    prelink->compressed = malloc(LZ_BOUND(prelink->header.image_size));
+    if (prelink->compressed == NULL) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        return false;
+    }
+    
+    size = LZ_Compress(
+        prelink->image, prelink->header.image_size, prelink->compressed);
+    if (size < prelink->header.image_size) {
+        prelink->header.flags |= PRELINK_FLAG_COMPRESSED;
+        prelink->image_stored = prelink->compressed;
+        prelink->header.image_stored_size = size;
+    }
+    
+    return true;
+}
+
+static bool Prelink_Write(const prelink_t *prelink, const char *path) {
+    uint8_t header[sizeof(prelink_header_t)];
+    FILE *file;
+    size_t i;
+    bool result = false;
+    
+    memcpy(header, PRELINK_MAGIC, 4);
+    Prelink_Put32(header + 4, PRELINK_VERSION);
+    Prelink_Put32(header + 8, prelink->header.flags);
+    Prelink_Put32(header + 12, prelink->header.meta_size);
+    Prelink_Put32(header + 16, prelink->header.image_size);
+    Prelink_Put32(header + 20, prelink->header.image_stored_size);
+    Prelink_Put32(header + 24, prelink->header.image_bss_size);
+    Prelink_Put32(header + 28, prelink->header.image_align);
+    Prelink_Put32(header + 32, prelink->header.load_size);
+    Prelink_Put32(header + 36, prelink->header.fixup_count);
+    Prelink_Put32(header + 40, prelink->header.names_size);
+    
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    
+    if (!Prelink_WriteBlock(file, header, sizeof(header)) ||
+        !Prelink_WriteBlock(
+            file, prelink->file + prelink->shdrs[prelink->meta_shndx].sh_offset,
+            prelink->header.meta_size) ||
+        !Prelink_WriteBlock(
+            file, prelink->image_stored,
+            prelink->header.image_stored_size) ||
+        !Prelink_WriteBlock(
+            file, prelink->load, prelink->header.load_size))
+        goto exit_error;
+    
+    for (i = 0; i < prelink->header.fixup_count; i++) {
+        uint8_t fixup[sizeof(prelink_fixup_t)];
+        
+        Prelink_Put32(fixup + 0, prelink->fixups[i].offset);
+        Prelink_Put32(fixup + 4, prelink->fixups[i].info);
+        Prelink_Put32(fixup + 8, prelink->fixups[i].addend);
+        Prelink_Put32(fixup + 12, prelink->fixups[i].symbol);
+        if (!Prelink_WriteBlock(file, fixup, sizeof(fixup)))
+            goto exit_error;
+    }
+    
+    if (fwrite(prelink->names, 1, prelink->header.names_size, file) !=
+        prelink->header.names_size)
+        goto exit_error;
+    
+    result = true;
+exit_error:
+    if (!result)
+        fprintf(stderr, "%s: could not write file\n", path);
+    if (fclose(file) != 0)
+        result = false;
+    return result;
+}
+
+/* Writes data, padded to a multiple of 4 bytes. */
+static bool Prelink_WriteBlock(FILE *file, const void *data, size_t size) {
+    static const uint8_t zeroes[3];
+    
+    return
+        fwrite(data, 1, size, file) == size &&
+        fwrite(zeroes, 1, -size & 3, file) == (-size & 3);
+}
+
+/* Links each module of paths for -t, and reports on it. Returns non-zero if
+ * any fails. */
+static int Prelink_Test(int count, char *paths[]) {
+    int i, result = 0;
+    
+    for (i = 0; i < count; i++) {
+        prelink_t prelink;
+        size_t checked, external, j;
+        clock_t start, elapsed;
+        double rate;
+        bool linked;
+        
+        memset(&prelink, 0, sizeof(prelink));
+        prelink.path = paths[i];
+        
+        start = clock();
+        linked =
+            Prelink_ReadFile(&prelink) && Prelink_ReadElf(&prelink) &&
+            Prelink_Layout(&prelink) && Prelink_Relocate(&prelink);
+        elapsed = clock() - start;
+        /* the image is compressed as -z would, before the loader's fixups. */
+        linked = linked && Prelink_TestCompress(&prelink, &rate);
+        start = clock();
+        linked = linked && Prelink_TestLink(&prelink, &checked);
+        elapsed += clock() - start;
+        
+        if (linked) {
+            external = 0;
+            for (j = 0; j < prelink.header.fixup_count; j++) {
+                if (prelink.fixups[j].info & PRELINK_FIXUP_EXTERNAL)
+                    external++;
+            }
+            printf(
+                "%s: %zu relocations, %zu by the loader (%zu external), "
+                "%zu checked, %.3f ms\n",
+                prelink.path, prelink.relocation_count,
+                (size_t)prelink.header.fixup_count, external, checked,
+                elapsed * 1000.0 / CLOCKS_PER_SEC);
+            if (prelink.header.flags & PRELINK_FLAG_COMPRESSED)
+                printf(
+                    "%s: image %u bytes, %u with -z, decompressed at "
+                    "%.0f MB/s\n",
+                    prelink.path, (unsigned)prelink.header.image_size,
+                    (unsigned)prelink.header.image_stored_size, rate);
+            else
+                printf(
+                    "%s: image %u bytes, no smaller with -z\n",
+                    prelink.path, (unsigned)prelink.header.image_size);
+        } else
+            result = 1;
+        
+        Prelink_Free(&prelink);
+    }
+    
+    return result;
+}
+
+/* Does the fixups the loader would, with the image where the loader would put
+ * it. The game's symbols are made up: the ones used as small data are put
+ * near the small data bases, and the rest in the game's code. */
+static bool Prelink_TestLink(prelink_t *prelink, size_t *checked) {
+    link_target_t target;
+    link_image_t images[2];
+    bool *small = NULL, result = false;
+    uint32_t image_size;
+    size_t i;
+    
+    memset(&target, 0, sizeof(target));
+    target.sda_base = PRELINK_TEST_SDA_BASE;
+    target.sda2_base = PRELINK_TEST_SDA2_BASE;
+    
+    image_size = prelink->header.image_size + prelink->header.image_bss_size;
+    images[PRELINK_REGION_IMAGE].data = prelink->image;
+    images[PRELINK_REGION_IMAGE].address =
+        (PRELINK_TEST_LIST_END - image_size) &
+        ~(prelink->header.image_align - 1);
+    images[PRELINK_REGION_IMAGE].size = prelink->header.image_size;
+    images[PRELINK_REGION_LOAD].data = prelink->load;
+    images[PRELINK_REGION_LOAD].address = PRELINK_TEST_LOAD;
+    images[PRELINK_REGION_LOAD].size = prelink->header.load_size;
+    
+    small = calloc(prelink->name_count + 1, sizeof(bool));
+    if (small == NULL) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        goto exit_error;
+    }
+    for (i = 0; i < prelink->header.fixup_count; i++) {
+        const prelink_fixup_t *fixup = &prelink->fixups[i];
+        
+        if ((fixup->info & PRELINK_FIXUP_EXTERNAL) &&
+            (PRELINK_FIXUP_TYPE(fixup->info) == R_PPC_EMB_SDA21 ||
+             PRELINK_FIXUP_TYPE(fixup->info) == R_PPC_SDAREL16))
+            small[fixup->symbol] = true;
+    }
+    
+    *checked = 0;
+    for (i = 0; i < prelink->header.fixup_count; i++) {
+        const prelink_fixup_t *fixup = &prelink->fixups[i];
+        const link_image_t *image;
+        unsigned int type;
+        uint32_t symbol;
+        bool fixup_checked;
+        
+        type = PRELINK_FIXUP_TYPE(fixup->info);
+        image = &images[PRELINK_FIXUP_REGION(fixup->info)];
+        if (!(fixup->info & PRELINK_FIXUP_EXTERNAL))
+            symbol = images[PRELINK_REGION_IMAGE].address + fixup->symbol;
+        else if (small[fixup->symbol])
+            symbol =
+                PRELINK_TEST_SDA_BASE - 0x7ff8 + fixup->symbol % 0x1000 * 8;
+        else
+            symbol = PRELINK_TEST_GAME + fixup->symbol * 16;
+        
+        if (Link_Apply(
+                &target, image, fixup->offset, type, fixup->addend,
+                symbol) != LINK_OK) {
+            fprintf(
+                stderr, "%s: relocation type %u at %#x failed\n",
+                prelink->path, type, image->address + fixup->offset);
+            goto exit_error;
+        }
+        if (!Prelink_TestCheck(
+                &target, image, fixup->offset, type, symbol + fixup->addend,
+                &fixup_checked)) {
+            fprintf(
+                stderr, "%s: relocation type %u at %#x is wrong\n",
+                prelink->path, type, image->address + fixup->offset);
+            goto exit_error;
+        }
+        if (fixup_checked)
+            (*checked)++;
+    }
+    
+    result = true;
+exit_error:
+    free(small);
+    return result;
+}
+
+/* Compresses the image as -z does, and sets rate to how many MB/s of the
+ * image LZ_Decompress makes, over a tenth of a second of tries. Returns false
+ * if it doesn't decompress to the image. */
+static bool Prelink_TestCompress(prelink_t *prelink, double *rate) {
+    uint8_t *out;
+    size_t count;
+    clock_t start, elapsed;
+    bool result = false;
+    
+    *rate = 0;
+    if (!Prelink_Compress(prelink, true))
+        return false;
+    if (!(prelink->header.flags & PRELINK_FLAG_COMPRESSED))
+        return true;
+    
+    out = malloc(prelink->header.image_size);
+    if (out == NULL) {
+        fprintf(stderr, "%s: out of memory\n", prelink->path);
+        return false;
+    }
+    
+    count = 0;
+    start = clock();
+    do {
+        if (!LZ_Decompress(
+                prelink->compressed, prelink->header.image_stored_size, out,
+                prelink->header.image_size))
+            goto exit_error;
+        count++;
+        elapsed = clock() - start;
+    } while (elapsed < CLOCKS_PER_SEC / 10);
+    
+    if (memcmp(out, prelink->image, prelink->header.image_size) != 0)
+        goto exit_error;
+    *rate =
+        (double)count * prelink->header.image_size * CLOCKS_PER_SEC /
+        elapsed / 1000000;
+    
+    result = true;
+exit_error:
+    if (!result)
+        fprintf(stderr, "%s: image doesn't decompress\n", prelink->path);
+    free(out);
+    return result;
+}
+
+/* Reads back the relocation of type at offset in image, and returns whether it
+ * gives value, the symbol plus the addend. checked is set false for types
+ * which can't be read back alone. */
+static bool Prelink_TestCheck(
+        const link_target_t *target, const link_image_t *image,
+        uint32_t offset, unsigned int type, uint32_t value, bool *checked) {
+    const uint8_t *data;
+    uint32_t position, word;
+    int32_t branch;
+    
+    data = image->data + offset;
+    position = image->address + offset;
+    *checked = true;
+    
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_UADDR32:
+            return Prelink_Get32(data) == value;
+        case R_PPC_REL32:
+            return Prelink_Get32(data) == value - position;
+        case R_PPC_ADDR16_LO:
+            return Prelink_Get16(data) == (value & 0xffff);
+        case R_PPC_ADDR16_HI:
+            return Prelink_Get16(data) == value >> 16;
+        case R_PPC_ADDR16_HA:
+            return Prelink_Get16(data) == ((value + 0x8000) >> 16 & 0xffff);
+        case R_PPC_REL24: {
+            branch = Prelink_Get32(data) & 0x03fffffc;
+            if (branch & 0x02000000)
+                branch -= 0x04000000;
+            return position + branch == value;
+        } case R_PPC_REL14:
+        case R_PPC_REL14_BRTAKEN:
+        case R_PPC_REL14_BRNTAKEN: {
+            branch = Prelink_Get32(data) & 0x0000fffc;
+            if (branch & 0x00008000)
+                branch -= 0x00010000;
+            return position + branch == value;
+        } case R_PPC_SDAREL16: {
+            return
+                target->sda_base + (int16_t)Prelink_Get16(data) == value;
+        } case R_PPC_EMB_SDA21: {
+            word = Prelink_Get32(data - (position & 3));
+            switch (word >> 16 & 0x1f) {
+                case 13:
+                    word = target->sda_base;
+                    break;
+                case 2:
+                    word = target->sda2_base;
+                    break;
+                case 0:
+                    word = 0;
+                    break;
+                default:
+                    return false;
+            }
+            return word + (int16_t)Prelink_Get16(data) == value;
+        } default:
+            *checked = false;
+            return true;
+    }
+}